@@ -0,0 +1,433 @@
+/* 
+ * loopback benchmark, runs an echo server and a number of clients in
+ * the same process and reports throughput, or round-trip latency.
+ *
+ * usage: loopback [-t] [-r] [-u path] [-c conns] [-n msgs] [-s size] [-w window]
+ *                 [-b usecs]
+ *   -t  use wss:// (expects bench/cert.pem and bench/key.pem, and a
+ *       build with `make TLS=1`)
+ *   -u  connect over a unix domain socket at `path` instead of TCP
+ *   -r  measure round trips (one message in flight) instead of throughput
+ *   -c  number of client connections (default 1)
+ *   -n  messages sent per connection (default 100000)
+ *   -s  payload size in bytes (default 4096)
+ *   -w  messages in flight per connection (default 16)
+ *   -p  port (default 7760)
+ *   -S  time every Nth message on the server, and report where the
+ *       time went (default 0, off)
+ *   -b  have the server's threads busy poll for this long before
+ *       blocking in a read (default 0, off), and report the CPU time
+ *       spent spinning
+ */
+#define _GNU_SOURCE
+
+#include "../webs.h"
+
+#include <time.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
+
+#ifdef WEBS_TLS
+#include <openssl/ssl.h>
+#endif
+
+#define BENCH_CERT "bench/cert.pem"
+#define BENCH_KEY  "bench/key.pem"
+
+/* 
+ * benchmark parameters.
+ */
+struct bench_opts {
+	int tls;
+	int rtt;
+	int conns;
+	long msgs;
+	long size;
+	long window;
+	int port;
+	char* path;
+	long sample;
+	long busy_poll;
+};
+
+/* 
+ * a client connection (optionally over TLS).
+ */
+struct bench_conn {
+#ifdef WEBS_TLS
+	SSL* ssl;
+#endif
+	int fd;
+};
+
+/* 
+ * per-thread state and results.
+ */
+struct bench_thread {
+	struct bench_opts* opts;
+	pthread_t thread;
+	double* rtts;   /* round-trip times in microseconds (-r only) */
+	long done;      /* messages echoed back */
+	int error;
+};
+
+#ifdef WEBS_TLS
+static SSL_CTX* bench_ctx;
+#endif
+
+static int ktls_conns = 0;
+
+static double bench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int bench_write(struct bench_conn* _c, char* _buf, size_t _n) {
+	ssize_t n;
+	
+	while (_n) {
+#ifdef WEBS_TLS
+		if (_c->ssl) n = SSL_write(_c->ssl, _buf, _n); else
+#endif
+		n = write(_c->fd, _buf, _n);
+		if (n <= 0) return -1;
+		_buf += n, _n -= n;
+	}
+	
+	return 0;
+}
+
+static int bench_read(struct bench_conn* _c, char* _buf, size_t _n) {
+	ssize_t n;
+	
+	while (_n) {
+#ifdef WEBS_TLS
+		if (_c->ssl) n = SSL_read(_c->ssl, _buf, _n); else
+#endif
+		n = read(_c->fd, _buf, _n);
+		if (n <= 0) return -1;
+		_buf += n, _n -= n;
+	}
+	
+	return 0;
+}
+
+/* 
+ * connects to the echo server and completes the websocket handshake.
+ */
+static int bench_connect(struct bench_conn* _c, struct bench_opts* _o) {
+	struct sockaddr_in addr;
+	struct sockaddr_un uaddr;
+	char buf[1024];
+	const int ONE = 1;
+	int len = 0;
+	
+#ifdef WEBS_TLS
+	_c->ssl = NULL;
+#endif
+	
+	if (_o->path) {
+		_c->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (_c->fd < 0) return -1;
+		
+		memset(&uaddr, 0, sizeof(uaddr));
+		uaddr.sun_family = AF_UNIX;
+		strncpy(uaddr.sun_path, _o->path, sizeof(uaddr.sun_path) - 1);
+		
+		if (connect(_c->fd, (struct sockaddr*) &uaddr, sizeof(uaddr)) < 0)
+			return -1;
+	} else {
+		_c->fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (_c->fd < 0) return -1;
+		
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(_o->port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		
+		if (connect(_c->fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+			return -1;
+		
+		setsockopt(_c->fd, IPPROTO_TCP, TCP_NODELAY, &ONE, sizeof(int));
+	}
+	
+#ifdef WEBS_TLS
+	if (_o->tls) {
+		_c->ssl = SSL_new(bench_ctx);
+		SSL_set_fd(_c->ssl, _c->fd);
+		if (SSL_connect(_c->ssl) <= 0) return -1;
+	}
+#endif
+	
+	len = sprintf(buf, "GET / HTTP/1.1\r\nHost: localhost\r\n"
+		"Upgrade: websocket\r\nConnection: Upgrade\r\n"
+		"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+		"Sec-WebSocket-Version: 13\r\n\r\n");
+	
+	if (bench_write(_c, buf, len) < 0)
+		return -1;
+	
+	/* read the response one byte at a time so that no frame data
+	 * is consumed along with it */
+	for (len = 0; len < 4 || memcmp(buf + len - 4, "\r\n\r\n", 4); len++)
+		if (len == (int) sizeof(buf) || bench_read(_c, buf + len, 1) < 0)
+			return -1;
+	
+	return 0;
+}
+
+/* 
+ * builds a masked client frame holding `_n` bytes of payload.
+ */
+static size_t bench_make_frame(char* _dst, long _n) {
+	size_t off = 2;
+	long i;
+	
+	_dst[0] = (char) 0x82;
+	
+	if (_n > 65535) {
+		_dst[1] = (char) (0x80 | 127);
+		for (i = 0; i < 8; i++)
+			_dst[2 + i] = (char) ((uint64_t) _n >> (56 - 8 * i));
+		off = 10;
+	} else if (_n > 125) {
+		_dst[1] = (char) (0x80 | 126);
+		_dst[2] = (char) (_n >> 8);
+		_dst[3] = (char) _n;
+		off = 4;
+	} else _dst[1] = (char) (0x80 | _n);
+	
+	/* use an all-zero mask, so the payload goes through unchanged */
+	memset(_dst + off, 0, 4);
+	memset(_dst + off + 4, 'x', _n);
+	
+	return off + 4 + _n;
+}
+
+/* 
+ * reads one (unmasked) server frame, discarding its payload.
+ */
+static int bench_read_frame(struct bench_conn* _c, char* _buf) {
+	uint64_t len;
+	int i;
+	
+	if (bench_read(_c, _buf, 2) < 0) return -1;
+	len = _buf[1] & 0x7F;
+	
+	if (len == 126) {
+		if (bench_read(_c, _buf, 2) < 0) return -1;
+		len = ((uint8_t) _buf[0] << 8) | (uint8_t) _buf[1];
+	} else if (len == 127) {
+		if (bench_read(_c, _buf, 8) < 0) return -1;
+		for (len = 0, i = 0; i < 8; i++)
+			len = (len << 8) | (uint8_t) _buf[i];
+	}
+	
+	return bench_read(_c, _buf, len);
+}
+
+static void* bench_client(void* _t) {
+	struct bench_thread* t = _t;
+	struct bench_opts* o = t->opts;
+	struct bench_conn conn;
+	char* frame = malloc(o->size + 14);
+	char* rbuf = malloc(o->size + 14);
+	size_t frame_len = bench_make_frame(frame, o->size);
+	long sent = 0;
+	double start;
+	
+	if (bench_connect(&conn, o) < 0) {
+		t->error = 1;
+		return NULL;
+	}
+	
+	while (t->done < o->msgs) {
+		/* keep up to `window` messages in flight */
+		while (sent < o->msgs && sent - t->done < (o->rtt ? 1 : o->window)) {
+			start = bench_now();
+			if (bench_write(&conn, frame, frame_len) < 0) break;
+			sent++;
+		}
+		
+		if (bench_read_frame(&conn, rbuf) < 0) {
+			t->error = 1;
+			break;
+		}
+		
+		if (o->rtt)
+			t->rtts[t->done] = (bench_now() - start) * 1e6;
+		
+		t->done++;
+	}
+	
+#ifdef WEBS_TLS
+	if (conn.ssl) SSL_free(conn.ssl);
+#endif
+	close(conn.fd);
+	free(frame);
+	free(rbuf);
+	
+	return NULL;
+}
+
+/* 
+ * echo handlers for the server side.
+ */
+static int bench_on_data(webs_client* _self, char* _data, ssize_t _n) {
+	webs_sendn(_self, _data, _n);
+	return 0;
+}
+
+static int bench_on_open(webs_client* _self) {
+	if (_self->tls_flags & WEBS_KTLS_TX)
+		ktls_conns++;
+	return 0;
+}
+
+/* 
+ * reads the CPU time (user and system) used by the whole process.
+ */
+static double bench_cpu(void) {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6
+		+ ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+}
+
+static int bench_cmp(const void* _a, const void* _b) {
+	double a = *(const double*) _a, b = *(const double*) _b;
+	return (a > b) - (a < b);
+}
+
+int main(int argc, char** argv) {
+	struct bench_opts o = {0, 0, 1, 100000, 4096, 16, 7760, NULL, 0, 0};
+	struct bench_thread* threads;
+	struct webs_stats stats;
+	struct webs_latency lat;
+	webs_server* srv;
+	double start, elapsed, cpu, * all = NULL;
+	long total = 0, i, j, n = 0;
+	int c;
+	
+	while ((c = getopt(argc, argv, "tru:c:n:s:w:p:S:b:")) != -1) {
+		switch (c) {
+			case 't': o.tls = 1; break;
+			case 'r': o.rtt = 1; break;
+			case 'u': o.path = optarg; break;
+			case 'c': o.conns = atoi(optarg); break;
+			case 'n': o.msgs = atol(optarg); break;
+			case 's': o.size = atol(optarg); break;
+			case 'w': o.window = atol(optarg); break;
+			case 'p': o.port = atoi(optarg); break;
+			case 'S': o.sample = atol(optarg); break;
+			case 'b': o.busy_poll = atol(optarg); break;
+			default: return 1;
+		}
+	}
+	
+	if (o.size < 1) o.size = 1;
+	
+	if (o.tls && o.path) {
+		printf("-t and -u cannot be used together.\n");
+		return 1;
+	}
+	
+#ifdef WEBS_TLS
+	if (o.tls) {
+		bench_ctx = SSL_CTX_new(TLS_client_method());
+		srv = webs_start_tls(o.port, BENCH_CERT, BENCH_KEY);
+	} else
+#else
+	if (o.tls) {
+		printf("-t needs a build with `make TLS=1`.\n");
+		return 1;
+	}
+#endif
+	if (o.path) srv = webs_start_unix(o.path);
+	else srv = webs_start_at("127.0.0.1", o.port);
+	
+	if (srv == NULL) {
+		printf("failed to start server (for -t, run `make bench/cert.pem`).\n");
+		return 1;
+	}
+	
+	srv->events.on_data = bench_on_data;
+	srv->events.on_open = bench_on_open;
+	srv->sample_every = o.sample;
+	srv->busy_poll_us = o.busy_poll;
+	
+	threads = calloc(o.conns, sizeof(struct bench_thread));
+	
+	start = bench_now();
+	cpu = bench_cpu();
+	
+	for (i = 0; i < o.conns; i++) {
+		threads[i].opts = &o;
+		if (o.rtt) threads[i].rtts = malloc(o.msgs * sizeof(double));
+		pthread_create(&threads[i].thread, 0, bench_client, &threads[i]);
+	}
+	
+	for (i = 0; i < o.conns; i++) {
+		pthread_join(threads[i].thread, 0);
+		total += threads[i].done;
+		if (threads[i].error) printf("connection %ld failed.\n", i);
+	}
+	
+	elapsed = bench_now() - start;
+	cpu = bench_cpu() - cpu;
+	
+	webs_get_stats(srv, &stats);
+	
+	printf("%s  conns %d  size %ld  msgs %ld  %.3f s\n",
+		o.tls ? "wss" : o.path ? "ws+unix" : "ws",
+		o.conns, o.size, total, elapsed);
+	printf("  %.0f msg/s  %.1f MB/s echoed", total / elapsed,
+		total * (double) o.size / elapsed / 1e6);
+	if (o.tls) printf("  (kTLS on %d of %d connections)", ktls_conns, o.conns);
+	printf("\n");
+	
+	/* (clients and server together, since they share the process) */
+	printf("  cpu %.3f s  (%.0f%% of a core, %.2f us/msg)\n", cpu,
+		cpu / elapsed * 100, total ? cpu / total * 1e6 : 0.0);
+	
+	if (o.busy_poll)
+		printf("  server busy polling: %.3f s spinning, %lu reads found data\n",
+			stats.busy_us / 1e6, (unsigned long) stats.busy_polls);
+	
+	/* (unix sockets have no segments to count) */
+	if (stats.msgs_out) {
+		printf("  server: %.3f writes/msg", (double) stats.write_calls / stats.msgs_out);
+		if (!o.path) printf("  %.3f segments/msg", (double) stats.segs_out / stats.msgs_out);
+		printf("\n");
+	}
+	
+	webs_get_latency(srv, &lat);
+	
+	if (lat.samples) {
+		printf("  server us (%lu sampled): p50 %lu  p99 %lu  max %lu\n",
+			(unsigned long) lat.samples,
+			(unsigned long) webs_latency_percentile(&lat, 50),
+			(unsigned long) webs_latency_percentile(&lat, 99),
+			(unsigned long) lat.max_us);
+		printf("    mean read %.1f  wait %.1f  handler %.1f  write %.1f\n",
+			(double) lat.read_us / lat.samples, (double) lat.wait_us / lat.samples,
+			(double) lat.handler_us / lat.samples, (double) lat.write_us / lat.samples);
+	}
+	
+	if (o.rtt) {
+		all = malloc(total * sizeof(double));
+		
+		for (i = 0; i < o.conns; i++)
+			for (j = 0; j < threads[i].done; j++)
+				all[n++] = threads[i].rtts[j];
+		
+		qsort(all, n, sizeof(double), bench_cmp);
+		
+		if (n) printf("  rtt us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+			all[n / 2], all[n * 9 / 10], all[n * 99 / 100], all[n - 1]);
+	}
+	
+	return 0;
+}
@@ -0,0 +1,447 @@
+/* 
+ * microbenchmarks for the library's hot primitives, timed in isolation
+ * on fixed inputs across a range of payload sizes. each primitive's
+ * output is first checked against a reference (OpenSSL for SHA-1 and
+ * base-64, straightforward re-implementations for the rest), and the
+ * benchmark fails if any of them differ.
+ *
+ * usage: micro [-r runs] [-t target_us] [-f filter]
+ *   -r  timed runs per benchmark (default 31), after 3 warmup runs
+ *   -t  time each run should take, in microseconds (default 2000),
+ *       the number of calls per run is calibrated to match
+ *   -f  only run benchmarks whose name contains `filter`
+ *
+ * each row reports the median time per call (and per byte), the
+ * fastest run, and the coefficient of variation across runs.
+ *
+ * the library's internal (static) functions are reached by including
+ * webs.c directly.
+ */
+#include "../webs.c"
+
+#include <math.h>
+#include <openssl/sha.h>
+#include <openssl/evp.h>
+
+#define MICRO_WARMUPS 3
+#define MICRO_MAX_RUNS 255
+
+/* 
+ * benchmark parameters.
+ */
+struct micro_opts {
+	int runs;
+	double target_us;
+	char* filter;
+};
+
+/* 
+ * a benchmark, which makes `_iters` calls to the primitive being
+ * measured (for a payload of `size` bytes).
+ */
+struct micro_bench {
+	char* name;
+	size_t size;
+	void (*run)(struct micro_bench*, long _iters);
+	char* in;     /* fixed input */
+	char* out;    /* scratch output */
+	int pipe[2];  /* memory pipe (parse_frame only) */
+	double paused_ns; /* time spent on setup during a run */
+	size_t sink;  /* keeps results live */
+};
+
+static size_t micro_sizes[] = {16, 125, 1024, 16384, 65536, 1048576};
+static int micro_failed = 0;
+
+/* (clients that frames are parsed through belong to a server that is
+ * never started, whose settings are all off) */
+static webs_server micro_srv;
+
+static double micro_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int micro_cmp(const void* _a, const void* _b) {
+	double a = *(double*) _a, b = *(double*) _b;
+	return (a > b) - (a < b);
+}
+
+static void micro_check(int _ok, char* _what, size_t _size) {
+	if (_ok) return;
+	
+	printf("MISMATCH: %s (%lu bytes) differs from the reference\n",
+		_what, (unsigned long) _size);
+	micro_failed = 1;
+	
+	return;
+}
+
+/* 
+ * reference implementations.
+ */
+static size_t ref_length(char* _dst, size_t _n) {
+	size_t i;
+	
+	if (_n > 65535) {
+		_dst[1] = 127;
+		for (i = 0; i < 8; i++)
+			_dst[2 + i] = (char) ((uint64_t) _n >> (56 - 8 * i));
+		return 10;
+	}
+	
+	if (_n > 125) {
+		_dst[1] = 126;
+		_dst[2] = (char) (_n >> 8);
+		_dst[3] = (char) _n;
+		return 4;
+	}
+	
+	_dst[1] = (char) _n;
+	
+	return 2;
+}
+
+static size_t ref_frame(char* _src, char* _dst, size_t _n, uint8_t _op) {
+	size_t off = ref_length(_dst, _n);
+	
+	_dst[0] = (char) (0x80 | _op);
+	memcpy(_dst + off, _src, _n);
+	
+	return off + _n;
+}
+
+/* 
+ * the header of a (masked) client frame with a `_n` byte payload.
+ */
+static size_t ref_header(char* _dst, size_t _n, uint32_t _key) {
+	size_t off = ref_length(_dst, _n);
+	
+	_dst[0] = (char) 0x82;
+	_dst[1] |= (char) 0x80;
+	memcpy(_dst + off, &_key, 4);
+	
+	return off + 4;
+}
+
+static void ref_unmask(char* _dta, uint32_t _key, size_t _n) {
+	unsigned char k[4];
+	size_t i;
+	
+	memcpy(k, &_key, 4);
+	
+	for (i = 0; i < _n; i++)
+		_dta[i] ^= k[i & 3];
+	
+	return;
+}
+
+/* 
+ * benchmark bodies.
+ */
+static void run_sha1(struct micro_bench* _b, long _iters) {
+	long i;
+	
+	for (i = 0; i < _iters; i++) {
+		__webs_sha1(_b->in, _b->out, _b->size);
+		_b->sink += (unsigned char) _b->out[0];
+	}
+	
+	return;
+}
+
+static void run_b64(struct micro_bench* _b, long _iters) {
+	long i;
+	
+	for (i = 0; i < _iters; i++)
+		_b->sink += __webs_b64_encode(_b->in, _b->out, _b->size);
+	
+	return;
+}
+
+static void run_decode(struct micro_bench* _b, long _iters) {
+	long i;
+	
+	for (i = 0; i < _iters; i++) {
+		__webs_decode_data(_b->in, 0x5A3C96E1, _b->size);
+		_b->sink += (unsigned char) _b->in[0];
+	}
+	
+	return;
+}
+
+static void run_make_frame(struct micro_bench* _b, long _iters) {
+	long i;
+	
+	for (i = 0; i < _iters; i++)
+		_b->sink += __webs_make_frame(_b->in, _b->out, _b->size, 0x2);
+	
+	return;
+}
+
+static void run_parse_frame(struct micro_bench* _b, long _iters) {
+	struct webs_frame frm;
+	webs_client cli;
+	double start;
+	size_t hdr;
+	long i, j, batch;
+	
+	memset(&cli, 0, sizeof(cli));
+	cli.fd = _b->pipe[0];
+	cli.srv = &micro_srv;
+	hdr = ref_header(_b->out, _b->size, 0x5A3C96E1);
+	
+	/* refill the pipe between batches (not counted) */
+	for (i = 0; i < _iters; i += batch) {
+		batch = _iters - i < 4096 ? _iters - i : 4096;
+		start = micro_now_ns();
+		
+		for (j = 0; j < batch; j++)
+			if (write(_b->pipe[1], _b->out, hdr) != (ssize_t) hdr)
+				return;
+		
+		_b->paused_ns += micro_now_ns() - start;
+		
+		for (j = 0; j < batch; j++) {
+			__webs_parse_frame(&cli, &frm);
+			_b->sink += frm.length;
+		}
+	}
+	
+	return;
+}
+
+static void run_handshake(struct micro_bench* _b, long _iters) {
+	struct webs_info info;
+	long i;
+	
+	for (i = 0; i < _iters; i++) {
+		__webs_process_handshake(_b->in, &info);
+		_b->sink += __webs_generate_handshake(_b->out, info.webs_key);
+	}
+	
+	return;
+}
+
+/* 
+ * checks each primitive's output against the reference, for a payload
+ * of `_n` bytes.
+ */
+static void micro_verify(size_t _n) {
+	char* in = malloc(_n + 16);
+	char* a = malloc(2 * _n + 64);
+	char* b = malloc(2 * _n + 64);
+	struct webs_frame frm;
+	webs_client cli;
+	int fds[2];
+	size_t i, len;
+	
+	if (!in || !a || !b)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
+	
+	for (i = 0; i < _n; i++)
+		in[i] = (char) (i * 131 + 7);
+	
+	__webs_sha1(in, a, _n);
+	SHA1((unsigned char*) in, _n, (unsigned char*) b);
+	micro_check(memcmp(a, b, 20) == 0, "__webs_sha1", _n);
+	
+	len = __webs_b64_encode(in, a, _n);
+	EVP_EncodeBlock((unsigned char*) b, (unsigned char*) in, _n);
+	micro_check(len == strlen(b) && memcmp(a, b, len + 1) == 0,
+		"__webs_b64_encode", _n);
+	
+	memcpy(a, in, _n);
+	memcpy(b, in, _n);
+	__webs_decode_data(a, 0x5A3C96E1, _n);
+	ref_unmask(b, 0x5A3C96E1, _n);
+	micro_check(memcmp(a, b, _n) == 0, "__webs_decode_data", _n);
+	
+	len = __webs_make_frame(in, a, _n, 0x2);
+	micro_check(len == ref_frame(in, b, _n, 0x2) && memcmp(a, b, len) == 0,
+		"__webs_make_frame", _n);
+	
+	if (pipe(fds) == 0) {
+		memset(&cli, 0, sizeof(cli));
+		cli.fd = fds[0];
+		cli.srv = &micro_srv;
+		len = ref_header(b, _n, 0x5A3C96E1);
+		
+		micro_check(write(fds[1], b, len) == (ssize_t) len
+		&& __webs_parse_frame(&cli, &frm) == 0
+		&& (size_t) frm.length == _n && frm.key == 0x5A3C96E1
+		&& WEBSFR_GET_OPCODE(frm.info) == 0x2, "__webs_parse_frame", _n);
+		
+		close(fds[0]);
+		close(fds[1]);
+	}
+	
+	free(in);
+	free(a);
+	free(b);
+	
+	return;
+}
+
+/* 
+ * checks the handshake against the example in RFC-6455 (section 1.3).
+ */
+static void micro_verify_handshake(char* _req) {
+	struct webs_info info;
+	char out[512];
+	
+	micro_check(__webs_process_handshake(_req, &info) == 0
+	&& strcmp(info.webs_key, "dGhlIHNhbXBsZSBub25jZQ==") == 0
+	&& info.webs_vrs == 13, "__webs_process_handshake", strlen(_req));
+	
+	__webs_generate_handshake(out, info.webs_key);
+	micro_check(strstr(out, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") != NULL,
+		"__webs_generate_handshake", strlen(_req));
+	
+	return;
+}
+
+/* 
+ * times a benchmark, and prints its row.
+ */
+static void micro_measure(struct micro_bench* _b, struct micro_opts* _o) {
+	double t[MICRO_MAX_RUNS], start, sum = 0, var = 0, mean, med;
+	long iters = 1;
+	int i;
+	
+	if (_o->filter && !strstr(_b->name, _o->filter))
+		return;
+	
+	/* calibrate the calls per run to take about `target_us` */
+	for (;;) {
+		start = micro_now_ns();
+		_b->run(_b, iters);
+		
+		if (micro_now_ns() - start >= _o->target_us * 1000 || iters > (1L << 30))
+			break;
+		
+		iters *= 2;
+	}
+	
+	for (i = 0; i < MICRO_WARMUPS; i++)
+		_b->run(_b, iters);
+	
+	for (i = 0; i < _o->runs; i++) {
+		_b->paused_ns = 0;
+		start = micro_now_ns();
+		_b->run(_b, iters);
+		t[i] = (micro_now_ns() - start - _b->paused_ns) / iters;
+	}
+	
+	for (i = 0; i < _o->runs; i++)
+		sum += t[i];
+	
+	mean = sum / _o->runs;
+	
+	for (i = 0; i < _o->runs; i++)
+		var += (t[i] - mean) * (t[i] - mean);
+	
+	qsort(t, _o->runs, sizeof(double), micro_cmp);
+	med = t[_o->runs / 2];
+	
+	printf("%-26s %8lu %12.1f %10.3f %12.1f %7.2f%%\n", _b->name,
+		(unsigned long) _b->size, med, _b->size ? med / _b->size : 0.0,
+		t[0], mean ? 100 * sqrt(var / _o->runs) / mean : 0.0);
+	
+	return;
+}
+
+int main(int argc, char** argv) {
+	char request[] = "GET /chat HTTP/1.1\r\nHost: server.example.com\r\n"
+		"Upgrade: websocket\r\nConnection: Upgrade\r\n"
+		"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+		"Origin: http://example.com\r\nSec-WebSocket-Protocol: chat\r\n"
+		"Sec-WebSocket-Version: 13\r\n\r\n";
+	struct micro_opts opts;
+	struct micro_bench b;
+	size_t max = 0, i, j;
+	int c;
+	
+	opts.runs = 31;
+	opts.target_us = 2000;
+	opts.filter = NULL;
+	
+	while ((c = getopt(argc, argv, "r:t:f:")) != -1) {
+		switch (c) {
+			case 'r': opts.runs = atoi(optarg); break;
+			case 't': opts.target_us = atof(optarg); break;
+			case 'f': opts.filter = optarg; break;
+			default: return 1;
+		}
+	}
+	
+	if (opts.runs < 1 || opts.runs > MICRO_MAX_RUNS)
+		opts.runs = 31;
+	
+	for (i = 0; i < sizeof(micro_sizes) / sizeof(size_t); i++) {
+		micro_verify(micro_sizes[i]);
+		if (micro_sizes[i] > max) max = micro_sizes[i];
+	}
+	
+	/* odd sizes catch tail handling */
+	for (i = 0; i < 200; i++)
+		micro_verify(i);
+	
+	micro_verify_handshake(request);
+	
+	if (micro_failed) return 1;
+	
+	memset(&b, 0, sizeof(b));
+	b.in = malloc(max + 16);
+	b.out = malloc(2 * max + 64);
+	
+	if (!b.in || !b.out || pipe(b.pipe) < 0)
+		return 1;
+	
+	/* room for a full batch of headers */
+	fcntl(b.pipe[1], F_SETPIPE_SZ, 1 << 20);
+	
+	for (j = 0; j < max; j++)
+		b.in[j] = (char) (j * 131 + 7);
+	
+	printf("all primitives match their references\n\n");
+	printf("%-26s %8s %12s %10s %12s %8s\n", "benchmark", "bytes",
+		"median ns", "ns/byte", "fastest ns", "cv");
+	
+	for (i = 0; i < sizeof(micro_sizes) / sizeof(size_t); i++) {
+		b.size = micro_sizes[i];
+		
+		b.name = "__webs_sha1";
+		b.run = run_sha1;
+		micro_measure(&b, &opts);
+		
+		b.name = "__webs_b64_encode";
+		b.run = run_b64;
+		micro_measure(&b, &opts);
+		
+		b.name = "__webs_decode_data";
+		b.run = run_decode;
+		micro_measure(&b, &opts);
+		
+		b.name = "__webs_make_frame";
+		b.run = run_make_frame;
+		micro_measure(&b, &opts);
+		
+		b.name = "__webs_parse_frame";
+		b.run = run_parse_frame;
+		micro_measure(&b, &opts);
+	}
+	
+	free(b.in);
+	
+	b.name = "__webs_process_handshake";
+	b.size = strlen(request);
+	b.in = request;
+	b.run = run_handshake;
+	micro_measure(&b, &opts);
+	
+	free(b.out);
+	
+	return 0;
+}
@@ -0,0 +1,531 @@
+/*
+ * replay benchmark, drives traffic recorded by webs_capture_start()
+ * against an echo server, sending each connection's messages at the
+ * times they were recorded (or faster), and reports throughput and
+ * round-trip latency. replaying the same capture against different
+ * builds compares them under the same real-world traffic.
+ *
+ * usage: replay [-x speed] [-p port] [-e] file
+ *   -x  how many times faster than recorded to send (default 1, or 0
+ *       to send everything as fast as possible)
+ *   -p  port (default 7762)
+ *   -e  drive an external server at `port`, rather than starting an
+ *       echo server in this process (latency is only measured if that
+ *       server echoes each message)
+ *
+ * payloads that weren't recorded are sent as filler of the recorded
+ * length. each connection is replayed by its own thread, connecting at
+ * the time its client connected (or sent its first message).
+ */
+#define _GNU_SOURCE
+
+#include "../webs.h"
+
+#include <time.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+
+#define REPLAY_DRAIN_S 2.0
+
+/*
+ * a recorded message.
+ */
+struct replay_msg {
+	uint64_t time_us;
+	uint32_t len;
+	uint8_t op;
+	char* payload;  /* (NULL if it wasn't recorded) */
+};
+
+/*
+ * a recorded connection, and the results of replaying it.
+ */
+struct replay_conn {
+	uint32_t id;
+	uint64_t open_us;
+	uint64_t close_us;     /* (0 if it was still open) */
+	struct replay_msg* msgs;
+	size_t num_msgs;
+	pthread_t thread;
+	int fd;
+	char* rbuf;            /* replies read but not yet parsed */
+	size_t rlen, rsize;
+	double* sent_at;       /* when each data message was sent */
+	uint32_t* sent_len;    /* and how long it was */
+	double* rtts;          /* round-trip times, in microseconds */
+	size_t num_data;       /* data messages sent */
+	size_t next;           /* the first not yet echoed (or given up on) */
+	size_t echoed;         /* data messages echoed back */
+	double behind;         /* furthest behind schedule, in seconds */
+	double last;           /* when the last message was sent or echoed */
+	int error;
+};
+
+static double replay_speed = 1;
+static double replay_start;
+static int replay_port = 7762;
+static char* replay_filler;
+
+static double replay_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * when a recorded time comes around in the replay.
+ */
+static double replay_due(uint64_t _us) {
+	return replay_speed > 0 ? replay_start + _us * 1e-6 / replay_speed
+		: replay_start;
+}
+
+/*
+ * opens a connection and completes the websocket handshake.
+ */
+static int replay_connect(void) {
+	struct sockaddr_in addr;
+	char buf[512];
+	const int ONE = 1;
+	int fd, len;
+	
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(replay_port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	
+	if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+		goto FAIL;
+	
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &ONE, sizeof(int));
+	
+	len = sprintf(buf, "GET / HTTP/1.1\r\nHost: localhost\r\n"
+		"Upgrade: websocket\r\nConnection: Upgrade\r\n"
+		"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+		"Sec-WebSocket-Version: 13\r\n\r\n");
+	
+	if (write(fd, buf, len) != len)
+		goto FAIL;
+	
+	for (len = 0; len < 4 || memcmp(buf + len - 4, "\r\n\r\n", 4); len++)
+		if (len == (int) sizeof(buf) || read(fd, buf + len, 1) != 1)
+			goto FAIL;
+	
+	return fd;
+	
+	FAIL:
+	
+	close(fd);
+	return -1;
+}
+
+/*
+ * reads whatever replies have arrived (without blocking), and matches
+ * each echoed message with when it was sent (by its length, skipping
+ * any the server didn't echo).
+ * @return -1 once the connection has failed or closed, or 0 otherwise.
+ */
+static int replay_read(struct replay_conn* _c) {
+	uint8_t* p;
+	uint64_t len;
+	size_t off = 0, hdr, i;
+	ssize_t n;
+	
+	for (;;) {
+		if (_c->rsize - _c->rlen < 4096) {
+			_c->rsize *= 2;
+			_c->rbuf = realloc(_c->rbuf, _c->rsize);
+		}
+		
+		n = recv(_c->fd, _c->rbuf + _c->rlen, _c->rsize - _c->rlen, MSG_DONTWAIT);
+		
+		if (n == 0 || (n < 0 && errno != EAGAIN))
+			return -1;
+		
+		if (n < 0)
+			break;
+		
+		_c->rlen += n;
+	}
+	
+	while (_c->rlen - off >= 2) {
+		p = (uint8_t*) _c->rbuf + off;
+		len = p[1] & 0x7F;
+		hdr = len == 126 ? 4 : len == 127 ? 10 : 2;
+		
+		if (_c->rlen - off < hdr)
+			break;
+		
+		if (len == 126)
+			len = (uint64_t) p[2] << 8 | p[3];
+		
+		else if (len == 127)
+			for (len = 0, i = 2; i < 10; i++)
+				len = len << 8 | p[i];
+		
+		if (_c->rlen - off < hdr + len)
+			break;
+		
+		/* (pongs aren't matched, they may overtake echoed messages) */
+		if ((p[0] & 0x0F) == 0x1 || (p[0] & 0x0F) == 0x2) {
+			for (i = _c->next; i < _c->num_data && _c->sent_len[i] != len; i++);
+			
+			if (i < _c->num_data) {
+				_c->last = replay_now();
+				_c->rtts[_c->echoed++] = (_c->last - _c->sent_at[i]) * 1e6;
+				_c->next = i + 1;
+			}
+		}
+		
+		if ((p[0] & 0x0F) == 0x8)
+			return -1;
+		
+		off += hdr + len;
+	}
+	
+	memmove(_c->rbuf, _c->rbuf + off, _c->rlen - off);
+	_c->rlen -= off;
+	
+	return 0;
+}
+
+/*
+ * waits until a time, reading replies meanwhile.
+ */
+static int replay_wait(struct replay_conn* _c, double _until) {
+	struct pollfd pfd;
+	struct timespec ts;
+	double left;
+	
+	pfd.fd = _c->fd;
+	pfd.events = POLLIN;
+	
+	while ((left = _until - replay_now()) > 0) {
+		ts.tv_sec = (time_t) left;
+		ts.tv_nsec = (long) ((left - ts.tv_sec) * 1e9);
+		
+		if (ppoll(&pfd, 1, &ts, NULL) > 0 && replay_read(_c) < 0)
+			return -1;
+	}
+	
+	return 0;
+}
+
+/*
+ * writes a buffer, reading replies whenever the connection can't take
+ * any more (so that neither side blocks on the other).
+ */
+static int replay_write(struct replay_conn* _c, char* _buf, size_t _n) {
+	struct pollfd pfd;
+	ssize_t n;
+	
+	pfd.fd = _c->fd;
+	pfd.events = POLLIN | POLLOUT;
+	
+	while (_n) {
+		n = send(_c->fd, _buf, _n, MSG_DONTWAIT | MSG_NOSIGNAL);
+		
+		if (n > 0) {
+			_buf += n;
+			_n -= n;
+			continue;
+		}
+		
+		if (n < 0 && errno != EAGAIN)
+			return -1;
+		
+		poll(&pfd, 1, -1);
+		
+		if ((pfd.revents & POLLIN) && replay_read(_c) < 0)
+			return -1;
+	}
+	
+	return 0;
+}
+
+/*
+ * sends a (masked, with a zero key) frame.
+ */
+static int replay_send(struct replay_conn* _c, uint8_t _op, char* _data, size_t _n) {
+	char hdr[14];
+	size_t off = 2;
+	int i;
+	
+	hdr[0] = (char) (0x80 | _op);
+	
+	if (_n > 65535) {
+		hdr[1] = (char) (0x80 | 127);
+		for (i = 0; i < 8; i++)
+			hdr[2 + i] = (char) ((uint64_t) _n >> (56 - 8 * i));
+		off = 10;
+	} else if (_n > 125) {
+		hdr[1] = (char) (0x80 | 126);
+		hdr[2] = (char) (_n >> 8);
+		hdr[3] = (char) _n;
+		off = 4;
+	} else hdr[1] = (char) (0x80 | _n);
+	
+	memset(hdr + off, 0, 4);
+	
+	if (replay_write(_c, hdr, off + 4) < 0)
+		return -1;
+	
+	return replay_write(_c, _data ? _data : replay_filler, _n);
+}
+
+static void* replay_client(void* _c) {
+	struct replay_conn* c = _c;
+	struct replay_msg* m;
+	double due, deadline;
+	size_t i, n = 0;
+	
+	for (i = 0; i < c->num_msgs; i++)
+		if (c->msgs[i].op == 0x1 || c->msgs[i].op == 0x2)
+			n++;
+	
+	c->sent_at = malloc((n + 1) * sizeof(double));
+	c->sent_len = malloc((n + 1) * sizeof(uint32_t));
+	c->rtts = malloc((n + 1) * sizeof(double));
+	c->rsize = 65536;
+	c->rbuf = malloc(c->rsize);
+	
+	due = replay_due(c->open_us);
+	
+	while (replay_now() < due)
+		usleep(1000);
+	
+	if ((c->fd = replay_connect()) < 0) {
+		c->error = 1;
+		return NULL;
+	}
+	
+	for (i = 0; i < c->num_msgs; i++) {
+		m = &c->msgs[i];
+		due = replay_due(m->time_us);
+		
+		if (replay_wait(c, due) < 0)
+			break;
+		
+		if (replay_now() - due > c->behind)
+			c->behind = replay_now() - due;
+		
+		/* (control frames carry at most 125 bytes) */
+		if (m->op == 0x9 || m->op == 0xA) {
+			if (replay_send(c, m->op, m->payload, m->len > 125 ? 125 : m->len) < 0)
+				break;
+			continue;
+		}
+		
+		c->sent_at[c->num_data] = replay_now();
+		c->sent_len[c->num_data] = m->len;
+		
+		if (replay_send(c, m->op, m->payload, m->len) < 0)
+			break;
+		
+		c->num_data++;
+		c->last = replay_now();
+	}
+	
+	if (i < c->num_msgs)
+		c->error = 1;
+	
+	/* wait for the last echoes, and for the time the client left */
+	deadline = replay_now() + REPLAY_DRAIN_S;
+	
+	while (!c->error && c->next < c->num_data && replay_now() < deadline)
+		if (replay_wait(c, replay_now() + 0.01) < 0)
+			break;
+	
+	if (c->close_us && !c->error) {
+		replay_wait(c, replay_due(c->close_us));
+		replay_send(c, 0x8, "\x03\xe8", 2);
+	}
+	
+	close(c->fd);
+	
+	return NULL;
+}
+
+/*
+ * echo handler for the server side.
+ */
+static int replay_on_data(webs_client* _self, char* _data, ssize_t _n) {
+	webs_sendn(_self, _data, _n);
+	return 0;
+}
+
+static int replay_cmp(const void* _a, const void* _b) {
+	double a = *(const double*) _a, b = *(const double*) _b;
+	return (a > b) - (a < b);
+}
+
+/*
+ * orders records by connection, then by position in the file.
+ */
+static int replay_cmp_records(const void* _a, const void* _b) {
+	const struct webs_capture_record* a = *(const struct webs_capture_record* const*) _a;
+	const struct webs_capture_record* b = *(const struct webs_capture_record* const*) _b;
+	
+	if (a->conn != b->conn)
+		return (a->conn > b->conn) - (a->conn < b->conn);
+	
+	return (a > b) - (a < b);
+}
+
+int main(int argc, char** argv) {
+	struct webs_capture_record** recs = NULL;
+	struct webs_capture_record* rec;
+	struct replay_conn* conns = NULL;
+	struct replay_conn* c = NULL;
+	struct replay_msg* m;
+	webs_server* srv;
+	size_t size, off, num_recs = 0, num_conns = 0, max_len = 0;
+	size_t total = 0, echoed = 0, n = 0, i, j;
+	double elapsed, behind = 0, last = 0, * all;
+	uint64_t recorded = 0;
+	int external = 0, ch;
+	char* file;
+	FILE* f;
+	
+	while ((ch = getopt(argc, argv, "x:p:e")) != -1) {
+		switch (ch) {
+			case 'x': replay_speed = atof(optarg); break;
+			case 'p': replay_port = atoi(optarg); break;
+			case 'e': external = 1; break;
+			default: return 1;
+		}
+	}
+	
+	if (optind >= argc || (f = fopen(argv[optind], "rb")) == NULL) {
+		printf("usage: replay [-x speed] [-p port] [-e] file\n");
+		return 1;
+	}
+	
+	/* the capture is read whole, payloads are used in place */
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	file = malloc(size + 1);
+	
+	if (fread(file, 1, size, f) != size || size < 8
+	|| memcmp(file, WEBS_CAPTURE_MAGIC, 8)) {
+		printf("%s isn't a capture file.\n", argv[optind]);
+		return 1;
+	}
+	
+	fclose(f);
+	
+	recs = malloc((size / sizeof(*rec) + 1) * sizeof(*recs));
+	
+	for (off = 8; off + sizeof(*rec) <= size; num_recs++) {
+		rec = (struct webs_capture_record*) (file + off);
+		recs[num_recs] = rec;
+		off += sizeof(*rec) + (rec->payload ? rec->len : 0);
+		
+		/* (a capture that was cut short ends at its last whole record) */
+		if (off > size)
+			break;
+		
+		if (rec->len > max_len)
+			max_len = rec->len;
+		
+		if (rec->time_us > recorded)
+			recorded = rec->time_us;
+	}
+	
+	qsort(recs, num_recs, sizeof(*recs), replay_cmp_records);
+	
+	conns = calloc(num_recs + 1, sizeof(struct replay_conn));
+	
+	for (i = 0; i < num_recs; i++) {
+		rec = recs[i];
+		
+		if (c == NULL || c->id != rec->conn) {
+			c = &conns[num_conns++];
+			c->id = rec->conn;
+			c->open_us = rec->time_us;
+			c->msgs = malloc((num_recs - i) * sizeof(struct replay_msg));
+		}
+		
+		if (rec->op == WEBS_CAPTURE_CLOSE) {
+			c->close_us = rec->time_us;
+			continue;
+		}
+		
+		if (rec->op == WEBS_CAPTURE_OPEN)
+			continue;
+		
+		m = &c->msgs[c->num_msgs++];
+		m->time_us = rec->time_us;
+		m->len = rec->len;
+		m->op = rec->op;
+		m->payload = rec->payload ? (char*) (rec + 1) : NULL;
+	}
+	
+	replay_filler = malloc(max_len + 1);
+	memset(replay_filler, 'x', max_len);
+	
+	if (!external) {
+		srv = webs_start_at("127.0.0.1", replay_port);
+		
+		if (srv == NULL) {
+			printf("failed to start server.\n");
+			return 1;
+		}
+		
+		srv->events.on_data = replay_on_data;
+	}
+	
+	printf("%lu records, %lu connections, %.3f s recorded\n",
+		(unsigned long) num_recs, (unsigned long) num_conns, recorded * 1e-6);
+	
+	if (replay_speed > 0)
+		printf("replaying at %gx\n", replay_speed);
+	else
+		printf("replaying at full speed\n");
+	
+	replay_start = replay_now() + 0.1;
+	
+	for (i = 0; i < num_conns; i++)
+		pthread_create(&conns[i].thread, 0, replay_client, &conns[i]);
+	
+	for (i = 0; i < num_conns; i++) {
+		pthread_join(conns[i].thread, 0);
+		
+		total += conns[i].num_data;
+		echoed += conns[i].echoed;
+		
+		if (conns[i].behind > behind)
+			behind = conns[i].behind;
+		
+		if (conns[i].last > last)
+			last = conns[i].last;
+		
+		if (conns[i].error)
+			printf("connection %lu failed.\n", (unsigned long) conns[i].id);
+	}
+	
+	/* (not counting the wait for echoes that never came) */
+	elapsed = last > replay_start ? last - replay_start : 0;
+	
+	printf("  %lu messages sent, %lu echoed  %.3f s\n",
+		(unsigned long) total, (unsigned long) echoed, elapsed);
+	printf("  %.0f msg/s  at most %.1f ms behind schedule\n",
+		elapsed > 0 ? total / elapsed : 0, behind * 1e3);
+	
+	all = malloc((echoed + 1) * sizeof(double));
+	
+	for (i = 0; i < num_conns; i++)
+		for (j = 0; j < conns[i].echoed; j++)
+			all[n++] = conns[i].rtts[j];
+	
+	qsort(all, n, sizeof(double), replay_cmp);
+	
+	if (n) printf("  rtt us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+		all[n / 2], all[n * 9 / 10], all[n * 99 / 100], all[n - 1]);
+	
+	return 0;
+}
@@ -0,0 +1,431 @@
+/* 
+ * connection soak benchmark, opens a large number of websocket
+ * connections to a server (run in a child process), and reports the
+ * resident memory, threads, descriptors and CPU time that they cost.
+ * it can then keep them open for a while, with a trickle of pings and
+ * messages and a rate of connections being replaced, and report how
+ * the server's usage grows (which, once the connections have settled,
+ * it shouldn't).
+ *
+ * usage: soak [-n steps] [-P park_ms] [-p port] [-d seconds]
+ *             [-i seconds] [-r rate] [-c rate]
+ *   -n  comma-separated connection counts to report at
+ *       (default 10000,100000,500000)
+ *   -P  the server's park_ms (default 100, 0 for a thread per connection)
+ *   -p  port (default 7761)
+ *   -d  how long to keep the connections open after the last count is
+ *       reached (default 0)
+ *   -i  how often to sample the server while doing so (default 10)
+ *   -r  pings and messages sent per second, across all connections
+ *       (default 100)
+ *   -c  connections replaced per second (default 10). half are closed
+ *       cleanly, the rest are reset part way through a message.
+ *
+ * each connection uses two descriptors (one in each process, and a
+ * loopback port), so large counts need `ulimit -n` raised to match.
+ * clients are spread over several 127.0.0.x addresses, so they don't
+ * run out of ports.
+ */
+#define _GNU_SOURCE
+
+#include "../webs.h"
+
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define SOAK_PORTS_PER_ADDR 25000
+#define SOAK_MAX_STEPS 16
+#define SOAK_TICK_US 10000
+
+/* 
+ * usage of the server process at one point in time.
+ */
+struct soak_sample {
+	double time;    /* when it was taken */
+	long rss;       /* resident memory, in kB */
+	long threads;   /* number of threads */
+	long fds;       /* number of open descriptors */
+	long cpu;       /* user + system time, in clock ticks */
+};
+
+/* 
+ * reads a number from a line of /proc/<pid>/status.
+ */
+static long soak_status(pid_t _pid, char* _key) {
+	char line[256];
+	FILE* f;
+	long value = -1;
+	size_t n = strlen(_key);
+	
+	sprintf(line, "/proc/%d/status", (int) _pid);
+	
+	if ((f = fopen(line, "r")) == NULL) return -1;
+	
+	while (fgets(line, sizeof(line), f))
+		if (strncmp(line, _key, n) == 0 && line[n] == ':') {
+			value = atol(line + n + 1);
+			break;
+		}
+	
+	fclose(f);
+	
+	return value;
+}
+
+/* 
+ * counts the descriptors a process has open.
+ */
+static long soak_fds(pid_t _pid) {
+	char path[64];
+	struct dirent* e;
+	DIR* dir;
+	long n = 0;
+	
+	sprintf(path, "/proc/%d/fd", (int) _pid);
+	
+	if ((dir = opendir(path)) == NULL) return -1;
+	
+	while ((e = readdir(dir)))
+		if (e->d_name[0] != '.')
+			n++;
+	
+	closedir(dir);
+	
+	return n;
+}
+
+/* 
+ * reads the CPU time a process has used (utime + stime, in clock
+ * ticks) from /proc/<pid>/stat.
+ */
+static long soak_cpu(pid_t _pid) {
+	char buf[1024];
+	unsigned long utime, stime;
+	char* p;
+	FILE* f;
+	size_t n;
+	
+	sprintf(buf, "/proc/%d/stat", (int) _pid);
+	
+	if ((f = fopen(buf, "r")) == NULL) return -1;
+	
+	n = fread(buf, 1, sizeof(buf) - 1, f);
+	buf[n] = '\0';
+	fclose(f);
+	
+	/* fields after the command name (which may hold spaces) */
+	if ((p = strrchr(buf, ')')) == NULL
+	|| sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+	&utime, &stime) != 2)
+		return -1;
+	
+	return utime + stime;
+}
+
+static double soak_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void soak_sample(pid_t _pid, struct soak_sample* _s) {
+	_s->time = soak_now();
+	_s->rss = soak_status(_pid, "VmRSS");
+	_s->threads = soak_status(_pid, "Threads");
+	_s->fds = soak_fds(_pid);
+	_s->cpu = soak_cpu(_pid);
+	return;
+}
+
+/* 
+ * opens a connection (from the `_i`th client address) and completes
+ * the websocket handshake. the connection is left non-blocking.
+ */
+static int soak_connect(long _i, int _port) {
+	struct sockaddr_in addr;
+	char buf[512];
+	int fd, len;
+	
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + _i / SOAK_PORTS_PER_ADDR);
+	
+	if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+		goto FAIL;
+	
+	addr.sin_port = htons(_port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	
+	if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+		goto FAIL;
+	
+	len = sprintf(buf, "GET / HTTP/1.1\r\nHost: localhost\r\n"
+		"Upgrade: websocket\r\nConnection: Upgrade\r\n"
+		"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+		"Sec-WebSocket-Version: 13\r\n\r\n");
+	
+	if (write(fd, buf, len) != len)
+		goto FAIL;
+	
+	for (len = 0; len < 4 || memcmp(buf + len - 4, "\r\n\r\n", 4); len++)
+		if (len == (int) sizeof(buf) || read(fd, buf + len, 1) != 1)
+			goto FAIL;
+	
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	
+	return fd;
+	
+	FAIL:
+	
+	close(fd);
+	return -1;
+}
+
+/* 
+ * sends a (masked, with a zero key) frame on a connection, first
+ * discarding anything the server has sent it (e.g. pongs).
+ */
+static void soak_send(int _fd, int _info, char* _data, int _n) {
+	char buf[256];
+	
+	while (recv(_fd, buf, sizeof(buf), MSG_DONTWAIT) > 0);
+	
+	buf[0] = _info;
+	buf[1] = 0x80 | _n;
+	memset(buf + 2, 0, 4);
+	memcpy(buf + 6, _data, _n);
+	
+	send(_fd, buf, 6 + _n, MSG_NOSIGNAL | MSG_DONTWAIT);
+	
+	return;
+}
+
+/* 
+ * closes the `_i`th connection and opens another in its place. even
+ * numbered replacements send a close frame first, odd ones send the
+ * first fragment of a message and then reset the connection.
+ */
+static void soak_replace(int* _fds, long _i, long _n, int _port) {
+	struct linger lin = {1, 0};
+	
+	if (_fds[_i] >= 0) {
+		if (_n % 2 == 0)
+			soak_send(_fds[_i], 0x88, "\x03\xe8", 2);
+		
+		else {
+			soak_send(_fds[_i], 0x01, "partial", 7);
+			setsockopt(_fds[_i], SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+		}
+		
+		close(_fds[_i]);
+	}
+	
+	_fds[_i] = soak_connect(_i, _port);
+	
+	return;
+}
+
+/* 
+ * keeps the connections open for `_secs` seconds, with a trickle of
+ * pings and messages and a rate of them being replaced, sampling the
+ * server every `_every` seconds, and reports how its usage grew. the
+ * first interval is taken as a warm up (e.g. for the threads that the
+ * trickle wakes), so growth is counted from the first sample.
+ */
+static void soak_run(pid_t _pid, int* _fds, long _conns, int _port, double _secs,
+double _every, double _rate, double _churn) {
+	struct soak_sample start, first, last, s;
+	double end, next, sends = 0, replaces = 0, ticks = sysconf(_SC_CLK_TCK);
+	long sent = 0, replaced = 0, failed = 0, first_replaced = 0, i;
+	
+	soak_sample(_pid, &start);
+	first = last = start;
+	end = start.time + _secs;
+	next = start.time + _every;
+	
+	printf("\n%8s %8s %10s %8s %8s %6s %10s %10s\n", "seconds", "conns",
+		"rss kB", "threads", "fds", "cpu %", "sent", "replaced");
+	
+	while (soak_now() < end) {
+		usleep(SOAK_TICK_US);
+		
+		sends += _rate * SOAK_TICK_US / 1e6;
+		replaces += _churn * SOAK_TICK_US / 1e6;
+		
+		for (; sends >= 1; sends--) {
+			i = rand() % _conns;
+			
+			if (_fds[i] < 0) continue;
+			
+			if (sent++ % 2)
+				soak_send(_fds[i], 0x89, "", 0);
+			else
+				soak_send(_fds[i], 0x81, "soak", 4);
+		}
+		
+		for (; replaces >= 1; replaces--) {
+			i = rand() % _conns;
+			soak_replace(_fds, i, replaced++, _port);
+			
+			if (_fds[i] < 0)
+				failed++;
+		}
+		
+		if (soak_now() < next)
+			continue;
+		
+		soak_sample(_pid, &s);
+		next += _every;
+		
+		if (s.rss < 0) {
+			printf("server exited.\n");
+			break;
+		}
+		
+		printf("%8.0f %8ld %10ld %8ld %8ld %6.1f %10ld %10ld\n",
+			s.time - start.time, _conns, s.rss, s.threads, s.fds,
+			(s.cpu - last.cpu) / ticks / (s.time - last.time) * 100,
+			sent, replaced);
+		
+		fflush(stdout);
+		
+		if (last.time == start.time) {
+			first = s;
+			first_replaced = replaced;
+		}
+		
+		last = s;
+	}
+	
+	if (last.time == first.time) return;
+	
+	replaced -= first_replaced;
+	
+	printf("\ngrowth over the last %.0f seconds (%ld connections replaced, %ld failed):\n",
+		last.time - first.time, replaced, failed);
+	printf("  rss      %+ld kB (%+.0f kB/hour, %.0f bytes per replaced connection)\n",
+		last.rss - first.rss,
+		(last.rss - first.rss) * 3600.0 / (last.time - first.time),
+		replaced ? (last.rss - first.rss) * 1024.0 / replaced : 0.0);
+	printf("  threads  %+ld\n", last.threads - first.threads);
+	printf("  fds      %+ld\n", last.fds - first.fds);
+	printf("  cpu      %.1f%% on average\n",
+		(last.cpu - first.cpu) / ticks / (last.time - first.time) * 100);
+	
+	return;
+}
+
+int main(int argc, char** argv) {
+	char steps_default[] = "10000,100000,500000";
+	char* steps = steps_default;
+	char* step;
+	long targets[SOAK_MAX_STEPS];
+	struct soak_sample base, s;
+	struct rlimit lim;
+	webs_server* srv;
+	double deadline, secs = 0, every = 10, rate = 100, churn = 10;
+	long park_ms = 100, conns = 0, num_steps = 0, i;
+	int port = 7761, c;
+	int* fds;
+	pid_t pid;
+	
+	while ((c = getopt(argc, argv, "n:P:p:d:i:r:c:")) != -1) {
+		switch (c) {
+			case 'n': steps = optarg; break;
+			case 'P': park_ms = atol(optarg); break;
+			case 'p': port = atoi(optarg); break;
+			case 'd': secs = atof(optarg); break;
+			case 'i': every = atof(optarg); break;
+			case 'r': rate = atof(optarg); break;
+			case 'c': churn = atof(optarg); break;
+			default: return 1;
+		}
+	}
+	
+	for (step = strtok(steps, ","); step && num_steps < SOAK_MAX_STEPS;
+	step = strtok(NULL, ","))
+		targets[num_steps++] = atol(step);
+	
+	if (num_steps == 0 || every <= 0) return 1;
+	
+	/* use as many descriptors as we are allowed (the server inherits
+	 * the same limit) */
+	getrlimit(RLIMIT_NOFILE, &lim);
+	lim.rlim_cur = lim.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &lim);
+	
+	/* the server runs in its own process, so that only its usage is
+	 * measured */
+	pid = fork();
+	
+	if (pid == 0) {
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		
+		srv = webs_start_at("127.0.0.1", port);
+		
+		if (srv == NULL) {
+			printf("failed to start server.\n");
+			_exit(1);
+		}
+		
+		srv->park_ms = park_ms;
+		
+		for (;;) pause();
+	}
+	
+	fds = malloc(targets[num_steps - 1] * sizeof(int));
+	
+	if (pid < 0 || fds == NULL) {
+		printf("failed to start server.\n");
+		return 1;
+	}
+	
+	sleep(1);
+	soak_sample(pid, &base);
+	
+	printf("park_ms %ld  descriptor limit %ld  baseline %ld kB, %ld threads, %ld fds\n",
+		park_ms, (long) lim.rlim_cur, base.rss, base.threads, base.fds);
+	
+	for (i = 0; i < num_steps; i++) {
+		while (conns < targets[i]) {
+			if ((fds[conns] = soak_connect(conns, port)) < 0) {
+				printf("  connection %ld failed (%s), stopping.\n", conns, strerror(errno));
+				break;
+			}
+			
+			conns++;
+		}
+		
+		/* wait for the server's threads to settle */
+		deadline = soak_now() + 5 + park_ms / 1000.0;
+		soak_sample(pid, &s);
+		
+		while (soak_now() < deadline && s.threads > base.threads + 1
+		&& (park_ms || s.threads < base.threads + conns)) {
+			usleep(100000);
+			soak_sample(pid, &s);
+		}
+		
+		printf("%8ld connections  %6ld threads  %8ld fds  %8ld kB resident  %6.0f bytes/connection\n",
+			conns, s.threads, s.fds, s.rss,
+			conns ? (s.rss - base.rss) * 1024.0 / conns : 0.0);
+		
+		if (conns < targets[i]) break;
+	}
+	
+	if (secs > 0 && conns > 0)
+		soak_run(pid, fds, conns, port, secs, every, rate, churn);
+	
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	
+	return 0;
+}
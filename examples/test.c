@@ -52,6 +52,9 @@ int myFunc3(webs_client* self, enum webs_error err) {
 		case WEBS_ERR_UNEXPECTED_CONTINUTATION:
 			printf("server %ld - on_error: recieved unexpected continuation frame.\n", self->srv->id);
 			break;
+		case WEBS_ERR_RATE_LIMITED:
+			printf("server %ld - on_error: client went over its rate limits.\n", self->srv->id);
+			break;
 	}
 	
 	return 0;
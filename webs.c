@@ -1,5 +1,49 @@
+#define _GNU_SOURCE
+
 #include "webs.h"
 
+#include <stddef.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <linux/tcp.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#ifdef SYS_openat2
+	#include <linux/openat2.h>
+#endif
+
+#ifdef WEBS_TLS
+	#include <openssl/ssl.h>
+	#include <openssl/err.h>
+#endif
+
+/* 
+ * static (USDT) tracepoints, compiled in with WEBS_USDT (which needs
+ * <sys/sdt.h>, from systemtap). each probe is a single nop until a
+ * tracer attaches to it, and without WEBS_USDT they vanish entirely.
+ */
+#ifdef WEBS_USDT
+	#include <sys/sdt.h>
+	#define WEBS_PROBE1(N, A) DTRACE_PROBE1(webs, N, A)
+	#define WEBS_PROBE2(N, A, B) DTRACE_PROBE2(webs, N, A, B)
+	#define WEBS_PROBE3(N, A, B, C) DTRACE_PROBE3(webs, N, A, B, C)
+#else
+	#define WEBS_PROBE1(N, A)
+	#define WEBS_PROBE2(N, A, B)
+	#define WEBS_PROBE3(N, A, B, C)
+#endif
+
 /* headers for ping and pong frames */
 uint8_t WEBS_PING[2] = {0x89, 0x00};
 uint8_t WEBS_PONG[2] = {0x8A, 0x00};
@@ -11,6 +55,10 @@ uint8_t WEBSFR_MASKED_MASK[2] = {0x00, 0x80};
 uint8_t WEBSFR_FINISH_MASK[2] = {0x80, 0x00};
 uint8_t WEBSFR_RESVRD_MASK[2] = {0x70, 0x00};
 
+/* spare handshake buffers for each NUMA node, shared by every server */
+static pthread_once_t __webs_spare_once = PTHREAD_ONCE_INIT;
+static struct webs_spares __webs_spares[WEBS_MAX_NODES];
+
 /* 
  * strcat that write result to a buffer...
  */
@@ -27,12 +75,11 @@ static int __webs_strcat(char* _buf, char* _a, char* _b) {
  * thats why this is here...
  */
 uint64_t __WEBS_BIG_ENDIAN_QWORD(uint64_t _x) {
-	((uint32_t*) &_x)[0] = WEBS_BIG_ENDIAN_DWORD(((uint32_t*) &_x)[0]);
-	((uint32_t*) &_x)[1] = WEBS_BIG_ENDIAN_DWORD(((uint32_t*) &_x)[1]);
-	((uint32_t*) &_x)[0] ^= ((uint32_t*) &_x)[1];
-	((uint32_t*) &_x)[1] ^= ((uint32_t*) &_x)[0];
-	((uint32_t*) &_x)[0] ^= ((uint32_t*) &_x)[1];
-	return _x;
+	uint32_t lo = (uint32_t) _x;
+	uint32_t hi = (uint32_t) (_x >> 32);
+	
+	return ((uint64_t) WEBS_BIG_ENDIAN_DWORD(lo) << 32)
+		| WEBS_BIG_ENDIAN_DWORD(hi);
 }
 
 /* 
@@ -66,8 +113,8 @@ static int __webs_sha1(char* _s, char* _d, uint64_t _n) {
 	uint64_t pad_n = _n + ((55 - _n) & 63) + 9;
 	
 	uint64_t num_chks = pad_n / 64;	/* number of chunks to be processed */
-	uint16_t rem_chks_begin = 0;   	/* the first chunk with extended data */
-	uint16_t offset = pad_n - 128; 	/* start index for extended data */
+	uint64_t rem_chks_begin = 0;   	/* the first chunk with extended data */
+	uint64_t offset = pad_n - 128; 	/* start index for extended data */
 	
 	/* buffer to store extended chunk data (i.e. data that goes past the
 	 * smallest multiple of 64 bytes less than `_n`) (to avoid having to
@@ -193,19 +240,364 @@ static int __webs_b64_encode(char* _s, char* _d, size_t _n) {
 		_d[i + 3] = '=';
 	}
 	
-	_d[i + 4] = '\0';
+	/* (data that is a multiple of 3 bytes needs no padding) */
+	if (rem) i += 4;
+	_d[i] = '\0';
+	
+	return i;
+}
+
+/* 
+ * waits for a client's connection to become readable or writable, for
+ * calls on a non-blocking socket (as a TLS client's is, and as a plain
+ * client's is while a file is sent without waiting) that would block.
+ * @param _self: the client.
+ * @param _events: the events to wait for (POLLIN or POLLOUT).
+ * @return -1 on error, or 0 otherwise.
+ */
+static int __webs_wait_socket(webs_client* _self, short _events) {
+	struct pollfd pfd;
+	
+	pfd.fd = _self->fd;
+	pfd.events = _events;
+	
+	while (poll(&pfd, 1, -1) < 0)
+		if (errno != EINTR)
+			return -1;
+	
+	return 0;
+}
+
+#ifdef WEBS_TLS
+/* 
+ * works out what an OpenSSL call that didn't complete is waiting for.
+ * @param _ssl: the client's OpenSSL session.
+ * @param _ret: the call's return value.
+ * @return POLLIN or POLLOUT, or 0 if the call failed.
+ */
+static short __webs_ssl_events(SSL* _ssl, int _ret) {
+	int err = SSL_get_error(_ssl, _ret);
+	
+	/* (a read may also need to write, e.g. to answer a key update,
+	 * and a write to read) */
+	if (err == SSL_ERROR_WANT_READ)
+		return POLLIN;
+	
+	if (err == SSL_ERROR_WANT_WRITE)
+		return POLLOUT;
+	
+	return 0;
+}
+
+/* 
+ * reads from a TLS connection through OpenSSL. the client's lock is
+ * held only for the read itself, which doesn't block (what arrived may
+ * be only part of a record), so that frames sent from other threads
+ * are not held up while this thread waits for data.
+ * @param _self: the client to be read from.
+ * @param _dst: a buffer to store the resulting data.
+ * @param _n: the maximum number of bytes to be read.
+ * @return the number of bytes read, or -1 on error.
+ */
+static ssize_t __webs_ssl_read(webs_client* _self, void* _dst, size_t _n) {
+	short events;
+	int n;
+	
+	for (;;) {
+		pthread_mutex_lock(&_self->lock);
+		
+		n = SSL_read(_self->ssl, _dst, _n > INT_MAX ? INT_MAX : _n);
+		events = n > 0 ? 0 : __webs_ssl_events(_self->ssl, n);
+		
+		pthread_mutex_unlock(&_self->lock);
+		
+		if (events == 0 || __webs_wait_socket(_self, events) < 0)
+			break;
+	}
+	
+	return n > 0 ? n : -1;
+}
+
+/* 
+ * writes the record held in a client's `tls_buf` through OpenSSL. once
+ * OpenSSL has taken a record it must be given the same one until it is
+ * written, so the record stays held (ahead of any other data) until
+ * then. the caller must hold the client's lock.
+ * @param _self: the client to be written to.
+ * @param _flags: 0, or MSG_DONTWAIT to stop (rather than wait) if the
+ * connection can't take the record.
+ * @return -1 on error (with `errno` set to EAGAIN if the record is
+ * still held), or 0 otherwise.
+ */
+static int __webs_ssl_flush(webs_client* _self, int _flags) {
+	short events;
+	int n;
+	
+	while (_self->tls_len) {
+		n = SSL_write(_self->ssl, _self->tls_buf, _self->tls_len);
+		
+		if (n > 0) {
+			_self->tls_len = 0;
+			break;
+		}
+		
+		if ((events = __webs_ssl_events(_self->ssl, n)) == 0)
+			return -1;
+		
+		if (_flags & MSG_DONTWAIT) {
+			errno = EAGAIN;
+			return -1;
+		}
+		
+		if (__webs_wait_socket(_self, events) < 0)
+			return -1;
+	}
+	
+	return 0;
+}
+
+/* 
+ * writes gathered buffers to a TLS connection through OpenSSL,
+ * packing small buffers together so that each call produces full
+ * TLS records. data packed into a record counts as written, as the
+ * record is held until it is (see __webs_ssl_flush()). the caller
+ * must hold the client's lock.
+ * @param _self: the client to be written to.
+ * @param _iov: the buffers to be written.
+ * @param _cnt: the number of buffers.
+ * @param _flags: 0, or MSG_DONTWAIT to stop (rather than wait) once
+ * the connection can't take any more.
+ * @return the number of bytes written, or -1 on error (with `errno`
+ * set to EAGAIN if nothing could be written without waiting).
+ */
+static ssize_t __webs_ssl_writev(webs_client* _self, struct iovec* _iov,
+size_t _cnt, int _flags) {
+	ssize_t total = 0;
+	size_t i, off, n;
+	
+	/* (a record left held by the last call goes first) */
+	if (__webs_ssl_flush(_self, _flags) < 0)
+		return -1;
+	
+	for (i = 0; i < _cnt; i++) {
+		for (off = 0; off < _iov[i].iov_len; off += n) {
+			n = _iov[i].iov_len - off;
+			if (n > WEBS_TLS_RECORD - _self->tls_len)
+				n = WEBS_TLS_RECORD - _self->tls_len;
+			
+			memcpy(_self->tls_buf + _self->tls_len,
+				(char*) _iov[i].iov_base + off, n);
+			_self->tls_len += n;
+			total += n;
+			
+			if (_self->tls_len < WEBS_TLS_RECORD)
+				continue;
+			
+			if (__webs_ssl_flush(_self, _flags) < 0)
+				return errno == EAGAIN ? total : -1;
+		}
+	}
+	
+	if (__webs_ssl_flush(_self, _flags) < 0 && errno != EAGAIN)
+		return -1;
+	
+	return total;
+}
+#endif
+
+/* 
+ * reads the monotonic clock.
+ * @return the current time, in microseconds.
+ */
+static size_t __webs_now_us(void) {
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* 
+ * reads from a client's connection without blocking, spinning until
+ * data arrives or the server's `busy_poll_us` runs out, so that a read
+ * that would otherwise sleep (and then wait to be woken) finds the data
+ * already waiting.
+ * @param _self: the client to be read from.
+ * @param _dst: a buffer to store the resulting data.
+ * @param _n: the maximum number of bytes to be read.
+ * @param _flags: flags passed on to recv(2) (e.g. MSG_PEEK).
+ * @return the result of the read, or -1 with `errno` set to EAGAIN if
+ * nothing arrived in time.
+ */
+static ssize_t __webs_busy_read(webs_client* _self, void* _dst, size_t _n,
+int _flags) {
+	size_t start = 0, now = 0;
+	ssize_t n;
+	
+	for (;;) {
+		n = recv(_self->fd, _dst, _n, _flags | MSG_DONTWAIT);
+		
+		if (n >= 0 || errno != EAGAIN)
+			break;
+		
+		now = __webs_now_us();
+		
+		if (start == 0)
+			start = now;
+		
+		else if (now - start >= _self->srv->busy_poll_us)
+			break;
+		
+		/* spinning mustn't hold up a thread that shares the CPU (e.g.
+		 * the one that is about to send the data) */
+		sched_yield();
+	}
+	
+	/* (a read that found data straight away cost no spinning) */
+	if (start) {
+		if (n >= 0)
+			now = __webs_now_us();
+		
+		pthread_mutex_lock(&_self->lock);
+		_self->stats.busy_polls += n >= 0;
+		_self->stats.busy_us += now - start;
+		pthread_mutex_unlock(&_self->lock);
+	}
+	
+	return n;
+}
+
+/* 
+ * reads up to `_n` bytes from a client's connection, decrypting
+ * through OpenSSL if the connection uses TLS that the kernel is not
+ * handling.
+ * @param _self: the client to be read from.
+ * @param _dst: a buffer to store the resulting data.
+ * @param _n: the maximum number of bytes to be read.
+ * @return the result of the read.
+ */
+static ssize_t __webs_read_socket(webs_client* _self, void* _dst, size_t _n) {
+	ssize_t n;
+	
+	#ifdef WEBS_TLS
+		if (_self->ssl && !(_self->tls_flags & WEBS_KTLS_RX)) {
+			char c;
+			
+			/* spin until there is a record to decrypt (unless OpenSSL
+			 * already holds some decrypted data) */
+			if (_self->srv->busy_poll_us && !SSL_pending(_self->ssl))
+				__webs_busy_read(_self, &c, 1, MSG_PEEK);
+			
+			return __webs_ssl_read(_self, _dst, _n);
+		}
+	#endif
+	
+	if (_self->srv->busy_poll_us
+	&& ((n = __webs_busy_read(_self, _dst, _n, 0)) >= 0 || errno != EAGAIN))
+		return n;
+	
+	while ((n = read(_self->fd, _dst, _n)) < 0 && errno == EAGAIN)
+		if (__webs_wait_socket(_self, POLLIN) < 0)
+			break;
+	
+	return n;
+}
+
+/* 
+ * reads up to `_n` bytes from a client, taking them from whatever is
+ * left in its receive buffer (see __webs_read_batch()) first.
+ * @param _self: the client to be read from.
+ * @param _dst: a buffer to store the resulting data.
+ * @param _n: the maximum number of bytes to be read.
+ * @return the result of the read.
+ */
+static ssize_t __webs_read(webs_client* _self, void* _dst, size_t _n) {
+	struct webs_buffer* buf = _self->rbuf;
+	
+	if (buf == NULL || _self->rbuf_off == (size_t) buf->len)
+		return __webs_read_socket(_self, _dst, _n);
+	
+	if (_n > buf->len - _self->rbuf_off)
+		_n = buf->len - _self->rbuf_off;
+	
+	memcpy(_dst, buf->data + _self->rbuf_off, _n);
+	_self->rbuf_off += _n;
+	
+	return _n;
+}
+
+/* 
+ * writes gathered buffers to a client, encrypting through OpenSSL if
+ * the connection uses TLS that the kernel is not handling. the caller
+ * must hold the client's lock.
+ * @param _self: the client to be written to.
+ * @param _msg: the buffers to be written.
+ * @param _flags: flags passed on to sendmsg(2) (without MSG_DONTWAIT,
+ * this waits until the connection takes some of the data).
+ * @return the number of bytes written, or -1 on error.
+ */
+static ssize_t __webs_sendmsg(webs_client* _self, struct msghdr* _msg,
+int _flags) {
+	ssize_t n;
+	
+	#ifdef WEBS_TLS
+		if (_self->ssl && !(_self->tls_flags & WEBS_KTLS_TX))
+			return __webs_ssl_writev(_self, _msg->msg_iov, _msg->msg_iovlen,
+				_flags);
+	#endif
+	
+	while ((n = sendmsg(_self->fd, _msg, _flags)) < 0 && errno == EAGAIN
+	&& !(_flags & MSG_DONTWAIT))
+		if (__webs_wait_socket(_self, POLLOUT) < 0)
+			break;
+	
+	return n;
+}
+
+/* 
+ * writes a single buffer to a client, bypassing its outbound queue.
+ * @param _self: the client to be written to.
+ * @param _src: the data to be written.
+ * @param _n: the number of bytes to be written.
+ * @return the number of bytes written, or -1 on error.
+ */
+static ssize_t __webs_write(webs_client* _self, void* _src, size_t _n) {
+	struct msghdr msg = {0};
+	struct iovec iov;
+	size_t total = 0;
+	ssize_t n = 0;
+	
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	
+	pthread_mutex_lock(&_self->lock);
+	
+	/* (the connection may take the data a part at a time) */
+	while (total < _n) {
+		iov.iov_base = (char*) _src + total;
+		iov.iov_len = _n - total;
+		
+		if ((n = __webs_sendmsg(_self, &msg, MSG_NOSIGNAL)) < 0)
+			break;
+		
+		total += n;
+	}
+	
+	pthread_mutex_unlock(&_self->lock);
 	
-	return i + 4;
+	return n < 0 ? -1 : (ssize_t) total;
 }
 
 /* 
  * wraper functon that deals with reading lage amounts
  * of data, as well as attemts to complete partial reads.
- * @param _fd: the file desciptor to be read from.
+ * @param _self: the client to be read from.
  * @param _dst: a buffer to store the resulting data.
  * @param _n: the number of bytes to be read.
+ * @return -1 if the read failed or the connection was
+ * closed, or `_n` otherwise.
  */
-static ssize_t __webs_asserted_read(int _fd, void* _dst, size_t _n) {
+static ssize_t __webs_asserted_read(webs_client* _self, void* _dst, size_t _n) {
 	ssize_t bytes_read;
 	size_t size = 32768;
 	size_t i;
@@ -214,9 +606,9 @@ static ssize_t __webs_asserted_read(int _fd, void* _dst, size_t _n) {
 		if (_n - i < size)
 			size = _n - i;
 		
-		bytes_read = read(_fd, (char*) _dst + i, size);
+		bytes_read = __webs_read(_self, (char*) _dst + i, size);
 		
-		if (bytes_read < 0)
+		if (bytes_read <= 0)
 			return -1;
 		
 		i += bytes_read;
@@ -241,12 +633,12 @@ static int __webs_decode_data(char* _dta, uint32_t _key, ssize_t _n) {
 }
 
 /* 
- * empties bytes from a descriptor's internal buffer.
+ * empties bytes from a client's connection.
  * (this is used to skip frames that cannot be processed)
- * @param _fd: the descritor whos buffer is to be emptied.
+ * @param _self: the client whos data is to be discarded.
  * @return the number of bytes successfully processed.
  */
-static size_t __webs_flush(int _fd, size_t _n) {
+static size_t __webs_discard(webs_client* _self, size_t _n) {
 	static char vbuf[512];	/* void buffer */
 	short size = 512;     	/* number of bytes to dispose in next read */
 	ssize_t result;       	/* stores result of read(2) */
@@ -259,7 +651,7 @@ static size_t __webs_flush(int _fd, size_t _n) {
 		if (_n - i < 512)
 			size = _n - i;
 		
-		result = recv(_fd, vbuf, size, MSG_DONTWAIT);
+		result = __webs_read(_self, vbuf, size);
 		
 		if (result < 1 || (i += result) >= _n)
 			return i;
@@ -277,7 +669,7 @@ static int __webs_parse_frame(webs_client* _self, struct webs_frame* _frm) {
 	ssize_t error;
 	
 	/* read the 2-byte header field */
-	error = __webs_asserted_read(_self->fd, &_frm->info, 2);
+	error = __webs_asserted_read(_self, &_frm->info, 2);
 	if (error < 0) return -1; /* read(2) error, maybe broken pipe */
 	
 	/* read the length field (may offset payload) */
@@ -285,7 +677,7 @@ static int __webs_parse_frame(webs_client* _self, struct webs_frame* _frm) {
 	
 	/* a value of 126 here says to interpret the next two bytes */
 	if (WEBSFR_GET_LENGTH(_frm->info) == 126) {
-		error = __webs_asserted_read(_self->fd, &_frm->length, 2);
+		error = __webs_asserted_read(_self, &_frm->length, 2);
 		if (error < 0) return -1; /* read(2) error, maybe broken pipe */
 		
 		_frm->off = 4;
@@ -294,7 +686,7 @@ static int __webs_parse_frame(webs_client* _self, struct webs_frame* _frm) {
 	
 	/* a value of 127 says to interpret the next eight bytes */
 	else if (WEBSFR_GET_LENGTH(_frm->info) == 127) {
-		error = __webs_asserted_read(_self->fd, &_frm->length, 8);
+		error = __webs_asserted_read(_self, &_frm->length, 8);
 		if (error < 0) return -1; /* read(2) error, maybe broken pipe */
 		
 		_frm->off = 10;
@@ -307,7 +699,7 @@ static int __webs_parse_frame(webs_client* _self, struct webs_frame* _frm) {
 	/* if the data is masked, the payload is further offset
 	 * to fit a four byte key */
 	if (WEBSFR_GET_MASKED(_frm->info)) {
-		error = __webs_asserted_read(_self->fd, &_frm->key, 4);
+		error = __webs_asserted_read(_self, &_frm->key, 4);
 		if (error < 1) return -1; /* read(2) error, maybe broken pipe */
 	}
 	
@@ -325,16 +717,15 @@ static int __webs_parse_frame(webs_client* _self, struct webs_frame* _frm) {
 }
 
 /* 
- * generates a websocket frame from the provided data.
- * @param _src: a pointer to the frame's payload data.
- * @param _dst: a buffer that will hold the resulting frame.
+ * generates the header of a websocket frame.
+ * @param _dst: a buffer that will hold the resulting header.
  * @note the caller ensures this buffer is of adequate
- * length (it shouldn't need more than _n + 10 bytes).
+ * length (it shouldn't need more than 10 bytes).
  * @param _n: the size of the frame's payload data.
  * @param _op: the frame's opcode.
- * @return the total number of resulting bytes copied.
+ * @return the size of the resulting header.
  */
-static int __webs_make_frame(char* _src, char* _dst, ssize_t _n, uint8_t _op) {
+static int __webs_make_header(char* _dst, size_t _n, uint8_t _op) {
 	short data_start = 2;	/* offset to the start of the frame's payload */
 	uint16_t hdr = 0;    	/* the frame's header */
 	
@@ -343,28 +734,44 @@ static int __webs_make_frame(char* _src, char* _dst, ssize_t _n, uint8_t _op) {
 	
 	/* set frame length field */
 	
+	/* if we have 2^16 bytes or more, store the length in
+	 * the next eight bytes */
+	if (_n > 65535) {
+		WEBSFR_SET_LENGTH(hdr, 127);
+		CASTP(_dst + 2, uint64_t) = WEBS_BIG_ENDIAN_QWORD((uint64_t) _n);
+		data_start = 10;
+	}
+	
 	/* if we have more than 125 bytes, store the length in the
 	 * next two bytes */
-	if (_n > 125) {
+	else if (_n > 125) {
 		WEBSFR_SET_LENGTH(hdr, 126);
 		CASTP(_dst + 2, uint16_t) = WEBS_BIG_ENDIAN_WORD((uint16_t) _n);
 		data_start = 4;
 	}
 	
-	/* if we have more than 2^16 bytes, store the length in
-	 * the next eight bytes */
-	else if (_n > 65536) {
-		WEBSFR_SET_LENGTH(hdr, 127);
-		CASTP(_dst + 2, uint64_t) = WEBS_BIG_ENDIAN_QWORD((uint64_t) _n);
-		data_start = 10;
-	}
-	
 	/* otherwise place the value right in the field */
 	else WEBSFR_SET_LENGTH(hdr, _n);
 	
 	/* write header to buffer */
 	CASTP(_dst, uint16_t) = hdr;
 	
+	return data_start;
+}
+
+/* 
+ * generates a websocket frame from the provided data.
+ * @param _src: a pointer to the frame's payload data.
+ * @param _dst: a buffer that will hold the resulting frame.
+ * @note the caller ensures this buffer is of adequate
+ * length (it shouldn't need more than _n + 10 bytes).
+ * @param _n: the size of the frame's payload data.
+ * @param _op: the frame's opcode.
+ * @return the total number of resulting bytes copied.
+ */
+static size_t __webs_make_frame(char* _src, char* _dst, size_t _n, uint8_t _op) {
+	int data_start = __webs_make_header(_dst, _n, _op);
+	
 	/* copy data */
 	memcpy(_dst + data_start, _src, _n);
 	
@@ -372,508 +779,5210 @@ static int __webs_make_frame(char* _src, char* _dst, ssize_t _n, uint8_t _op) {
 }
 
 /* 
- * parses an HTTP header for web-socket related data.
- * @note this function is a bit of a mess...
- * @param _src: a pointer to the raw header data.
- * @param _rtn: a pointer to store the resulting data.
- * @return -1 on error (bad vers., ill-formed, etc.), or 0
- * otherwise.
+ * encodes a frame into a newly allocated packet, ready to be
+ * placed in a client's outbound queue.
+ * @param _src: a pointer to the frame's payload data.
+ * @param _n: the size of the frame's payload data.
+ * @param _op: the frame's opcode.
+ * @return a pointer to the new packet.
  */
-static int __webs_process_handshake(char* _src, struct webs_info* _rtn) {
-	char http_vrs_low = 0;
+static struct webs_packet* __webs_make_packet(char* _src, ssize_t _n,
+uint8_t _op) {
+	struct webs_packet* pkt = malloc(sizeof(struct webs_packet) + _n + 10);
 	
-	char param_str[256];
-	char req_type[8];
-	int nbytes = 0;
+	if (pkt == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
 	
-	_rtn->webs_key[0] = 0;
-	_rtn->webs_vrs = 0;
-	_rtn->http_vrs = 0;
+	pkt->next = NULL;
+	pkt->off = 0;
+	pkt->file = NULL;
+	pkt->file_len = 0;
+	pkt->keyed = 0;
+	pkt->len = __webs_make_frame(_src, pkt->data, _n, _op);
 	
-	sscanf(_src, "%s %*s HTTP/%c.%c%*[^\r]\r%n", req_type,
-		(char*) &_rtn->http_vrs, &http_vrs_low, &nbytes);
+	return pkt;
+}
+
+/* 
+ * copies an already encoded frame into a newly allocated packet.
+ * @param _frm: a pointer to the encoded frame.
+ * @param _n: the size of the encoded frame.
+ * @return a pointer to the new packet.
+ */
+static struct webs_packet* __webs_copy_packet(char* _frm, size_t _n) {
+	struct webs_packet* pkt = malloc(sizeof(struct webs_packet) + _n);
 	
-	_src += nbytes;
+	if (pkt == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
 	
-	if (strcmp(req_type, "GET"))
-		return -1;
+	pkt->next = NULL;
+	pkt->off = 0;
+	pkt->file = NULL;
+	pkt->file_len = 0;
+	pkt->keyed = 0;
+	pkt->len = _n;
+	memcpy(pkt->data, _frm, _n);
 	
-	_rtn->http_vrs <<= 8;
-	_rtn->http_vrs += http_vrs_low;
+	return pkt;
+}
+
+/* 
+ * creates a packet whose payload is read from a file when it is sent.
+ * only the frame header is held in memory.
+ * @param _file: the (shared) file holding the payload.
+ * @param _off: the offset of the payload within the file.
+ * @param _n: the size of the payload.
+ * @return a pointer to the new packet.
+ */
+static struct webs_packet* __webs_make_file_packet(struct webs_file* _file,
+off_t _off, size_t _n) {
+	struct webs_packet* pkt = malloc(sizeof(struct webs_packet) + 10);
 	
-	while (sscanf(_src, "%s%n", param_str, &nbytes) > 0) {
-		_src += nbytes;
-		
-		if (!strcmp(param_str, "Sec-WebSocket-Version:")) {
-			sscanf(_src, "%hu%*[^\r]\r%n", &_rtn->webs_vrs, &nbytes);
-			_src += nbytes;
-		}
-		
-		else
-		if (!strcmp(param_str, "Sec-WebSocket-Key:")) {
-			sscanf(_src, "%s%*[^\r]\r%n", _rtn->webs_key, &nbytes);
-			_src += nbytes;
-		}
-		
-		else {
-			sscanf(_src, "%*[^\r]\r%n", &nbytes);
-			_src += nbytes;
-		}
-	}
+	if (pkt == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
 	
-	if (!(_rtn->webs_key[0] || _rtn->webs_vrs || _rtn->http_vrs))
-		return -1;
+	pthread_mutex_lock(&_file->lock);
+	_file->refs++;
+	pthread_mutex_unlock(&_file->lock);
 	
-	return 0;
+	pkt->next = NULL;
+	pkt->off = 0;
+	pkt->file = _file;
+	pkt->keyed = 0;
+	pkt->file_off = _off;
+	pkt->file_len = _n;
+	pkt->len = __webs_make_header(pkt->data, _n, 0x2);
+	
+	return pkt;
 }
 
 /* 
- * generates an HTTP websocket handshake response. by the
- * specification (RFC-6455), this is done by concatonating the
- * client provided key with a magic string, and returning the
- * base-64 encoded, SHA-1 hash of the result in the "Sec-WebSocket-
- * Accept" field of an HTTP response header.
- * @param _dst: a buffer that will hold the resulting HTTP
- * response data.
- * @param _key: a pointer to the websocket key provided by the
- * client in it's HTTP websocket request header.
- * @return the total number of resulting bytes copied.
+ * wraps a duplicate of a caller's descriptor so that it can be shared
+ * between packets, and outlive the caller's copy.
+ * @param _fd: the descriptor to be duplicated.
+ * @return a pointer to the new file (with no references), or NULL if
+ * the descriptor could not be duplicated.
  */
-static int __webs_generate_handshake(char* _dst, char* _key) {
-	char buf[61]; 	/* size of result is 60 bytes */
-	char hash[21];	/* SHA-1 hash is 20 bytes */
-	int len = 0;
+static struct webs_file* __webs_open_file(int _fd) {
+	struct webs_file* file = malloc(sizeof(struct webs_file));
 	
-	len = __webs_strcat(buf, _key, "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
-	__webs_sha1(buf, hash, len);
-	len = __webs_b64_encode(hash, buf, 20);
-	buf[len] = '\0';
+	if (file == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
 	
-	return sprintf(_dst, WEBS_RESPONSE_FMT, buf);
+	file->fd = dup(_fd);
+	file->refs = 0;
+	
+	if (file->fd < 0) {
+		free(file);
+		return NULL;
+	}
+	
+	pthread_mutex_init(&file->lock, NULL);
+	
+	return file;
 }
 
 /* 
- * removes a client from a server's internal listing.
- * @param _node: a pointer to the client in the server's listing.
+ * drops a reference to a shared file, closing it once no packets
+ * refer to it.
+ * @param _file: the file to be released.
  */
-static void __webs_remove_client(struct webs_client_node* _node) {
-	if (_node == NULL) return;
+static void __webs_release_file(struct webs_file* _file) {
+	size_t refs;
 	
-	if (_node->prev)
-		_node->prev->next = _node->next;
+	pthread_mutex_lock(&_file->lock);
+	refs = --_file->refs;
+	pthread_mutex_unlock(&_file->lock);
 	
-	if (_node->next)
-		_node->next->prev = _node->prev;
+	if (refs) return;
 	
-	_node->client.srv->num_clients--;
-	free(_node);
+	close(_file->fd);
+	pthread_mutex_destroy(&_file->lock);
+	free(_file);
 	
 	return;
 }
 
 /* 
- * adds a client to a server's internal listing.
- * @param _srv: the server that the client should be added to.
- * @param _cli: the client to be added.
- * @return a pointer to the added client in the server's listing.
- * (or NULL if NULL was provided)
+ * frees a packet, along with its reference to a file (if any).
+ * @param _pkt: the packet to be freed.
  */
-static webs_client* __webs_add_client(webs_server* _srv, webs_client _cli) {
-	if (_srv == NULL) return NULL;
+static void __webs_free_packet(struct webs_packet* _pkt) {
+	if (_pkt->file)
+		__webs_release_file(_pkt->file);
 	
-	/* if this is first client, set head = tail = new element */
-	if (_srv->tail == NULL) {
-		_srv->tail = _srv->head = malloc(sizeof(struct webs_client_node));
+	free(_pkt);
+	
+	return;
+}
+
+/* 
+ * frees every packet in an outbound queue.
+ * @param _q: the queue to be emptied.
+ */
+static void __webs_clear_queue(struct webs_queue* _q) {
+	struct webs_packet* temp;
+	
+	while (_q->head) {
+		temp = _q->head->next;
+		__webs_free_packet(_q->head);
+		_q->head = temp;
+	}
+	
+	_q->tail = NULL;
+	_q->num_bytes = 0;
+	_q->file_bytes = 0;
+	
+	return;
+}
+
+/* 
+ * writes (part of) the file-backed payload of the packet at the head
+ * of a client's queue. the kernel copies the data straight from the
+ * page cache with sendfile(2) (or splice(2)) where it can, otherwise
+ * it is read through a buffer (for TLS encrypted in userspace, or for
+ * files neither call takes). a plain client's socket is made
+ * non-blocking for the call when the caller won't wait.
+ * @param _self: the client whose queue is being written.
+ * @param _pkt: the packet to be written (its header already sent).
+ * @param _flags: 0, or MSG_DONTWAIT to fail with EAGAIN (rather than
+ * wait) if the connection can't take any more. (a pipe is always
+ * waited for, as what is read from it can't be read again.)
+ * @return the number of bytes written, or -1 on error.
+ */
+static ssize_t __webs_send_file_part(webs_client* _self,
+struct webs_packet* _pkt, int _flags) {
+	struct msghdr msg = {0};
+	struct iovec iov;
+	char buf[16384];
+	size_t done = _pkt->off - _pkt->len;
+	size_t left = _pkt->file_len - done;
+	off_t pos = _pkt->file_off + done;
+	ssize_t n = -1;
+	int piped = 0;
+	int toggle = !_self->ssl && (_flags & MSG_DONTWAIT);
+	int err;
+	
+	if (!_self->ssl || (_self->tls_flags & WEBS_KTLS_TX)) {
+		/* (a TLS client's socket is always non-blocking) */
+		if (toggle)
+			fcntl(_self->fd, F_SETFL, O_NONBLOCK);
 		
-		if (_srv->tail == NULL)
-			WEBS_XERR("Failed to allocate memory!", ENOMEM);
+		do {
+			n = sendfile(_self->fd, _pkt->file->fd, &pos, left);
+			
+			/* sendfile(2) needs a file it can map, pipes can be
+			 * spliced */
+			if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+				n = splice(_pkt->file->fd, NULL, _self->fd, NULL, left,
+					SPLICE_F_MOVE | SPLICE_F_MORE);
+		} while (n < 0 && errno == EAGAIN && !(_flags & MSG_DONTWAIT)
+		&& __webs_wait_socket(_self, POLLOUT) == 0);
 		
-		_srv->head->prev = NULL;
+		if (toggle) {
+			err = errno;
+			fcntl(_self->fd, F_SETFL, 0);
+			errno = err;
+		}
+		
+		/* (EAGAIN leaves the rest to the poller) */
+		if (n > 0 || (n < 0 && errno != EINVAL))
+			return n;
 	}
 	
-	/* otherwise, just add after the current tail */
-	else {
-		_srv->tail->next = malloc(sizeof(struct webs_client_node));
+	if (left > sizeof(buf))
+		left = sizeof(buf);
+	
+	if (n != 0)
+		n = pread(_pkt->file->fd, buf, left, pos);
+	
+	if (n < 0 && errno == ESPIPE) {
+		n = read(_pkt->file->fd, buf, left);
+		piped = 1;
+	}
+	
+	/* the file is shorter than promised, the frame can't be finished */
+	if (n == 0)
+		errno = EIO;
+	
+	if (n <= 0)
+		return -1;
+	
+	iov.iov_base = buf;
+	iov.iov_len = left = n;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	
+	if (!piped)
+		return __webs_sendmsg(_self, &msg, MSG_NOSIGNAL | _flags);
+	
+	/* what was read from a pipe can't be read again, so all of it is
+	 * written, waiting on the connection if need be */
+	for (; iov.iov_len; iov.iov_len -= n) {
+		if ((n = __webs_sendmsg(_self, &msg, MSG_NOSIGNAL)) < 0)
+			return -1;
 		
-		if (_srv->tail->next == NULL)
-			WEBS_XERR("Failed to allocate memory!", ENOMEM);
+		iov.iov_base = (char*) iov.iov_base + n;
+	}
+	
+	return left;
+}
+
+/* 
+ * checks whether a packet holds a control frame (ping, pong or close).
+ * @param _pkt: the packet to be checked.
+ * @return 1 if it does, or 0 otherwise.
+ */
+static int __webs_is_control(struct webs_packet* _pkt) {
+	return (_pkt->data[0] & 0x0F) >= 0x8;
+}
+
+/* 
+ * picks which of a client's outbound queues to write from next. a frame
+ * that is partly written is always finished first, then urgent frames
+ * go ahead of normal ones, except that urgent data frames must wait for
+ * the end of any fragmented message being written from `out`. the
+ * caller must hold the client's lock.
+ * @param _self: the client whose queues are to be written.
+ * @return the queue to write from, or NULL if nothing can be written.
+ */
+static struct webs_queue* __webs_next_queue(webs_client* _self) {
+	struct webs_queue* urgent = &_self->urgent;
+	struct webs_packet* prev;
+	struct webs_packet* pkt;
+	
+	if (urgent->head && urgent->head->off > 0)
+		return urgent;
+	
+	if (_self->out.head && _self->out.head->off > 0)
+		return &_self->out;
+	
+	if (urgent->head && (!_self->mid_message || __webs_is_control(urgent->head)))
+		return urgent;
+	
+	/* control frames may still go between the message's fragments, so
+	 * move the first one ahead of the urgent data that has to wait */
+	for (prev = urgent->head; prev && prev->next; prev = prev->next) {
+		if (!__webs_is_control(prev->next))
+			continue;
+		
+		pkt = prev->next;
+		prev->next = pkt->next;
+		
+		if (urgent->tail == pkt)
+			urgent->tail = prev;
 		
-		_srv->tail->next->prev = _srv->tail;
-		_srv->tail = _srv->tail->next;
+		pkt->next = urgent->head;
+		urgent->head = pkt;
+		
+		return urgent;
+	}
+	
+	return _self->out.head ? &_self->out : NULL;
+}
+
+/* (defined below, alongside the other replay ring functions) */
+static struct webs_ring_entry* __webs_ring_reserve(webs_ring* _ring,
+size_t _len);
+static struct webs_packet* __webs_ring_copy(webs_ring* _ring, size_t _since,
+int* _count);
+
+/* (defined below, alongside the other client reference functions) */
+static void __webs_put_client(webs_client* _self);
+
+/* 
+ * records a data frame sent to a session (see webs_enable_resume()).
+ * each whole message takes the next sequence number in the session's
+ * ring, and those that can't be held there (streamed or file-backed
+ * ones) leave a gap, so that a session which missed one isn't resumed.
+ * @param _session: the session.
+ * @param _frm: the encoded frame (or just its header).
+ * @param _n: the size of the encoded frame.
+ * @param _whole: set if `_frm` holds the whole frame.
+ */
+static void __webs_session_record(struct webs_session* _session,
+char* _frm, size_t _n, int _whole) {
+	webs_ring* ring = _session->ring;
+	struct webs_ring_entry* e = NULL;
+	
+	/* (messages are counted by their final frames) */
+	if (!(_frm[0] & 0x80))
+		return;
+	
+	pthread_mutex_lock(&ring->lock);
+	
+	if (_whole && (_frm[0] & 0x0F) != 0x0)
+		e = __webs_ring_reserve(ring, _n);
+	
+	if (e) {
+		memcpy(ring->data + e->off, _frm, _n);
+		e->len = _n;
+		ring->write_off += e->len;
 	}
 	
-	_srv->tail->client = _cli;
-	_srv->tail->next = NULL;
+	else ring->next_seq++;
 	
-	_srv->num_clients++;
+	pthread_mutex_unlock(&ring->lock);
 	
-	return &_srv->tail->client;
+	return;
 }
 
 /* 
- * binds a socket to an address and port.
- * @param _soc: the socket to be bound.
- * @param _addr: a null-terminatng string containing the
- * address that the socket should be bound to.
- * @param _port: the port that the socket should be bound
- * to as a 16-bit integer.
- * @return -1 on error, or 0 otherwise.
+ * records a broadcast frame in every session of a server that has no
+ * open client to be sent it: those waiting to be resumed, and those
+ * whose client is resuming them (see __webs_session_open()). the
+ * caller must hold the server's lock.
+ * @param _srv: the server.
+ * @param _frm: the encoded frame (or just its header).
+ * @param _n: the size of the encoded frame.
+ * @param _whole: set if `_frm` holds the whole frame (otherwise the
+ * sessions are left with a gap, see __webs_session_record()).
  */
-static int __webs_bind_address(int _soc, int16_t _port) {
-	struct sockaddr_in soc_addr;
-	int error;
+static void __webs_record_sessions(webs_server* _srv, char* _frm, size_t _n,
+int _whole) {
+	struct webs_client_node* node;
+	struct webs_session* session;
 	
-	/* init struct */
-	soc_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-	soc_addr.sin_port = htons(_port);
-	soc_addr.sin_family = AF_INET;
+	for (session = _srv->waiting; session; session = session->newer)
+		__webs_session_record(session, _frm, _n, _whole);
 	
-	/* bind socket */
-	error = bind(_soc, (struct sockaddr*) &soc_addr, sizeof(soc_addr));
+	if (_srv->num_resuming)
+		for (node = _srv->head; node; node = node->next)
+			if (node->client.resuming)
+				__webs_session_record(node->client.session, _frm, _n, _whole);
 	
-	return -(error < 0);
+	return;
 }
 
 /* 
- * accepts a connection from a client and provides it with
- * relevant data.
- * @param _soc: the socket that the connection is being requested on.
- * @param _cli: the client that is to be connected.
- * @return -1 on error, or 0 otherwise.
+ * finds the bucket of a server's session table that a token belongs in.
+ * @param _srv: the server.
+ * @param _token: the session's token.
+ * @return the head of the bucket's list.
  */
-static int __webs_accept_connection(int _soc, webs_client* _c) {
-	/* static id counter variable */
-	static size_t client_id_counter = 0;
+static struct webs_session** __webs_session_bucket(webs_server* _srv,
+char* _token) {
+	size_t hash = 5381;
 	
-	socklen_t addr_size = sizeof(_c->addr);
+	while (*_token)
+		hash = hash * 33 + (unsigned char) *_token++;
 	
-	_c->fd = accept(_soc, (struct sockaddr*) &_c->addr, &addr_size);
-	if (_c->fd < 0) return -1;
+	return &_srv->sessions[hash % WEBS_RESUME_BUCKETS];
+}
+
+/* 
+ * compares a token asked for with a session's, in a time that doesn't
+ * depend on how much of it matches (so that it can't be guessed one
+ * character at a time).
+ * @param _token: the token asked for (WEBS_RESUME_TOKEN characters).
+ * @param _session: the session's token.
+ * @return 1 if the tokens match, or 0 otherwise.
+ */
+static int __webs_token_equal(char* _token, char* _session) {
+	unsigned char diff = 0;
+	int i;
 	
-	_c->id = client_id_counter;
-	client_id_counter++;
+	for (i = 0; i < WEBS_RESUME_TOKEN; i++)
+		diff |= (unsigned char) (_token[i] ^ _session[i]);
 	
-	return _c->fd;
+	return diff == 0;
 }
 
 /* 
- * main client function, called on a thread for each
- * connected client.
- * @param _self: the client who is calling.
+ * takes a session off a server's list of sessions waiting to be
+ * resumed. the caller must hold the server's lock.
+ * @param _srv: the server.
+ * @param _session: the (waiting) session.
  */
-static void* __webs_client_main(void* _self) {
-	webs_client* self = (webs_client*) _self;
-	ssize_t total;
-	ssize_t error;
+static void __webs_session_unwait(webs_server* _srv,
+struct webs_session* _session) {
+	if (_session->older)
+		_session->older->newer = _session->newer;
+	else
+		_srv->waiting = _session->newer;
 	
-	/* flag set if frame is a continuation one */
-	int cont = 0;
+	if (_session->newer)
+		_session->newer->older = _session->older;
+	else
+		_srv->waiting_tail = _session->older;
 	
-	/* general-purpose recv/send buffer */
-	struct webs_buffer soc_buffer = {0};
+	_session->older = _session->newer = NULL;
+	_srv->num_waiting--;
 	
-	/* temporary variables */
-	struct webs_info ws_info;
-	struct webs_frame frm;
-	char* data = 0;
+	return;
+}
+
+/* 
+ * removes a session from a server's table (and its list of waiting
+ * sessions, if it's waiting), to be freed by the caller once it has
+ * released the server's lock.
+ * @param _srv: the server.
+ * @param _session: the session.
+ */
+static void __webs_session_unlink(webs_server* _srv,
+struct webs_session* _session) {
+	struct webs_session** link = __webs_session_bucket(_srv, _session->token);
 	
-	/* wait for HTTP websocket request header */
-	soc_buffer.len = read(self->fd, soc_buffer.data, WEBS_MAX_PACKET - 1);
+	while (*link != _session)
+		link = &(*link)->next;
 	
-	/* if we did not recieve one, abort */
-	if (soc_buffer.len < 0)
-		goto ABORT;
+	*link = _session->next;
 	
-	/* process handshake */
-	soc_buffer.data[soc_buffer.len] = '\0';
+	if (_session->client == NULL)
+		__webs_session_unwait(_srv, _session);
 	
-	/* if we failed, abort */
-	if (__webs_process_handshake(soc_buffer.data, &ws_info) < 0)
-		goto ABORT;
+	return;
+}
+
+/* 
+ * frees a session (once it has been unlinked).
+ * @param _session: the session.
+ */
+static void __webs_session_free(struct webs_session* _session) {
+	webs_ring_free(_session->ring);
+	free(_session);
 	
-	/* if we succeeded, generate + tansmit response */
-	soc_buffer.len = __webs_generate_handshake(soc_buffer.data,
-		ws_info.webs_key);
+	return;
+}
+
+/* 
+ * starts a new session, with a random token.
+ * @param _srv: the server the session belongs to.
+ * @return the session (not yet in the server's table), or NULL on error.
+ */
+static struct webs_session* __webs_session_create(webs_server* _srv) {
+	struct webs_session* session;
+	unsigned char bytes[WEBS_RESUME_TOKEN / 2];
+	int fd, i;
 	
-	send(self->fd, soc_buffer.data, soc_buffer.len, 0);
+	fd = open("/dev/urandom", O_RDONLY);
 	
-	/* call client on_open function */
-	if (*self->srv->events.on_open)
-		(*self->srv->events.on_open)(self);
+	if (fd < 0)
+		return NULL;
 	
-	/* main loop */
-	for (;;) {
-		if (__webs_parse_frame(self, &frm) < 0) {
-			error = WEBS_ERR_READ_FAILED;
-			break;
+	i = read(fd, bytes, sizeof(bytes));
+	close(fd);
+	
+	if (i != (int) sizeof(bytes))
+		return NULL;
+	
+	session = malloc(sizeof(struct webs_session));
+	
+	if (session == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
+	
+	session->ring = webs_ring_create(_srv->resume_frames, _srv->resume_bytes,
+		NULL);
+	
+	if (session->ring == NULL) {
+		free(session);
+		return NULL;
+	}
+	
+	for (i = 0; i < (int) sizeof(bytes); i++)
+		sprintf(session->token + 2 * i, "%02x", bytes[i]);
+	
+	session->next = session->older = session->newer = NULL;
+	session->client = NULL;
+	session->left = 0;
+	
+	return session;
+}
+
+/* 
+ * checks that a session still holds every message after those that a
+ * client has seen.
+ * @param _ring: the session's ring.
+ * @param _seen: the number of messages the client has seen.
+ * @return 1 if it does, or 0 otherwise.
+ */
+static int __webs_session_covers(webs_ring* _ring, size_t _seen) {
+	size_t held = 0, i;
+	int covers;
+	
+	pthread_mutex_lock(&_ring->lock);
+	
+	for (i = 0; i < _ring->count; i++)
+		if (_ring->entries[(_ring->first + i) % _ring->max_frames].seq > _seen)
+			held++;
+	
+	/* (messages that couldn't be held leave gaps in the sequence) */
+	covers = _seen < _ring->next_seq && held == _ring->next_seq - 1 - _seen;
+	
+	pthread_mutex_unlock(&_ring->lock);
+	
+	return covers;
+}
+
+/* 
+ * gives a client the session it asked to resume, if it can be, along
+ * with copies of the frames that the client missed. otherwise the
+ * client is given a new session.
+ * @param _self: the client (whose handshake has been read).
+ * @param _info: the client's handshake.
+ * @param _missed: set to the frames the client missed (or NULL), to
+ * be sent once the handshake has been answered.
+ * @return 1 if the session was resumed, 0 if the client was given a
+ * new one, or -1 if it couldn't be given one.
+ */
+static int __webs_session_attach(webs_client* _self, struct webs_info* _info,
+struct webs_packet** _missed) {
+	webs_server* srv = _self->srv;
+	struct webs_session* session = NULL;
+	struct webs_session* stale = NULL;
+	struct webs_session** bucket;
+	webs_client* old = NULL;
+	int count;
+	
+	*_missed = NULL;
+	
+	pthread_mutex_lock(&srv->lock);
+	
+	/* (a token's length gives nothing away) */
+	if (strlen(_info->resume) == WEBS_RESUME_TOKEN) {
+		bucket = __webs_session_bucket(srv, _info->resume);
+		
+		for (session = *bucket; session; session = session->next)
+			if (__webs_token_equal(_info->resume, session->token))
+				break;
+	}
+	
+	if (session) {
+		old = session->client;
+		
+		/* the session's last connection may not have noticed that it
+		 * dropped yet, in which case it's cut off (once the server's
+		 * lock is released, holding a reference until then) */
+		if (old) {
+			pthread_mutex_lock(&old->lock);
+			old->session = NULL;
+			old->refs++;
+			pthread_mutex_unlock(&old->lock);
+			
+			if (old->resuming) {
+				old->resuming = 0;
+				srv->num_resuming--;
+			}
 		}
 		
-		/* only accept supported frames */
-		if (WEBSFR_GET_OPCODE(frm.info) != 0x0
-		 && WEBSFR_GET_OPCODE(frm.info) != 0x1
-		 && WEBSFR_GET_OPCODE(frm.info) != 0x2
-		 && WEBSFR_GET_OPCODE(frm.info) != 0x8
-		 && WEBSFR_GET_OPCODE(frm.info) != 0x9
-		 && WEBSFR_GET_OPCODE(frm.info) != 0xA) {
-			if (*self->srv->events.on_error)
-				(*self->srv->events.on_error)(self, WEBS_ERR_NO_SUPPORT);
+		else __webs_session_unwait(srv, session);
+		
+		session->client = _self;
+		
+		if (!__webs_session_covers(session->ring, _info->resume_seen)) {
+			__webs_session_unlink(srv, session);
+			stale = session;
+			session = NULL;
+		}
+		
+		/* (copied while the server's lock keeps the session from
+		 * being taken over, and freed) */
+		else {
+			*_missed = __webs_ring_copy(session->ring, _info->resume_seen,
+				&count);
+			
+			pthread_mutex_lock(&_self->lock);
+			_self->session = session;
+			pthread_mutex_unlock(&_self->lock);
 			
-			__webs_flush(self->fd, frm.off + frm.length - 2);
+			/* frames published until the client opens are kept in
+			 * the session, see __webs_session_open() */
+			_self->resuming = 1;
+			_self->resume_seq = _info->resume_seen + count;
+			srv->num_resuming++;
+		}
+	}
+	
+	pthread_mutex_unlock(&srv->lock);
+	
+	if (old) {
+		pthread_mutex_lock(&old->lock);
+		webs_eject(old);
+		pthread_mutex_unlock(&old->lock);
+		__webs_put_client(old);
+	}
+	
+	if (stale)
+		__webs_session_free(stale);
+	
+	if (session)
+		return 1;
+	
+	session = __webs_session_create(srv);
+	
+	if (session == NULL)
+		return -1;
+	
+	session->client = _self;
+	bucket = __webs_session_bucket(srv, session->token);
+	
+	pthread_mutex_lock(&srv->lock);
+	
+	session->next = *bucket;
+	*bucket = session;
+	
+	pthread_mutex_lock(&_self->lock);
+	_self->session = session;
+	pthread_mutex_unlock(&_self->lock);
+	
+	pthread_mutex_unlock(&srv->lock);
+	
+	return 0;
+}
+
+/* 
+ * opens a client, once it has been sent everything its session missed.
+ * frames published while a client resumes its session are kept in the
+ * session (see __webs_broadcast_frame()), and are sent to the client
+ * before it opens.
+ * @param _self: the client (whose handshake has been answered).
+ * @return copies of the frames that are still to be sent (after which
+ * this is called again), or NULL if the client is now open.
+ */
+static struct webs_packet* __webs_session_open(webs_client* _self) {
+	webs_server* srv = _self->srv;
+	struct webs_packet* missed = NULL;
+	webs_ring* ring;
+	int count, stale = 0;
+	
+	/* (broadcasts decide whether a client is open under the server's
+	 * lock, and either keep a frame in its session or queue it) */
+	pthread_mutex_lock(&srv->lock);
+	
+	if (_self->resuming) {
+		ring = _self->session->ring;
+		
+		/* a client that fell too far behind starts over when it
+		 * reconnects (nor is one that was ejected caught up) */
+		stale = !__webs_session_covers(ring, _self->resume_seq);
+		
+		if (!stale && !_self->ejected
+		&& (missed = __webs_ring_copy(ring, _self->resume_seq, &count)))
+			_self->resume_seq += count;
+		
+		if (missed == NULL) {
+			_self->resuming = 0;
+			srv->num_resuming--;
+		}
+	}
+	
+	if (missed == NULL) {
+		pthread_mutex_lock(&_self->lock);
+		_self->state = WEBS_STATE_OPEN;
+		pthread_mutex_unlock(&_self->lock);
+	}
+	
+	pthread_mutex_unlock(&srv->lock);
+	
+	if (stale) {
+		pthread_mutex_lock(&_self->lock);
+		webs_eject(_self);
+		pthread_mutex_unlock(&_self->lock);
+	}
+	
+	return missed;
+}
+
+/* 
+ * leaves a client's session waiting to be resumed, once the client has
+ * left (unless another connection has taken the session over). the
+ * caller must hold the server's lock.
+ * @param _srv: the server.
+ * @param _session: the session.
+ * @param _cli: the client that has left.
+ * @return the oldest waiting session, if it was dropped to make room
+ * (and is to be freed by the caller), or NULL.
+ */
+static struct webs_session* __webs_session_detach(webs_server* _srv,
+struct webs_session* _session, webs_client* _cli) {
+	struct webs_session* oldest = NULL;
+	
+	if (_session->client != _cli)
+		return NULL;
+	
+	_session->client = NULL;
+	_session->left = __webs_now_us();
+	_session->older = _srv->waiting_tail;
+	_session->newer = NULL;
+	
+	if (_srv->waiting_tail)
+		_srv->waiting_tail->newer = _session;
+	
+	/* the expiry thread sleeps while no session is waiting */
+	else {
+		_srv->waiting = _session;
+		pthread_cond_signal(&_srv->resume_cond);
+	}
+	
+	_srv->waiting_tail = _session;
+	
+	if (++_srv->num_waiting > WEBS_RESUME_MAX_WAITING) {
+		oldest = _srv->waiting;
+		__webs_session_unlink(_srv, oldest);
+	}
+	
+	return oldest;
+}
+
+/* 
+ * main function for a server's session expiry thread, which drops each
+ * session that has waited `resume_ms` to be resumed.
+ * @param _srv: the server.
+ */
+static void* __webs_session_main(void* _srv) {
+	webs_server* srv = (webs_server*) _srv;
+	struct webs_session* session;
+	struct timespec deadline;
+	size_t now, wait;
+	
+	pthread_mutex_lock(&srv->lock);
+	
+	while (!srv->closing) {
+		session = srv->waiting;
+		
+		if (session == NULL) {
+			pthread_cond_wait(&srv->resume_cond, &srv->lock);
 			continue;
 		}
 		
-		/* check if packet is too big */
-		if ((size_t) frm.length > SSIZE_MAX) {
-			if (*self->srv->events.on_error)
-				(*self->srv->events.on_error)(self, WEBS_ERR_OVERFLOW);
+		now = __webs_now_us();
+		
+		if (now >= session->left + srv->resume_ms * 1000) {
+			__webs_session_unlink(srv, session);
+			
+			pthread_mutex_unlock(&srv->lock);
+			__webs_session_free(session);
+			pthread_mutex_lock(&srv->lock);
 			
-			__webs_flush(self->fd, frm.off + frm.length - 2);
 			continue;
 		}
 		
-		/* respond to ping */
-		if (WEBSFR_GET_OPCODE(frm.info) == 0x9) {
-			__webs_flush(self->fd, frm.off + frm.length - 2);
+		/* (sessions wait for the same time, so the oldest is the
+		 * next to expire) */
+		wait = session->left + srv->resume_ms * 1000 - now;
+		
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += wait / 1000000;
+		deadline.tv_nsec += (wait % 1000000) * 1000;
+		
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		
+		pthread_cond_timedwait(&srv->resume_cond, &srv->lock, &deadline);
+	}
+	
+	pthread_mutex_unlock(&srv->lock);
+	
+	return NULL;
+}
+
+/* 
+ * writes out a client's outbound queues, gathering as many queued
+ * frames as possible into each call to sendmsg(2). urgent frames are
+ * written first, and normal ones are written one at a time while
+ * urgent ones wait, so that those go out at the next frame boundary.
+ * the caller must hold the client's lock.
+ * @param _self: the client whose queues are to be written.
+ * @param _flags: 0, or MSG_DONTWAIT to stop (rather than wait) once
+ * the connection can't take any more. (payloads read from pipes are
+ * always waited for.)
+ * @return -1 on error, 1 if frames were left queued (or a TLS record
+ * is still held, see __webs_ssl_flush()), or 0 otherwise.
+ */
+static int __webs_write_queue(webs_client* _self, int _flags) {
+	struct iovec iov[WEBS_MAX_IOV];
+	struct msghdr msg = {0};
+	struct webs_packet* last = NULL;
+	struct webs_packet* pkt;
+	struct webs_queue* q;
+	ssize_t n;
+	int i, more, file;
+	
+	while ((q = __webs_next_queue(_self))) {
+		pkt = q->head;
+		
+		/* a packet whose in-memory part has been written must be
+		 * waiting on its file-backed payload */
+		if ((file = pkt->off >= pkt->len)) {
+			n = __webs_send_file_part(_self, pkt, _flags);
+		}
+		
+		else {
+			/* gather frames up to (and including the header of)
+			 * the next file-backed packet */
+			for (i = 0; pkt && i < WEBS_MAX_IOV; pkt = pkt->next) {
+				iov[i].iov_base = pkt->data + pkt->off;
+				iov[i++].iov_len = pkt->len - pkt->off;
+				last = pkt;
+				if (pkt->file) break;
+				
+				/* urgent frames are waiting on this one */
+				if (q == &_self->out && _self->urgent.head) break;
+				
+				/* urgent data waits for the end of a message */
+				if (q == &_self->urgent && _self->mid_message
+				&& pkt->next && !__webs_is_control(pkt->next)) break;
+			}
+			
+			msg.msg_iov = iov;
+			msg.msg_iovlen = i;
+			
+			/* if more data follows this batch, let the kernel know
+			 * so it doesn't push out a partial segment */
+			more = last->file || last->next;
+			
+			if (q == &_self->urgent)
+				more = more || _self->out.head;
+			else if (_self->urgent.head)
+				more = more || __webs_is_control(_self->urgent.head)
+				|| (last->data[0] & 0x80);
+			
+			n = __webs_sendmsg(_self, &msg,
+				MSG_NOSIGNAL | _flags | (more ? MSG_MORE : 0));
+		}
+		
+		_self->stats.write_calls++;
+		
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN && (_flags & MSG_DONTWAIT)) return 1;
+			__webs_clear_queue(&_self->out);
+			__webs_clear_queue(&_self->urgent);
+			return -1;
+		}
+		
+		_self->stats.bytes_out += n;
+		q->num_bytes -= n;
+		WEBS_PROBE2(write, _self->id, n);
+		
+		if (file)
+			q->file_bytes -= n;
+		
+		/* release every frame that was written in full */
+		while ((pkt = q->head)) {
+			if ((size_t) n < pkt->len + pkt->file_len - pkt->off) {
+				pkt->off += n;
+				break;
+			}
+			
+			n -= pkt->len + pkt->file_len - pkt->off;
+			q->head = pkt->next;
+			
+			/* note whether `out` is partway through a message */
+			if (q == &_self->out && !__webs_is_control(pkt))
+				_self->mid_message = !(pkt->data[0] & 0x80);
+			
+			/* (frames a resumed session missed are written before it
+			 * opens, and aren't recorded again) */
+			if (_self->session && _self->state == WEBS_STATE_OPEN
+			&& !__webs_is_control(pkt))
+				__webs_session_record(_self->session, pkt->data, pkt->len,
+					pkt->file == NULL);
+			
+			__webs_free_packet(pkt);
+		}
+		
+		if (pkt == NULL)
+			q->tail = NULL;
+	}
+	
+	#ifdef WEBS_TLS
+		/* (the last of the data may still be held in a record) */
+		if (_self->tls_len && __webs_ssl_flush(_self, _flags) < 0)
+			return errno == EAGAIN ? 1 : -1;
+	#endif
+	
+	return 0;
+}
+
+/* 
+ * writes out a client's outbound queues, waiting for the connection
+ * to take all of it, see __webs_write_queue().
+ * @param _self: the client whose queues are to be written.
+ * @return -1 on error, or 0 otherwise.
+ */
+static int __webs_flush_queue(webs_client* _self) {
+	return __webs_write_queue(_self, 0);
+}
+
+/* 
+ * replaces the unsent frame in a queue that has the same key as a
+ * new one (if there is one).
+ * @param _q: the queue to be searched.
+ * @param _pkt: the new (keyed) frame.
+ * @return 1 if a frame was replaced, or 0 otherwise.
+ */
+static int __webs_replace_keyed(struct webs_queue* _q, struct webs_packet* _pkt) {
+	struct webs_packet* prev = NULL;
+	struct webs_packet* pkt;
+	
+	for (pkt = _q->head; pkt; prev = pkt, pkt = pkt->next) {
+		/* a frame that has been partly written must be finished */
+		if (!pkt->keyed || pkt->key != _pkt->key || pkt->off)
+			continue;
+		
+		_pkt->next = pkt->next;
+		
+		if (prev) prev->next = _pkt;
+		else _q->head = _pkt;
+		
+		if (_q->tail == pkt)
+			_q->tail = _pkt;
+		
+		_q->num_bytes += _pkt->len - pkt->len;
+		__webs_free_packet(pkt);
+		
+		return 1;
+	}
+	
+	return 0;
+}
+
+/* 
+ * (re)arms a client's watch on its server's epoll(7) instance, for
+ * whatever the client waits on: its connection waking while it is
+ * parked, and draining while it has a backlog. the caller must hold
+ * the client's lock.
+ * @param _self: the client (which is parked, or `writing`).
+ * @return -1 on error, or 0 otherwise.
+ */
+static int __webs_watch(webs_client* _self) {
+	int epfd = _self->srv->epfd;
+	struct epoll_event ev;
+	
+	ev.events = EPOLLONESHOT;
+	ev.data.ptr = &_self->watch;
+	
+	if (_self->parked)
+		ev.events |= EPOLLIN | EPOLLRDHUP;
+	
+	if (_self->writing)
+		ev.events |= EPOLLOUT;
+	
+	if (epoll_ctl(epfd, EPOLL_CTL_MOD, _self->fd, &ev) == 0
+	|| epoll_ctl(epfd, EPOLL_CTL_ADD, _self->fd, &ev) == 0)
+		return 0;
+	
+	return -1;
+}
+
+/* 
+ * checks whether a client has WEBS_MAX_BEHIND bytes or more queued in
+ * memory. the caller must hold the client's lock.
+ * @param _self: the client.
+ * @return 1 if it has, or 0 otherwise.
+ */
+static int __webs_is_behind(webs_client* _self) {
+	return _self->out.num_bytes - _self->out.file_bytes
+	+ _self->urgent.num_bytes - _self->urgent.file_bytes >= WEBS_MAX_BEHIND;
+}
+
+/* 
+ * leaves whatever remains of a client's outbound queues to its
+ * server's poller (or, if the client can't be watched, waits for the
+ * connection to take it). the caller must hold the client's lock.
+ * @param _self: the client, which has frames left to write.
+ * @return -1 on error, 0 if the queues were flushed, or 1 if the
+ * poller is writing them.
+ */
+static int __webs_leave_queue(webs_client* _self) {
+	if (_self->writing)
+		return 1;
+	
+	_self->writing = 1;
+	
+	if (__webs_watch(_self) == 0)
+		return 1;
+	
+	_self->writing = 0;
+	
+	return __webs_flush_queue(_self);
+}
+
+/* 
+ * checks whether the calling thread is the one handling a client's
+ * messages (its own thread, or a pool worker running its handler).
+ * @param _self: the client.
+ * @return 1 if it is, or 0 otherwise.
+ */
+static int __webs_on_own_thread(webs_client* _self) {
+	return (!_self->parked && pthread_equal(pthread_self(), _self->thread))
+	|| (_self->working && pthread_equal(pthread_self(), _self->worker));
+}
+
+/* 
+ * places a packet in a client's outbound queue. packets queued from
+ * the client's own thread are held until the end of the current loop
+ * iteration (unless too much data has built up), anything else is
+ * written immediately (as far as the connection takes it at once, with
+ * WEBS_QUEUE_NOWAIT). while a message is being streamed, other normal
+ * data frames are held back until it ends (control frames are not).
+ * @param _self: the client that the packet is to be sent to.
+ * @param _pkt: the packet to be queued (or the first of a chain of
+ * packets linked through `next`).
+ * @param _flags: WEBS_QUEUE_* flags.
+ * @param _prio: the packet's class, WEBS_PRIO_NORMAL or WEBS_PRIO_URGENT
+ * (control frames are always urgent).
+ * @note the caller must hold the client's lock (see
+ * __webs_enqueue_frames()).
+ * @return -1 on error, or the size of the (first) packet otherwise.
+ */
+static int __webs_queue_frames(webs_client* _self, struct webs_packet* _pkt,
+int _flags, int _prio) {
+	int fragment = _flags & WEBS_QUEUE_FRAGMENT;
+	struct webs_queue* q = &_self->out;
+	int keyed = _pkt->keyed;
+	int len = _pkt->len;
+	int n;
+	
+	if (__webs_is_control(_pkt) || (_prio == WEBS_PRIO_URGENT && !fragment))
+		q = &_self->urgent;
+	
+	else if (_self->stream_op >= 0 && !fragment)
+		q = &_self->held;
+	
+	/* a keyed frame replaces an older one still waiting in place */
+	if (keyed && __webs_replace_keyed(q, _pkt)) {
+		_self->stats.conflated++;
+		_self->stats.msgs_out++;
+		_pkt = NULL;
+	}
+	
+	else if (q->tail)
+		q->tail->next = _pkt;
+	else
+		q->head = _pkt;
+	
+	for (; _pkt; _pkt = _pkt->next) {
+		q->tail = _pkt;
+		q->num_bytes += _pkt->len + _pkt->file_len;
+		q->file_bytes += _pkt->file_len;
+		_self->stats.msgs_out++;
+		WEBS_PROBE2(enqueue, _self->id, _pkt->len + _pkt->file_len);
+	}
+	
+	/* broadcasts don't wait on the connection, whatever it can't take
+	 * is left to the server's poller (started by __webs_get_clients()),
+	 * unless too much has been left in memory already (conflated frames
+	 * can't pile up) */
+	if (__webs_is_behind(_self) && !keyed)
+		_flags &= ~WEBS_QUEUE_NOWAIT;
+	
+	/* nor do handlers running on a pool's workers, which mustn't be
+	 * held up by one slow client (a client that falls too far behind
+	 * has its next jobs held back instead, see __webs_worker_main()) */
+	if (_self->working && pthread_equal(pthread_self(), _self->worker))
+		_flags |= WEBS_QUEUE_NOWAIT;
+	
+	if (q != &_self->held && (!__webs_on_own_thread(_self)
+	|| _self->out.num_bytes + _self->urgent.num_bytes >= WEBS_MAX_QUEUE)) {
+		n = __webs_write_queue(_self,
+			(_flags & WEBS_QUEUE_NOWAIT) ? MSG_DONTWAIT : 0);
+		
+		if (n > 0)
+			n = __webs_leave_queue(_self);
+		
+		if (n < 0)
+			len = -1;
+	}
+	
+	return len;
+}
+
+/* 
+ * places a packet in a client's outbound queue, as with
+ * __webs_queue_frames(), taking the client's lock.
+ * @param _self: the client that the packet is to be sent to.
+ * @param _pkt: the packet to be queued (or the first of a chain).
+ * @param _flags: WEBS_QUEUE_* flags.
+ * @param _prio: the packet's class.
+ * @return -1 on error, or the size of the (first) packet otherwise.
+ */
+static int __webs_enqueue_frames(webs_client* _self, struct webs_packet* _pkt,
+int _flags, int _prio) {
+	int len;
+	
+	pthread_mutex_lock(&_self->lock);
+	len = __webs_queue_frames(_self, _pkt, _flags, _prio);
+	pthread_mutex_unlock(&_self->lock);
+	
+	return len;
+}
+
+/* 
+ * places a packet (or chain of packets) in a client's outbound queue,
+ * as with __webs_enqueue_frames(), in the normal class.
+ * @param _self: the client that the packet is to be sent to.
+ * @param _pkt: the packet to be queued.
+ * @return -1 on error, or the size of the (first) packet otherwise.
+ */
+static int __webs_enqueue(webs_client* _self, struct webs_packet* _pkt) {
+	return __webs_enqueue_frames(_self, _pkt, 0, WEBS_PRIO_NORMAL);
+}
+
+/* 
+ * reads the number of data-carrying segments the kernel has sent
+ * on a client's connection into its stats. the caller must hold the
+ * client's lock.
+ * @param _self: the client to be sampled.
+ */
+static void __webs_sample_segments(webs_client* _self) {
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+	
+	if (getsockopt(_self->fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0
+	&& len >= offsetof(struct tcp_info, tcpi_data_segs_out) + 4)
+		_self->stats.segs_out = info.tcpi_data_segs_out;
+	
+	return;
+}
+
+/* 
+ * adds one set of traffic counters to another.
+ * @param _dst: the counters to be added to.
+ * @param _src: the counters to be added.
+ */
+static void __webs_add_stats(struct webs_stats* _dst, struct webs_stats* _src) {
+	_dst->msgs_in     += _src->msgs_in;
+	_dst->bytes_in    += _src->bytes_in;
+	_dst->msgs_out    += _src->msgs_out;
+	_dst->bytes_out   += _src->bytes_out;
+	_dst->write_calls += _src->write_calls;
+	_dst->segs_out    += _src->segs_out;
+	_dst->throttled   += _src->throttled;
+	_dst->throttle_us += _src->throttle_us;
+	_dst->parks       += _src->parks;
+	_dst->shed        += _src->shed;
+	_dst->deferred    += _src->deferred;
+	_dst->conflated   += _src->conflated;
+	_dst->busy_polls  += _src->busy_polls;
+	_dst->busy_us     += _src->busy_us;
+	_dst->conns       += _src->conns;
+	_dst->jobs        += _src->jobs;
+	_dst->job_wait_us += _src->job_wait_us;
+	
+	if (_src->job_wait_max_us > _dst->job_wait_max_us)
+		_dst->job_wait_max_us = _src->job_wait_max_us;
+	
+	return;
+}
+
+/* 
+ * parses an HTTP header for web-socket related data.
+ * @note this function is a bit of a mess...
+ * @param _src: a pointer to the raw header data.
+ * @param _rtn: a pointer to store the resulting data.
+ * @return -1 on error (bad vers., ill-formed, etc.), or 0
+ * otherwise.
+ */
+static int __webs_process_handshake(char* _src, struct webs_info* _rtn) {
+	char http_vrs_low = 0;
+	
+	char param_str[256];
+	char req_type[8];
+	unsigned long seen;
+	int nbytes = 0;
+	char* query;
+	
+	_rtn->webs_key[0] = 0;
+	_rtn->webs_vrs = 0;
+	_rtn->http_vrs = 0;
+	_rtn->path[0] = 0;
+	_rtn->etag[0] = 0;
+	_rtn->resume[0] = 0;
+	_rtn->resume_seen = 0;
+	
+	/* (the path's width is WEBS_MAX_PATH - 1) */
+	sscanf(_src, "%s %255s HTTP/%c.%c%*[^\r]\r%n", req_type, _rtn->path,
+		(char*) &_rtn->http_vrs, &http_vrs_low, &nbytes);
+	
+	_src += nbytes;
+	
+	if (strcmp(req_type, "GET"))
+		return -1;
+	
+	/* a session can be resumed from the query string, as browsers
+	 * can't add headers to a handshake (the token's width is
+	 * WEBS_RESUME_TOKEN) */
+	for (query = strchr(_rtn->path, '?'); query; query = strchr(query, '&')) {
+		query++;
+		
+		if (!strncmp(query, "resume=", 7))
+			sscanf(query + 7, "%32[0-9a-f]", _rtn->resume);
+		
+		else if (!strncmp(query, "seen=", 5) && sscanf(query + 5, "%lu", &seen) == 1)
+			_rtn->resume_seen = seen;
+	}
+	
+	_rtn->http_vrs <<= 8;
+	_rtn->http_vrs += http_vrs_low;
+	
+	while (sscanf(_src, "%s%n", param_str, &nbytes) > 0) {
+		_src += nbytes;
+		
+		if (!strcmp(param_str, "Sec-WebSocket-Version:")) {
+			sscanf(_src, "%hu%*[^\r]\r%n", &_rtn->webs_vrs, &nbytes);
+			_src += nbytes;
+		}
+		
+		else
+		if (!strcmp(param_str, "Sec-WebSocket-Key:")) {
+			sscanf(_src, "%s%*[^\r]\r%n", _rtn->webs_key, &nbytes);
+			_src += nbytes;
+		}
+		
+		else
+		if (!strcmp(param_str, "If-None-Match:")) {
+			sscanf(_src, " %63[^\r]", _rtn->etag);
+			sscanf(_src, "%*[^\r]\r%n", &nbytes);
+			_src += nbytes;
+		}
+		
+		else
+		if (!strcmp(param_str, "Webs-Resume:")) {
+			if (sscanf(_src, " %32[0-9a-f] %lu", _rtn->resume, &seen) == 2)
+				_rtn->resume_seen = seen;
+			
+			sscanf(_src, "%*[^\r]\r%n", &nbytes);
+			_src += nbytes;
+		}
+		
+		else {
+			sscanf(_src, "%*[^\r]\r%n", &nbytes);
+			_src += nbytes;
+		}
+	}
+	
+	if (!(_rtn->webs_key[0] || _rtn->webs_vrs || _rtn->http_vrs))
+		return -1;
+	
+	return 0;
+}
+
+/* 
+ * generates an HTTP websocket handshake response. by the
+ * specification (RFC-6455), this is done by concatonating the
+ * client provided key with a magic string, and returning the
+ * base-64 encoded, SHA-1 hash of the result in the "Sec-WebSocket-
+ * Accept" field of an HTTP response header.
+ * @param _dst: a buffer that will hold the resulting HTTP
+ * response data.
+ * @param _key: a pointer to the websocket key provided by the
+ * client in it's HTTP websocket request header.
+ * @return the total number of resulting bytes copied.
+ */
+static int __webs_generate_handshake(char* _dst, char* _key) {
+	char buf[61]; 	/* size of result is 60 bytes */
+	char hash[21];	/* SHA-1 hash is 20 bytes */
+	int len = 0;
+	
+	len = __webs_strcat(buf, _key, "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+	__webs_sha1(buf, hash, len);
+	len = __webs_b64_encode(hash, buf, 20);
+	buf[len] = '\0';
+	
+	return sprintf(_dst, WEBS_RESPONSE_FMT, buf);
+}
+
+/* 
+ * turns the target of an HTTP request into a path within a server's
+ * directory, decoding it, and dropping its query and leading slashes.
+ * @param _dst: a buffer (of WEBS_MAX_PATH bytes) to hold the path.
+ * @param _src: the request's target.
+ * @return -1 if the path is too long or would leave the directory, -2
+ * if it is badly encoded, or 0 otherwise.
+ */
+static int __webs_http_resolve(char* _dst, char* _src) {
+	size_t n = 0;
+	unsigned int c;
+	char* seg;
+	
+	while (*_src == '/')
+		_src++;
+	
+	/* (room is left for a directory's "index.html") */
+	for (; *_src && *_src != '?'; n++) {
+		if (n == WEBS_MAX_PATH - 11)
+			return -1;
+		
+		/* an escape is exactly two hex digits (and never a NUL) */
+		if (*_src == '%') {
+			if (strspn(_src + 1, "0123456789abcdefABCDEF") < 2
+			|| sscanf(_src + 1, "%2x", &c) != 1 || c == 0)
+				return -2;
+			
+			_dst[n] = c;
+			_src += 3;
+		}
+		
+		else
+			_dst[n] = *_src++;
+	}
+	
+	_dst[n] = '\0';
+	
+	/* (an encoded leading slash would make the path absolute) */
+	if (_dst[0] == '/')
+		return -1;
+	
+	/* no segment may lead out of the directory */
+	for (seg = _dst; ; seg++) {
+		if (seg[0] == '.' && seg[1] == '.' && (seg[2] == '/' || seg[2] == '\0'))
+			return -1;
+		
+		if ((seg = strchr(seg, '/')) == NULL)
+			break;
+	}
+	
+	if (n == 0 || _dst[n - 1] == '/')
+		strcpy(_dst + n, "index.html");
+	
+	return 0;
+}
+
+/* 
+ * opens a file within a server's directory, without following any link
+ * out of it. the file is opened non-blocking, so that a FIFO can't hold
+ * the client's thread up before it is turned away.
+ * @param _root: the directory.
+ * @param _path: the file's path within it.
+ * @return the file's descriptor, or -1 on error.
+ */
+static int __webs_http_open(int _root, char* _path) {
+	int dir = _root;
+	int fd;
+	char* seg = _path;
+	char* end;
+	
+	#ifdef SYS_openat2
+	struct open_how how = {0};
+	
+	how.flags = O_RDONLY | O_NONBLOCK;
+	how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+	
+	fd = syscall(SYS_openat2, _root, _path, &how, sizeof(how));
+	
+	if (fd >= 0 || errno != ENOSYS)
+		return fd;
+	#endif
+	
+	/* without openat2(2), the path is walked a directory at a time,
+	 * following no links at all */
+	for (; (end = strchr(seg, '/')) != NULL; seg = end + 1) {
+		if (end == seg)
+			continue;
+		
+		*end = '\0';
+		fd = openat(dir, seg, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+		*end = '/';
+		
+		if (dir != _root)
+			close(dir);
+		
+		if (fd < 0)
+			return -1;
+		
+		dir = fd;
+	}
+	
+	fd = openat(dir, seg, O_RDONLY | O_NONBLOCK | O_NOFOLLOW);
+	
+	if (dir != _root)
+		close(dir);
+	
+	return fd;
+}
+
+/* 
+ * picks the content type of a file served over HTTP, from its name.
+ * @param _path: the file's path.
+ * @return the content type.
+ */
+static char* __webs_http_type(char* _path) {
+	static char* types[] = {
+		".html", "text/html; charset=utf-8",
+		".htm",  "text/html; charset=utf-8",
+		".js",   "text/javascript",
+		".mjs",  "text/javascript",
+		".css",  "text/css",
+		".json", "application/json",
+		".txt",  "text/plain; charset=utf-8",
+		".svg",  "image/svg+xml",
+		".png",  "image/png",
+		".jpg",  "image/jpeg",
+		".gif",  "image/gif",
+		".ico",  "image/x-icon",
+		".wasm", "application/wasm"
+	};
+	
+	char* ext = strrchr(_path, '.');
+	size_t i;
+	
+	if (ext)
+		for (i = 0; i < sizeof(types) / sizeof(char*); i += 2)
+			if (!strcmp(ext, types[i]))
+				return types[i + 1];
+	
+	return "application/octet-stream";
+}
+
+/* 
+ * writes the contents of a file to a client, with sendfile(2) unless
+ * the client's TLS is encrypted in userspace.
+ * @param _self: the client to be written to.
+ * @param _fd: the file to be written.
+ * @param _n: the size of the file.
+ * @return -1 on error, or 0 otherwise.
+ */
+static int __webs_http_send_file(webs_client* _self, int _fd, size_t _n) {
+	char buf[16384];
+	off_t pos = 0;
+	ssize_t n;
+	
+	while ((size_t) pos < _n) {
+		if (!_self->ssl || (_self->tls_flags & WEBS_KTLS_TX))
+			n = sendfile(_self->fd, _fd, &pos, _n - pos);
+		
+		else {
+			n = pread(_fd, buf, _n - pos < sizeof(buf) ? _n - pos : sizeof(buf), pos);
+			
+			if (n > 0 && (n = __webs_write(_self, buf, n)) > 0)
+				pos += n;
+		}
+		
+		if (n < 0 && (errno == EINTR
+		|| (errno == EAGAIN && __webs_wait_socket(_self, POLLOUT) == 0)))
+			continue;
+		
+		/* (including a file that shrank since it was measured) */
+		if (n <= 0)
+			return -1;
+	}
+	
+	return 0;
+}
+
+/* 
+ * answers a request that isn't a websocket handshake with the server's
+ * health response, a file from its directory, or a 404.
+ * @param _self: the client that sent the request.
+ * @param _info: the request.
+ * @param _buf: a buffer (of WEBS_MAX_PACKET bytes) for the response.
+ */
+static void __webs_http_respond(webs_client* _self, struct webs_info* _info,
+char* _buf) {
+	webs_server* srv = _self->srv;
+	struct webs_http_file* e;
+	char path[WEBS_MAX_PATH];
+	char etag[48];
+	struct msghdr msg = {0};
+	struct iovec iov;
+	struct stat st;
+	size_t len = strcspn(_info->path, "?");
+	unsigned long h = 5381;
+	int root = -1, fd = -1, bad = 0;
+	char* p;
+	
+	pthread_mutex_lock(&srv->lock);
+	
+	if (srv->health_path && strlen(srv->health_path) == len
+	&& !strncmp(srv->health_path, _info->path, len)) {
+		strcpy(_buf, srv->health_response);
+		pthread_mutex_unlock(&srv->lock);
+		
+		__webs_write(_self, _buf, strlen(_buf));
+		return;
+	}
+	
+	/* (a duplicate, in case the directory is changed meanwhile) */
+	if (srv->http_root >= 0)
+		root = dup(srv->http_root);
+	
+	pthread_mutex_unlock(&srv->lock);
+	
+	if (root >= 0 && (bad = __webs_http_resolve(path, _info->path)) == 0)
+		fd = __webs_http_open(root, path);
+	
+	if (root >= 0)
+		close(root);
+	
+	if (bad == -2) {
+		__webs_write(_self, WEBS_HTTP_BAD_REQUEST, strlen(WEBS_HTTP_BAD_REQUEST));
+		return;
+	}
+	
+	if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		__webs_write(_self, WEBS_HTTP_NOT_FOUND, strlen(WEBS_HTTP_NOT_FOUND));
+		
+		if (fd >= 0) close(fd);
+		return;
+	}
+	
+	/* (only a FIFO or device needed it non-blocking) */
+	fcntl(fd, F_SETFL, 0);
+	
+	for (p = path; *p; p++)
+		h = h * 33 + (unsigned char) *p;
+	
+	pthread_mutex_lock(&srv->lock);
+	
+	/* a file's header is only built again once the file changes */
+	e = &srv->http_cache[h % WEBS_HTTP_CACHE];
+	
+	if (strcmp(e->path, path) || e->dev != st.st_dev || e->ino != st.st_ino
+	|| e->mtime != st.st_mtime || e->size != st.st_size) {
+		strcpy(e->path, path);
+		e->dev = st.st_dev;
+		e->ino = st.st_ino;
+		e->mtime = st.st_mtime;
+		e->size = st.st_size;
+		
+		sprintf(e->etag, "\"%lx-%lx-%lx\"", (unsigned long) st.st_ino,
+			(unsigned long) st.st_size, (unsigned long) st.st_mtime);
+		
+		e->len = sprintf(e->header, WEBS_HTTP_FILE_FMT, __webs_http_type(path),
+			(unsigned long) st.st_size, e->etag);
+	}
+	
+	memcpy(_buf, e->header, e->len);
+	len = e->len;
+	strcpy(etag, e->etag);
+	
+	pthread_mutex_unlock(&srv->lock);
+	
+	/* the client already has this version of the file */
+	if (_info->etag[0] && (strstr(_info->etag, etag) || !strcmp(_info->etag, "*"))) {
+		__webs_write(_self, _buf, sprintf(_buf, WEBS_HTTP_UNCHANGED_FMT, etag));
+		close(fd);
+		return;
+	}
+	
+	/* the header goes out in the same segment as the file's start */
+	iov.iov_base = _buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	
+	if (__webs_sendmsg(_self, &msg, MSG_NOSIGNAL | MSG_MORE) == (ssize_t) len)
+		__webs_http_send_file(_self, fd, st.st_size);
+	
+	close(fd);
+	
+	return;
+}
+
+/* 
+ * checks whether a server has as many connections (or handshakes in
+ * progress) as it allows. the caller must hold the server's lock.
+ * @param _srv: the server to be checked.
+ * @return 1 if it does, or 0 otherwise.
+ */
+static int __webs_at_capacity(webs_server* _srv) {
+	return (_srv->max_clients && _srv->num_clients >= _srv->max_clients)
+	|| (_srv->max_handshakes && _srv->num_handshakes >= _srv->max_handshakes);
+}
+
+/* 
+ * wakes anything waiting for room on a server (after a client leaves,
+ * or finishes its handshake). the caller must hold the server's lock.
+ * @param _srv: the server.
+ */
+static void __webs_check_room(webs_server* _srv) {
+	struct epoll_event ev;
+	
+	pthread_cond_broadcast(&_srv->left);
+	
+	/* a runtime server's socket isn't watched while it is paused */
+	if (_srv->paused && !__webs_at_capacity(_srv)) {
+		_srv->paused = 0;
+		
+		ev.events = EPOLLIN | EPOLLONESHOT;
+		ev.data.ptr = &_srv->watch;
+		epoll_ctl(_srv->runtime->epfd, EPOLL_CTL_MOD, _srv->soc, &ev);
+	}
+	
+	return;
+}
+
+/* 
+ * frees a server once it has been closed, and its clients have left.
+ * @param _srv: the server to be freed.
+ */
+static void __webs_free_server(webs_server* _srv) {
+	struct webs_session* session;
+	void (*on_free)(void*);
+	void* user;
+	size_t i;
+	
+	#ifdef WEBS_TLS
+		if (_srv->tls)
+			SSL_CTX_free(_srv->tls);
+	#endif
+	
+	/* stop the park thread (every connection has left by now) */
+	if (_srv->runtime == NULL && _srv->epfd >= 0) {
+		pthread_cancel(_srv->park_thread);
+		pthread_join(_srv->park_thread, NULL);
+		close(_srv->epfd);
+	}
+	
+	if (_srv->http_root >= 0)
+		close(_srv->http_root);
+	
+	free(_srv->http_cache);
+	free(_srv->health_path);
+	free(_srv->health_response);
+	
+	if (_srv->capture)
+		fclose(_srv->capture);
+	
+	/* stop expiring sessions, then drop those still waiting (every
+	 * session is, by now) */
+	if (_srv->sessions) {
+		pthread_mutex_lock(&_srv->lock);
+		pthread_cond_signal(&_srv->resume_cond);
+		pthread_mutex_unlock(&_srv->lock);
+		pthread_join(_srv->resume_thread, NULL);
+		
+		for (i = 0; i < WEBS_RESUME_BUCKETS; i++) {
+			while ((session = _srv->sessions[i])) {
+				_srv->sessions[i] = session->next;
+				__webs_session_free(session);
+			}
+		}
+		
+		free(_srv->sessions);
+	}
+	
+	pthread_cond_destroy(&_srv->resume_cond);
+	pthread_mutex_destroy(&_srv->capture_lock);
+	free(_srv->cpus);
+	free(_srv->cpu_stats);
+	pthread_mutex_destroy(&_srv->lock);
+	pthread_cond_destroy(&_srv->left);
+	
+	on_free = _srv->on_free;
+	user = _srv->user;
+	free(_srv);
+	
+	if (on_free)
+		on_free(user);
+	
+	return;
+}
+
+/* 
+ * removes a client from a server's internal listing, closing its
+ * descriptor and adding its counters to the server's totals.
+ * @param _node: a pointer to the client in the server's listing.
+ */
+static void __webs_remove_client(struct webs_client_node* _node) {
+	struct webs_session* session;
+	struct webs_session* dropped = NULL;
+	struct webs_queue* queues[3];
+	struct webs_packet* pkt;
+	webs_server* srv;
+	int last, i;
+	
+	if (_node == NULL) return;
+	
+	srv = _node->client.srv;
+	
+	/* wait for broadcasts to finish queueing frames for the client,
+	 * and for the server's poller to give up any backlog (which it
+	 * does once it sees the connection shut down) */
+	pthread_mutex_lock(&_node->client.lock);
+	_node->client.state = WEBS_STATE_CLOSING;
+	
+	if (_node->client.writing)
+		shutdown(_node->client.fd, SHUT_RDWR);
+	
+	while (_node->client.writing || _node->client.refs)
+		pthread_cond_wait(&_node->client.written, &_node->client.lock);
+	
+	session = _node->client.session;
+	_node->client.session = NULL;
+	
+	/* frames that were never written are kept for the session too, in
+	 * the order they would have been written */
+	if (session) {
+		queues[0] = &_node->client.urgent;
+		queues[1] = &_node->client.out;
+		queues[2] = &_node->client.held;
+		
+		for (i = 0; i < 3; i++)
+			for (pkt = queues[i]->head; pkt; pkt = pkt->next)
+				if (!__webs_is_control(pkt))
+					__webs_session_record(session, pkt->data, pkt->len,
+						pkt->file == NULL);
+	}
+	
+	__webs_sample_segments(&_node->client);
+	
+	pthread_mutex_unlock(&_node->client.lock);
+	
+	pthread_mutex_lock(&srv->lock);
+	
+	if (_node->prev)
+		_node->prev->next = _node->next;
+	else
+		srv->head = _node->next;
+	
+	if (_node->next)
+		_node->next->prev = _node->prev;
+	else
+		srv->tail = _node->prev;
+	
+	__webs_add_stats(&srv->stats, &_node->client.stats);
+	
+	if (srv->cpu_stats && _node->client.cpu >= 0)
+		__webs_add_stats(&srv->cpu_stats[_node->client.cpu],
+			&_node->client.stats);
+	
+	srv->num_clients--;
+	last = srv->closing && srv->num_clients == 0 && !srv->listening;
+	__webs_check_room(srv);
+	
+	/* the client's session waits for it to come back */
+	if (session)
+		dropped = __webs_session_detach(srv, session, &_node->client);
+	
+	pthread_mutex_unlock(&srv->lock);
+	
+	if (dropped)
+		__webs_session_free(dropped);
+	
+	#ifdef WEBS_TLS
+		if (_node->client.ssl)
+			SSL_free(_node->client.ssl);
+	#endif
+	
+	free(_node->client.tls_buf);
+	
+	close(_node->client.fd);
+	__webs_clear_queue(&_node->client.out);
+	__webs_clear_queue(&_node->client.urgent);
+	__webs_clear_queue(&_node->client.held);
+	pthread_mutex_destroy(&_node->client.lock);
+	pthread_cond_destroy(&_node->client.drained);
+	pthread_cond_destroy(&_node->client.written);
+	free(_node);
+	
+	/* the last client to leave a closed server frees it */
+	if (last)
+		__webs_free_server(srv);
+	
+	return;
+}
+
+/* (defined below, alongside parking) */
+static int __webs_start_poller(webs_server* _srv);
+
+/* 
+ * adds a client to a server's internal listing. this is called from
+ * the client's own thread, so that its memory is allocated on the
+ * NUMA node that the thread runs on.
+ * @param _srv: the server that the client should be added to.
+ * @param _cli: the client to be added.
+ * @note the client is already counted in the server's `num_clients`.
+ * @return a pointer to the added client in the server's listing.
+ * (or NULL if NULL was provided)
+ */
+static webs_client* __webs_add_client(webs_server* _srv, webs_client _cli) {
+	struct webs_client_node* node;
+	
+	if (_srv == NULL) return NULL;
+	
+	node = malloc(sizeof(struct webs_client_node));
+	
+	if (node == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
+	
+	node->client = _cli;
+	node->next = NULL;
+	
+	/* the client's queue and counters start out empty */
+	memset(&node->client.out, 0, sizeof(struct webs_queue));
+	memset(&node->client.urgent, 0, sizeof(struct webs_queue));
+	memset(&node->client.held, 0, sizeof(struct webs_queue));
+	node->client.mid_message = 0;
+	node->client.writing = 0;
+	node->client.refs = 0;
+	node->client.stream_op = -1;
+	memset(&node->client.stats, 0, sizeof(struct webs_stats));
+	node->client.stats.conns = 1;
+	node->client.ssl = NULL;
+	node->client.tls_flags = 0;
+	node->client.tls_buf = NULL;
+	node->client.tls_len = 0;
+	node->client.jobs = node->client.jobs_tail = NULL;
+	node->client.num_jobs = 0;
+	node->client.scheduled = 0;
+	node->client.stalled = 0;
+	node->client.working = 0;
+	node->client.ejected = 0;
+	node->client.session = NULL;
+	node->client.resumed = 0;
+	node->client.resuming = 0;
+	node->client.resume_seq = 0;
+	node->client.user = NULL;
+	node->client.state = WEBS_STATE_HANDSHAKE;
+	node->client.parked = 0;
+	node->client.rbuf = NULL;
+	node->client.rbuf_off = 0;
+	node->client.watch.type = WEBS_WATCH_CLIENT;
+	node->client.watch.ptr = &node->client;
+	
+	/* buckets start full (the first refill tops them up) */
+	memset(&node->client.msg_bucket, 0, sizeof(struct webs_bucket));
+	memset(&node->client.byte_bucket, 0, sizeof(struct webs_bucket));
+	
+	pthread_cond_init(&node->client.drained, NULL);
+	pthread_cond_init(&node->client.written, NULL);
+	pthread_mutex_init(&node->client.lock, NULL);
+	
+	pthread_mutex_lock(&_srv->lock);
+	
+	/* if this is first client, set head = tail = new element */
+	if (_srv->tail == NULL) {
+		node->prev = NULL;
+		_srv->head = node;
+	}
+	
+	/* otherwise, just add after the current tail */
+	else {
+		node->prev = _srv->tail;
+		_srv->tail->next = node;
+	}
+	
+	_srv->tail = node;
+	
+	/* what a pool's workers can't write at once is left to the
+	 * server's poller */
+	if (_srv->pool)
+		__webs_start_poller(_srv);
+	
+	/* a client that arrives as the server closes is turned away */
+	if (_srv->closing)
+		webs_eject(&node->client);
+	
+	pthread_mutex_unlock(&_srv->lock);
+	
+	return &node->client;
+}
+
+/* 
+ * creates a socket bound to an address and port.
+ * @param _addr: a null-terminatng string containing the (IPv4 or
+ * IPv6) address that the socket should be bound to, or NULL to
+ * bind to every IPv4 address.
+ * @param _port: the port that the socket should be bound
+ * to as a 16-bit integer.
+ * @return the new socket, or -1 on error.
+ */
+static int __webs_bind_address(char* _addr, int16_t _port) {
+	const int ONE = 1;
+	struct addrinfo hints = {0};
+	struct addrinfo* res;
+	struct addrinfo* ai;
+	char port[8];
+	int soc = -1;
+	
+	hints.ai_family = _addr ? AF_UNSPEC : AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+	
+	sprintf(port, "%u", (uint16_t) _port);
+	
+	if (getaddrinfo(_addr, port, &hints, &res))
+		return -1;
+	
+	for (ai = res; ai; ai = ai->ai_next) {
+		soc = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (soc < 0) continue;
+		
+		/* allow reconnection to socket (for sanity) */
+		setsockopt(soc, SOL_SOCKET, SO_REUSEADDR, &ONE, sizeof(int));
+		
+		if (bind(soc, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		
+		close(soc);
+		soc = -1;
+	}
+	
+	freeaddrinfo(res);
+	
+	return soc;
+}
+
+/* 
+ * creates a socket bound to a unix socket path, replacing any
+ * stale socket file left at that path.
+ * @param _path: the path that the socket should be bound to.
+ * @return the new socket, or -1 on error.
+ */
+static int __webs_bind_path(char* _path) {
+	struct sockaddr_un addr = {0};
+	int soc;
+	
+	if (strlen(_path) >= sizeof(addr.sun_path))
+		return -1;
+	
+	soc = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (soc < 0) return -1;
+	
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, _path);
+	unlink(_path);
+	
+	if (bind(soc, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+		close(soc);
+		return -1;
+	}
+	
+	return soc;
+}
+
+/* 
+ * accepts a connection from a client and provides it with
+ * relevant data.
+ * @param _soc: the socket that the connection is being requested on.
+ * @param _cli: the client that is to be connected.
+ * @return -1 on error, or 0 otherwise.
+ */
+static int __webs_accept_connection(int _soc, webs_client* _c) {
+	/* static id counter variable */
+	static size_t client_id_counter = 0;
+	
+	socklen_t addr_size = sizeof(_c->addr);
+	
+	_c->fd = accept(_soc, (struct sockaddr*) &_c->addr, &addr_size);
+	if (_c->fd < 0) return -1;
+	
+	_c->id = client_id_counter;
+	client_id_counter++;
+	
+	return _c->fd;
+}
+
+#ifdef WEBS_TLS
+/* 
+ * performs the server side of a TLS handshake with a newly connected
+ * client, then checks which directions (if any) the kernel has taken
+ * over encryption for.
+ * @param _self: the client to perform the handshake with.
+ * @return -1 on error, or 0 otherwise.
+ */
+static int __webs_tls_accept(webs_client* _self) {
+	SSL* ssl = SSL_new(_self->srv->tls);
+	short events;
+	int n;
+	
+	if (ssl == NULL)
+		return -1;
+	
+	_self->ssl = ssl;
+	
+	/* the socket is made non-blocking, so that OpenSSL never waits on
+	 * the connection while the client's lock is held (unless the
+	 * holder means to, see __webs_wait_socket()) */
+	if (!SSL_set_fd(ssl, _self->fd)
+	|| fcntl(_self->fd, F_SETFL, O_NONBLOCK) < 0)
+		return -1;
+	
+	while ((n = SSL_accept(ssl)) <= 0)
+		if ((events = __webs_ssl_events(ssl, n)) == 0
+		|| __webs_wait_socket(_self, events) < 0)
+			return -1;
+	
+	if (BIO_get_ktls_send(SSL_get_wbio(ssl)))
+		_self->tls_flags |= WEBS_KTLS_TX;
+	
+	if (BIO_get_ktls_recv(SSL_get_rbio(ssl)))
+		_self->tls_flags |= WEBS_KTLS_RX;
+	
+	/* records written through OpenSSL are packed here */
+	if (!(_self->tls_flags & WEBS_KTLS_TX)
+	&& (_self->tls_buf = malloc(WEBS_TLS_RECORD)) == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
+	
+	return 0;
+}
+#endif
+
+/* 
+ * sends a close frame to a client that is open, after which any frames
+ * it sends (other than its reply) are ignored.
+ * @param _self: the client to be sent the frame.
+ * @param _code: the status code explaining why.
+ * @param _flags: 0 to wait for the frame (and anything queued ahead of
+ * it) to be written, or WEBS_QUEUE_NOWAIT.
+ */
+static void __webs_send_close(webs_client* _self, uint16_t _code, int _flags) {
+	uint16_t code = WEBS_BIG_ENDIAN_WORD(_code);
+	int error;
+	
+	pthread_mutex_lock(&_self->lock);
+	
+	if (_self->state == WEBS_STATE_OPEN) {
+		_self->state = WEBS_STATE_CLOSING;
+		
+		error = __webs_queue_frames(_self, __webs_make_packet((char*) &code, 2,
+			0x8), _flags, WEBS_PRIO_NORMAL);
+		
+		if (error >= 0 && !(_flags & WEBS_QUEUE_NOWAIT))
+			__webs_flush_queue(_self);
+	}
+	
+	pthread_mutex_unlock(&_self->lock);
+	
+	return;
+}
+
+/* 
+ * adds a sampled message's timings to its server's latency histogram.
+ * @param _srv: the server that recieved the message.
+ * @param _t: the times the message reached each stage.
+ */
+static void __webs_record_trace(webs_server* _srv, struct webs_trace* _t) {
+	struct webs_latency* lat = &_srv->latency;
+	size_t total = _t->done - _t->start;
+	size_t i = 0;
+	
+	while (i < WEBS_LATENCY_BUCKETS - 1 && total >> i)
+		i++;
+	
+	pthread_mutex_lock(&_srv->lock);
+	
+	lat->samples++;
+	lat->read_us += _t->read - _t->start;
+	lat->wait_us += _t->enter - _t->read;
+	lat->handler_us += _t->exit - _t->enter;
+	lat->write_us += _t->done - _t->exit;
+	lat->buckets[i]++;
+	
+	if (total > lat->max_us)
+		lat->max_us = total;
+	
+	pthread_mutex_unlock(&_srv->lock);
+	
+	return;
+}
+
+/* 
+ * refills a token bucket for the time since it was last refilled.
+ * @param _b: the bucket.
+ * @param _rate: tokens added per second.
+ * @param _burst: the most tokens the bucket holds.
+ * @param _now: the current time, in microseconds.
+ */
+static void __webs_refill(struct webs_bucket* _b, size_t _rate,
+size_t _burst, size_t _now) {
+	_b->tokens += (double) (_now - _b->last_us) * _rate / 1000000;
+	_b->last_us = _now;
+	
+	if (_b->tokens > _burst)
+		_b->tokens = _burst;
+	
+	return;
+}
+
+/* 
+ * works out how long a frame must wait for a bucket to hold enough
+ * tokens. a frame larger than the burst size only waits for a full
+ * bucket (and then leaves it in debt), so that it still gets through.
+ * @param _b: the bucket (already refilled).
+ * @param _rate: tokens added per second.
+ * @param _burst: the most tokens the bucket holds.
+ * @param _n: the tokens the frame costs.
+ * @return the time to wait, in microseconds (0 if none).
+ */
+static size_t __webs_bucket_wait(struct webs_bucket* _b, size_t _rate,
+size_t _burst, size_t _n) {
+	double need = _n < _burst ? _n : _burst;
+	
+	if (_b->tokens >= need)
+		return 0;
+	
+	return (size_t) ((need - _b->tokens) * 1000000 / _rate) + 1;
+}
+
+/* 
+ * enforces a server's per-client rate limits (see `struct webs_limits`)
+ * on a frame whose header has just been parsed, before its payload is
+ * read. if the client is over a limit, reading from it is paused until
+ * it isn't (so that TCP pushes back on it), or it is sent a close frame
+ * (status 1008), depending on the limits' `action`.
+ * @param _self: the client that sent the frame.
+ * @param _n: the length of the frame's payload.
+ * @return -1 if the client should be disconnected, or 0 otherwise.
+ */
+static int __webs_throttle(webs_client* _self, size_t _n) {
+	struct webs_limits* lim = &_self->srv->limits;
+	size_t msg_burst = lim->msg_burst ? lim->msg_burst : lim->msgs;
+	size_t byte_burst = lim->byte_burst ? lim->byte_burst : lim->bytes;
+	size_t now, wait, byte_wait;
+	struct timespec ts;
+	int throttled = 0;
+	
+	if (lim->msgs == 0 && lim->bytes == 0)
+		return 0;
+	
+	for (;;) {
+		now = __webs_now_us();
+		wait = byte_wait = 0;
+		
+		if (lim->msgs) {
+			__webs_refill(&_self->msg_bucket, lim->msgs, msg_burst, now);
+			wait = __webs_bucket_wait(&_self->msg_bucket, lim->msgs, msg_burst, 1);
+		}
+		
+		if (lim->bytes) {
+			__webs_refill(&_self->byte_bucket, lim->bytes, byte_burst, now);
+			byte_wait = __webs_bucket_wait(&_self->byte_bucket, lim->bytes,
+				byte_burst, _n);
+		}
+		
+		if (byte_wait > wait)
+			wait = byte_wait;
+		
+		if (wait == 0)
+			break;
+		
+		if (!throttled) {
+			throttled = 1;
+			
+			pthread_mutex_lock(&_self->lock);
+			_self->stats.throttled++;
+			pthread_mutex_unlock(&_self->lock);
+			
+			if (lim->action == WEBS_LIMIT_CLOSE) {
+				__webs_send_close(_self, WEBS_CLOSE_POLICY, 0);
+				return -1;
+			}
+		}
+		
+		ts.tv_sec = wait / 1000000;
+		ts.tv_nsec = (wait % 1000000) * 1000;
+		nanosleep(&ts, NULL);
+		
+		pthread_mutex_lock(&_self->lock);
+		_self->stats.throttle_us += __webs_now_us() - now;
+		pthread_mutex_unlock(&_self->lock);
+	}
+	
+	if (lim->msgs) _self->msg_bucket.tokens -= 1;
+	if (lim->bytes) _self->byte_bucket.tokens -= _n;
+	
+	return 0;
+}
+
+/* 
+ * puts a client at the back of its worker pool's run queue. the caller
+ * must hold the pool's lock.
+ * @param _pool: the pool.
+ * @param _cli: the client, which has jobs waiting.
+ */
+static void __webs_schedule(webs_pool* _pool, webs_client* _cli) {
+	_cli->next_ready = NULL;
+	
+	if (_pool->tail) _pool->tail->next_ready = _cli;
+	else _pool->head = _cli;
+	
+	_pool->tail = _cli;
+	pthread_cond_signal(&_pool->ready);
+	
+	return;
+}
+
+/* 
+ * main function for a worker thread, runs queued `on_data` calls (or
+ * `on_data_batch` calls, each with as many of a client's waiting
+ * messages as a batch holds). a client is only ever in the run queue
+ * once, so its jobs are run one at a time and in order.
+ * @param _pool: the pool that the worker belongs to.
+ */
+static void* __webs_worker_main(void* _pool) {
+	webs_pool* pool = (webs_pool*) _pool;
+	struct webs_msg msgs[WEBS_MAX_BATCH];
+	struct webs_job* jobs;
+	struct webs_job* job;
+	webs_client* cli;
+	size_t now, wait, total, most, count, i;
+	size_t entered = 0, exited = 0, done = 0;
+	int traced;
+	
+	pthread_mutex_lock(&pool->lock);
+	
+	for (;;) {
+		while (pool->head == NULL && !pool->stop)
+			pthread_cond_wait(&pool->ready, &pool->lock);
+		
+		if (pool->stop) break;
+		
+		/* take the next client's oldest job(s) */
+		cli = pool->head;
+		pool->head = cli->next_ready;
+		if (pool->head == NULL) pool->tail = NULL;
+		
+		jobs = job = cli->jobs;
+		now = __webs_now_us();
+		total = most = 0;
+		traced = 0;
+		
+		for (count = 1;; count++) {
+			wait = now - job->queued;
+			total += wait;
+			if (wait > most) most = wait;
+			if (job->trace.start) traced = 1;
+			
+			if (job->next == NULL || count == WEBS_MAX_BATCH
+			|| !cli->srv->events.on_data_batch)
+				break;
+			
+			job = job->next;
+		}
+		
+		cli->jobs = job->next;
+		if (cli->jobs == NULL) cli->jobs_tail = NULL;
+		job->next = NULL;
+		
+		pthread_mutex_unlock(&pool->lock);
+		
+		/* frames sent by the handler are queued as if they were sent
+		 * from the client's own thread, then written together */
+		pthread_mutex_lock(&cli->lock);
+		cli->worker = pthread_self();
+		cli->working = 1;
+		cli->stats.jobs += count;
+		cli->stats.job_wait_us += total;
+		if (most > cli->stats.job_wait_max_us)
+			cli->stats.job_wait_max_us = most;
+		pthread_mutex_unlock(&cli->lock);
+		
+		for (job = jobs, i = 0; job; job = job->next, i++) {
+			msgs[i].data = job->data;
+			msgs[i].len = job->len;
+		}
+		
+		/* (the jobs in a batch share their timings) */
+		if (traced) entered = __webs_now_us();
+		WEBS_PROBE2(handler_enter, cli->id, jobs->len);
+		
+		if (cli->srv->events.on_data_batch)
+			(*cli->srv->events.on_data_batch)(cli, msgs, count);
+		
+		else if (*cli->srv->events.on_data)
+			(*cli->srv->events.on_data)(cli, jobs->data, jobs->len);
+		
+		WEBS_PROBE1(handler_exit, cli->id);
+		if (traced) exited = __webs_now_us();
+		
+		/* the frames go out as far as the connection takes them at
+		 * once, and the rest is left to the server's poller */
+		pthread_mutex_lock(&cli->lock);
+		cli->working = 0;
+		
+		if (__webs_write_queue(cli, MSG_DONTWAIT) > 0)
+			__webs_leave_queue(cli);
+		
+		pthread_mutex_unlock(&cli->lock);
+		
+		if (traced) done = __webs_now_us();
+		
+		while ((job = jobs)) {
+			jobs = job->next;
+			
+			if (job->trace.start) {
+				job->trace.enter = entered;
+				job->trace.exit = exited;
+				job->trace.done = done;
+				__webs_record_trace(cli->srv, &job->trace);
+			}
+			
+			free(job->data);
+			free(job);
+		}
+		
+		pthread_mutex_lock(&cli->lock);
+		pthread_mutex_lock(&pool->lock);
+		
+		cli->num_jobs -= count;
+		pthread_cond_signal(&cli->drained);
+		
+		/* go to the back of the line if there is more to do, unless
+		 * the client is too far behind, in which case the poller puts
+		 * it back once its backlog drains (see __webs_unstall()) */
+		if (cli->jobs && cli->writing && __webs_is_behind(cli))
+			cli->stalled = 1;
+		
+		else if (cli->jobs)
+			__webs_schedule(pool, cli);
+		
+		else cli->scheduled = 0;
+		
+		/* (the client may leave as soon as this is released) */
+		pthread_mutex_unlock(&cli->lock);
+	}
+	
+	pthread_mutex_unlock(&pool->lock);
+	
+	return NULL;
+}
+
+/* 
+ * hands a message to a client's worker pool, first waiting for room
+ * if too many of the client's messages are already waiting (which
+ * leaves further data in the socket, so TCP pushes back on the client).
+ * @param _self: the client that sent the message.
+ * @param _data: the message (the pool takes ownership).
+ * @param _n: the length of the message.
+ * @param _trace: the message's timings so far (if it is sampled).
+ */
+static void __webs_dispatch(webs_client* _self, char* _data, ssize_t _n,
+struct webs_trace* _trace) {
+	webs_pool* pool = _self->srv->pool;
+	struct webs_job* job = malloc(sizeof(struct webs_job));
+	
+	if (job == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
+	
+	job->next = NULL;
+	job->data = _data;
+	job->len = _n;
+	job->trace = *_trace;
+	
+	pthread_mutex_lock(&pool->lock);
+	
+	while (_self->num_jobs >= pool->max_jobs)
+		pthread_cond_wait(&_self->drained, &pool->lock);
+	
+	job->queued = __webs_now_us();
+	
+	if (_self->jobs_tail) _self->jobs_tail->next = job;
+	else _self->jobs = job;
+	
+	_self->jobs_tail = job;
+	_self->num_jobs++;
+	
+	if (!_self->scheduled) {
+		_self->scheduled = 1;
+		__webs_schedule(pool, _self);
+	}
+	
+	pthread_mutex_unlock(&pool->lock);
+	
+	return;
+}
+
+/* 
+ * waits for every job a client has in its worker pool to complete.
+ * @param _self: the client to be waited on.
+ */
+static void __webs_drain_jobs(webs_client* _self) {
+	webs_pool* pool = _self->srv->pool;
+	
+	if (pool == NULL) return;
+	
+	pthread_mutex_lock(&pool->lock);
+	
+	while (_self->num_jobs)
+		pthread_cond_wait(&_self->drained, &pool->lock);
+	
+	pthread_mutex_unlock(&pool->lock);
+	
+	return;
+}
+
+/* 
+ * initialises the pools of spare buffers (once).
+ */
+static void __webs_init_spares(void) {
+	int i;
+	
+	for (i = 0; i < WEBS_MAX_NODES; i++)
+		pthread_mutex_init(&__webs_spares[i].lock, NULL);
+	
+	return;
+}
+
+/* 
+ * finds the pool of spare buffers for the NUMA node that the calling
+ * thread runs on, so that a buffer is only reused on the node it was
+ * put back from (a client's thread stays on its node when the server's
+ * threads are pinned, see webs_set_cpus()).
+ * @return the pool.
+ */
+static struct webs_spares* __webs_local_spares(void) {
+	unsigned node = 0;
+	
+	pthread_once(&__webs_spare_once, __webs_init_spares);
+	
+	if (syscall(SYS_getcpu, NULL, &node, NULL) < 0)
+		node = 0;
+	
+	return &__webs_spares[node % WEBS_MAX_NODES];
+}
+
+/* 
+ * borrows a buffer from the local node's spares (or allocates one).
+ * @return a pointer to the buffer.
+ */
+static struct webs_buffer* __webs_get_buffer(void) {
+	struct webs_spares* spares = __webs_local_spares();
+	struct webs_buffer* buf;
+	
+	pthread_mutex_lock(&spares->lock);
+	
+	if ((buf = spares->head)) {
+		spares->head = buf->next;
+		spares->count--;
+	}
+	
+	pthread_mutex_unlock(&spares->lock);
+	
+	if (buf == NULL)
+		buf = malloc(sizeof(struct webs_buffer));
+	
+	if (buf == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
+	
+	buf->len = 0;
+	
+	return buf;
+}
+
+/* 
+ * returns a borrowed buffer to the local node's spares (or frees it,
+ * if there are already WEBS_MAX_SPARE_BUFFERS spares).
+ * @param _buf: the buffer to be returned.
+ */
+static void __webs_put_buffer(struct webs_buffer* _buf) {
+	struct webs_spares* spares = __webs_local_spares();
+	
+	pthread_mutex_lock(&spares->lock);
+	
+	if (spares->count < WEBS_MAX_SPARE_BUFFERS) {
+		_buf->next = spares->head;
+		spares->head = _buf;
+		spares->count++;
+		_buf = NULL;
+	}
+	
+	pthread_mutex_unlock(&spares->lock);
+	
+	free(_buf);
+	
+	return;
+}
+
+/* 
+ * waits up to the server's `park_ms` for a client to send something.
+ * @param _self: the client to be waited on.
+ * @return 1 if nothing arrived, or 0 otherwise.
+ */
+static int __webs_is_idle(webs_client* _self) {
+	struct pollfd pfd;
+	
+	if (_self->rbuf && _self->rbuf_off < (size_t) _self->rbuf->len)
+		return 0;
+	
+	#ifdef WEBS_TLS
+		/* data already decrypted by OpenSSL won't wake poll(2) */
+		if (_self->ssl && SSL_pending(_self->ssl))
+			return 0;
+	#endif
+	
+	pfd.fd = _self->fd;
+	pfd.events = POLLIN;
+	
+	return poll(&pfd, 1, _self->srv->park_ms) == 0;
+}
+
+/* (defined below, alongside the server's main function) */
+static void* __webs_park_main(void* _srv);
+
+/* 
+ * starts a server's park thread, the first time it is needed (a
+ * runtime's thread is always running). the caller must hold the
+ * server's lock.
+ * @param _srv: the server.
+ * @return -1 if the thread could not be started, or 0 otherwise.
+ */
+static int __webs_start_poller(webs_server* _srv) {
+	if (_srv->epfd < 0) {
+		_srv->epfd = epoll_create1(EPOLL_CLOEXEC);
+		
+		if (_srv->epfd >= 0
+		&& pthread_create(&_srv->park_thread, 0, __webs_park_main, _srv) != 0) {
+			close(_srv->epfd);
+			_srv->epfd = -1;
+		}
+	}
+	
+	return _srv->epfd < 0 ? -1 : 0;
+}
+
+/* 
+ * parks an idle client's connection, so that its thread can exit.
+ * the connection is watched by the server's park thread (or its
+ * runtime's thread), which starts
+ * a new thread for it once it has something to read (or is ejected).
+ * @param _self: the client to be parked.
+ * @return -1 if the connection could not be parked (and the caller
+ * should carry on reading from it), or 0 if the caller must now exit
+ * without touching the client.
+ */
+static int __webs_park(webs_client* _self) {
+	webs_server* srv = _self->srv;
+	size_t busy = 0;
+	int error;
+	
+	/* a handler still running on a worker would expect its frames
+	 * to be flushed by this thread */
+	if (srv->pool) {
+		pthread_mutex_lock(&srv->pool->lock);
+		busy = _self->num_jobs;
+		pthread_mutex_unlock(&srv->pool->lock);
+	}
+	
+	if (busy) return -1;
+	
+	pthread_mutex_lock(&srv->lock);
+	error = __webs_start_poller(srv);
+	pthread_mutex_unlock(&srv->lock);
+	
+	if (error < 0) return -1;
+	
+	/* frames sent while the client is parked are written straight
+	 * away by whoever sends them (the watch is armed under the lock,
+	 * as it may also be watching for a backlog to drain) */
+	pthread_mutex_lock(&_self->lock);
+	_self->parked = 1;
+	_self->stats.parks++;
+	
+	if ((error = __webs_watch(_self)) < 0) {
+		_self->parked = 0;
+		_self->stats.parks--;
+	}
+	
+	pthread_mutex_unlock(&_self->lock);
+	
+	return error;
+}
+
+/* 
+ * records a message from a client (or its connecting or leaving) in
+ * its server's capture file, if the server has one.
+ * @param _self: the client.
+ * @param _op: the message's opcode (or WEBS_CAPTURE_OPEN/CLOSE).
+ * @param _data: the message's payload (or NULL if it isn't held).
+ * @param _n: the message's length.
+ */
+static void __webs_capture(webs_client* _self, uint8_t _op, char* _data,
+size_t _n) {
+	webs_server* srv = _self->srv;
+	struct webs_capture_record rec = {0};
+	
+	if (srv->capture == NULL)
+		return;
+	
+	rec.conn = _self->id;
+	rec.len = _n;
+	rec.op = _op;
+	
+	pthread_mutex_lock(&srv->capture_lock);
+	
+	/* (checked again, in case the capture has just been stopped) */
+	if (srv->capture) {
+		rec.time_us = __webs_now_us() - srv->capture_start;
+		rec.payload = srv->capture_payloads && _data;
+		
+		fwrite(&rec, sizeof(rec), 1, srv->capture);
+		
+		if (rec.payload)
+			fwrite(_data, 1, _n, srv->capture);
+	}
+	
+	pthread_mutex_unlock(&srv->capture_lock);
+	
+	return;
+}
+
+/* 
+ * reads from a client into its receive buffer, and hands every whole
+ * message that arrived to the server's `on_data_batch` handler in a
+ * single call, unmasked in place. a frame that can't be batched (a
+ * control frame, a fragment, or a message too big for the buffer) is
+ * left in the buffer for the client's frame loop to read.
+ * @param _self: the client to be read from.
+ * @return -1 if the read failed, -2 if a rate limit closed the
+ * connection, 0 if the next frame has to be read by the frame loop, or
+ * the number of messages handed over otherwise.
+ */
+static int __webs_read_batch(webs_client* _self) {
+	struct webs_msg msgs[WEBS_MAX_BATCH];
+	struct webs_buffer* buf;
+	size_t off, need, len, i, bytes = 0;
+	int count = 0, stop = 0, limited = 0;
+	uint8_t* hdr;
+	uint32_t key;
+	ssize_t n;
+	char next;
+	
+	if (_self->rbuf == NULL) {
+		_self->rbuf = __webs_get_buffer();
+		_self->rbuf_off = 0;
+	}
+	
+	buf = _self->rbuf;
+	
+	for (;;) {
+		off = _self->rbuf_off;
+		
+		while (count < WEBS_MAX_BATCH && buf->len - off >= 2) {
+			hdr = (uint8_t*) buf->data + off;
+			
+			/* only whole (and masked) text and binary frames are batched */
+			if (!(hdr[0] & 0x80) || (hdr[0] & 0x70) || !(hdr[1] & 0x80)
+			|| ((hdr[0] & 0x0F) != 0x1 && (hdr[0] & 0x0F) != 0x2)) {
+				stop = 1;
+				break;
+			}
+			
+			len = hdr[1] & 0x7F;
+			need = len == 126 ? 8 : len == 127 ? 14 : 6;
+			
+			if (buf->len - off < need)
+				break;
+			
+			if (len == 126)
+				len = (size_t) hdr[2] << 8 | hdr[3];
+			
+			else if (len == 127)
+				for (len = 0, i = 2; i < 10; i++)
+					len = len << 8 | hdr[i];
+			
+			/* (leaving room for the NUL after the message) */
+			if (len >= WEBS_MAX_PACKET - need) {
+				stop = 1;
+				break;
+			}
+			
+			if (buf->len - off < need + len)
+				break;
+			
+			if (__webs_throttle(_self, len) < 0) {
+				limited = 1;
+				break;
+			}
+			
+			memcpy(&key, hdr + need - 4, 4);
+			__webs_decode_data((char*) hdr + need, key, len);
+			__webs_capture(_self, hdr[0] & 0x0F, (char*) hdr + need, len);
+			
+			msgs[count].data = (char*) hdr + need;
+			msgs[count].len = len;
+			count++;
+			
+			off += need + len;
+		}
+		
+		if (count || stop || limited)
+			break;
+		
+		/* nothing whole is waiting, so an incomplete frame is moved to
+		 * the front of the buffer, and more is read after it */
+		if (off) {
+			memmove(buf->data, buf->data + off, buf->len - off);
+			buf->len -= off;
+			_self->rbuf_off = 0;
+		}
+		
+		n = __webs_read_socket(_self, buf->data + buf->len,
+			WEBS_MAX_PACKET - 1 - buf->len);
+		
+		if (n <= 0)
+			return -1;
+		
+		buf->len += n;
+	}
+	
+	/* each message is followed by a NUL, written over the first byte
+	 * of the (already parsed) frame after it, or of whatever follows
+	 * the batch (which is put back afterwards) */
+	next = buf->data[off];
+	
+	for (i = 0; i < (size_t) count; i++) {
+		msgs[i].data[msgs[i].len] = '\0';
+		bytes += msgs[i].len;
+		WEBS_PROBE2(message, _self->id, msgs[i].len);
+	}
+	
+	pthread_mutex_lock(&_self->lock);
+	_self->stats.msgs_in += count;
+	_self->stats.bytes_in += bytes;
+	pthread_mutex_unlock(&_self->lock);
+	
+	_self->rbuf_off = off;
+	
+	if (count)
+		(*_self->srv->events.on_data_batch)(_self, msgs, count);
+	
+	buf->data[off] = next;
+	
+	return limited ? -2 : count;
+}
+
+/* 
+ * a client's frame loop, run after its handshake until it leaves (or
+ * until its connection is parked).
+ * @param _self: the client whose frames are to be read.
+ */
+static void __webs_client_loop(webs_client* self) {
+	ssize_t total = 0;
+	ssize_t error;
+	
+	/* flag set if frame is a continuation one */
+	int cont = 0;
+	
+	/* opcode of the message being read */
+	uint8_t op = 0;
+	
+	/* temporary variables */
+	struct webs_frame frm;
+	struct webs_trace trace = {0};
+	struct webs_msg msg;
+	char* data = 0;
+	int batched, flushed;
+	
+	/* main loop */
+	for (;;) {
+		/* write anything queued during the last iteration before
+		 * waiting on the next frame (unless the server's poller is
+		 * already writing out a backlog, which takes it along) */
+		pthread_mutex_lock(&self->lock);
+		flushed = self->writing ? 0 : __webs_flush_queue(self);
+		pthread_mutex_unlock(&self->lock);
+		
+		if (flushed < 0) {
+			error = WEBS_ERR_READ_FAILED;
+			break;
+		}
+		
+		/* a sampled message is done once the frames sent by its
+		 * handler have been written */
+		if (trace.exit) {
+			trace.done = __webs_now_us();
+			__webs_record_trace(self->srv, &trace);
+			memset(&trace, 0, sizeof(trace));
+		}
+		
+		/* give the thread up while the connection is idle (outside
+		 * of a fragmented message), see `webs_server.park_ms` */
+		if (self->srv->park_ms && !cont && __webs_is_idle(self)) {
+			free(data);
+			data = 0;
+			
+			/* nor does it need a receive buffer */
+			if (self->rbuf) {
+				__webs_put_buffer(self->rbuf);
+				self->rbuf = NULL;
+			}
+			
+			if (__webs_park(self) == 0)
+				return;
+		}
+		
+		/* with `on_data_batch` (and no pool), the messages that arrive
+		 * together are handed over together */
+		if (self->srv->events.on_data_batch && !self->srv->pool && !cont) {
+			batched = __webs_read_batch(self);
+			
+			if (batched < 0) {
+				error = batched == -2 ? WEBS_ERR_RATE_LIMITED : WEBS_ERR_READ_FAILED;
+				break;
+			}
+			
+			if (batched > 0)
+				continue;
+		}
+		
+		if (__webs_parse_frame(self, &frm) < 0) {
+			error = WEBS_ERR_READ_FAILED;
+			break;
+		}
+		
+		if (__webs_throttle(self, frm.length) < 0) {
+			error = WEBS_ERR_RATE_LIMITED;
+			break;
+		}
+		
+		WEBS_PROBE3(frame, self->id, WEBSFR_GET_OPCODE(frm.info), frm.length);
+		
+		/* time every `sample_every`th message, from its first header */
+		if (self->srv->sample_every && !trace.start
+		&& (WEBSFR_GET_OPCODE(frm.info) == 0x1 || WEBSFR_GET_OPCODE(frm.info) == 0x2)
+		&& (self->stats.msgs_in + 1) % self->srv->sample_every == 0)
+			trace.start = __webs_now_us();
+		
+		/* only accept supported frames */
+		if (WEBSFR_GET_OPCODE(frm.info) != 0x0
+		 && WEBSFR_GET_OPCODE(frm.info) != 0x1
+		 && WEBSFR_GET_OPCODE(frm.info) != 0x2
+		 && WEBSFR_GET_OPCODE(frm.info) != 0x8
+		 && WEBSFR_GET_OPCODE(frm.info) != 0x9
+		 && WEBSFR_GET_OPCODE(frm.info) != 0xA) {
+			if (*self->srv->events.on_error)
+				(*self->srv->events.on_error)(self, WEBS_ERR_NO_SUPPORT);
+			
+			__webs_discard(self, frm.length);
+			continue;
+		}
+		
+		/* check if packet is too big */
+		if ((size_t) frm.length > SSIZE_MAX) {
+			if (*self->srv->events.on_error)
+				(*self->srv->events.on_error)(self, WEBS_ERR_OVERFLOW);
+			
+			__webs_discard(self, frm.length);
+			continue;
+		}
+		
+		/* respond to ping */
+		if (WEBSFR_GET_OPCODE(frm.info) == 0x9) {
+			__webs_discard(self, frm.length);
+			__webs_capture(self, 0x9, NULL, frm.length);
+			
+			if (*self->srv->events.on_ping)
+				(*self->srv->events.on_ping)(self);
+			
+			else
+				webs_pong(self);
+			
+			continue;
+		}
+		
+		/* handle pong */
+		if (WEBSFR_GET_OPCODE(frm.info) == 0xA) {
+			__webs_discard(self, frm.length);
+			__webs_capture(self, 0xA, NULL, frm.length);
+			
+			if (*self->srv->events.on_pong)
+				(*self->srv->events.on_pong)(self);
+			
+			continue;
+		}
+		
+		/* deal with normal frames (non-fragmented) */
+		if (WEBSFR_GET_OPCODE(frm.info) != 0x0) {
+			/* read data */
+			if (data) free(data);
+			data = malloc(frm.length + 1);
+			
+			if (data == NULL)
+				WEBS_XERR("Failed to allocate memory!", ENOMEM);
+			
+			if (__webs_asserted_read(self, data, frm.length) < 0) {
+				error = WEBS_ERR_READ_FAILED;
+				break;
+			}
+			
+			total = frm.length;
+			op = WEBSFR_GET_OPCODE(frm.info);
+			__webs_decode_data(data, frm.key, frm.length);
+			
+			if (!WEBSFR_GET_FINISH(frm.info)) {
+				cont = 1;
+				continue;
+			}
+		}
+		
+		/* otherwise deal with fragmentation */
+		else if (cont == 1) {
+			data = realloc(data, total + frm.length + 1);
+			
+			if (data == NULL)
+				WEBS_XERR("Failed to allocate memory!", ENOMEM);
+			
+			if (__webs_asserted_read(self, data + total,
+			frm.length) < 0) {
+				error = WEBS_ERR_READ_FAILED;
+				break;
+			}
+			
+			__webs_decode_data(data + total, frm.key, frm.length);
+			
+			total += frm.length;
+			
+			if (!WEBSFR_GET_FINISH(frm.info))
+				continue;
+			
+			cont = 0;
+		}
+		
+		/* or if we aren't expecting a continuation frame,
+		 * set error and skip the frame */
+		else {
+			if (*self->srv->events.on_error)
+				(*self->srv->events.on_error)(self,
+					WEBS_ERR_UNEXPECTED_CONTINUTATION);
+			
+			__webs_discard(self, frm.length);
+			continue;
+		}
+		
+		/* respond to close (unless this is the reply to a close
+		 * frame that we sent) */
+		if (WEBSFR_GET_OPCODE(frm.info) == 0x8) {
+			if (self->state != WEBS_STATE_CLOSING) {
+				__webs_enqueue(self, __webs_make_packet(data, frm.length, 0x8));
+				webs_flush(self);
+			}
+			
+			error = 0;
+			break;
+		}
+		
+		/* call clinet on_data function */
+		data[total] = '\0';
+		
+		pthread_mutex_lock(&self->lock);
+		self->stats.msgs_in++;
+		self->stats.bytes_in += total;
+		pthread_mutex_unlock(&self->lock);
+		
+		__webs_capture(self, op, data, total);
+		
+		WEBS_PROBE2(message, self->id, total);
+		if (trace.start) trace.read = __webs_now_us();
+		
+		/* hand the message to a worker if the server has a pool
+		 * (which then owns it) */
+		if (self->srv->pool) {
+			__webs_dispatch(self, data, total, &trace);
+			memset(&trace, 0, sizeof(trace));
+			data = 0;
+			continue;
+		}
+		
+		if (data) {
+			if (trace.start) trace.enter = __webs_now_us();
+			WEBS_PROBE2(handler_enter, self->id, total);
+			
+			if (self->srv->events.on_data_batch) {
+				msg.data = data;
+				msg.len = total;
+				(*self->srv->events.on_data_batch)(self, &msg, 1);
+			}
+			
+			else if (*self->srv->events.on_data)
+				(*self->srv->events.on_data)(self, data, total);
+			
+			WEBS_PROBE1(handler_exit, self->id);
+			if (trace.start) trace.exit = __webs_now_us();
+		}
+		
+		free(data);
+		
+		data = 0;
+		continue;
+	}
+	
+	/* whatever was being read when the loop ended (e.g. a close
+	 * frame, or part of a fragmented message) */
+	free(data);
+	
+	if (self->rbuf)
+		__webs_put_buffer(self->rbuf);
+	
+	/* let any handlers still running for this client finish */
+	__webs_drain_jobs(self);
+	
+	/* a client that was ejected is expected to fail its last read */
+	if (self->ejected)
+		error = 0;
+	
+	/* call client on_error if there was an error */
+	if (error > 0) {
+		if (*self->srv->events.on_error)
+			(*self->srv->events.on_error)(self, error);
+	}
+	
+	if (*self->srv->events.on_close)
+		(*self->srv->events.on_close)(self);
+	
+	__webs_capture(self, WEBS_CAPTURE_CLOSE, NULL, 0);
+	__webs_remove_client((struct webs_client_node*) self);
+	
+	return;
+}
+
+/* 
+ * marks the end of a client's handshake (successful or not), making
+ * room for another, and lets the client's thread compete with those
+ * of established connections again.
+ * @param _self: the client whose handshake has ended.
+ */
+static void __webs_end_handshake(webs_client* _self) {
+	struct sched_param param = {0};
+	
+	pthread_mutex_lock(&_self->srv->lock);
+	_self->srv->num_handshakes--;
+	__webs_check_room(_self->srv);
+	pthread_mutex_unlock(&_self->srv->lock);
+	
+	if (_self->srv->max_handshakes)
+		pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+	
+	return;
+}
+
+/* 
+ * main client function, called on a thread for each
+ * connected client.
+ * @param _self: the client who is calling.
+ */
+static void* __webs_client_main(void* _self) {
+	webs_client* self;
+	
+	/* recv/send buffer for the handshake, borrowed from a pool of
+	 * spares (rather than held on the stack) */
+	struct webs_buffer* soc_buffer = __webs_get_buffer();
+	
+	/* temporary variables */
+	struct webs_info ws_info;
+	struct webs_packet* missed = NULL;
+	struct sched_param param = {0};
+	const int ONE = 1;
+	int busy_poll;
+	
+	/* the accept loop passes a temporary copy of the client, which
+	 * is replaced by one allocated from this thread */
+	self = __webs_add_client(((webs_client*) _self)->srv, *(webs_client*) _self);
+	free(_self);
+	
+	/* frames sent from this thread are queued until the end of
+	 * the current loop iteration */
+	self->thread = pthread_self();
+	
+	/* let the kernel busy poll the device queue for the client's
+	 * packets too, where it allows (see `busy_poll_us`) */
+	if (self->srv->busy_poll_us) {
+		busy_poll = self->srv->busy_poll_us;
+		setsockopt(self->fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(int));
+		
+		#ifdef SO_PREFER_BUSY_POLL
+			setsockopt(self->fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &ONE, sizeof(int));
+		#endif
+	}
+	
+	/* under admission control, handshakes run at a lower priority
+	 * than established connections */
+	if (self->srv->max_handshakes)
+		pthread_setschedparam(pthread_self(), SCHED_BATCH, &param);
+	
+	#ifdef WEBS_TLS
+		/* complete the TLS handshake first, if required */
+		if (self->srv->tls && __webs_tls_accept(self) < 0)
+			goto ABORT;
+	#endif
+	
+	/* wait for HTTP websocket request header */
+	soc_buffer->len = __webs_read(self, soc_buffer->data, WEBS_MAX_PACKET - 1);
+	
+	/* if we did not recieve one, abort */
+	if (soc_buffer->len < 0)
+		goto ABORT;
+	
+	/* process handshake */
+	soc_buffer->data[soc_buffer->len] = '\0';
+	
+	/* if we failed, abort */
+	if (__webs_process_handshake(soc_buffer->data, &ws_info) < 0)
+		goto ABORT;
+	
+	/* requests that aren't handshakes are answered over HTTP */
+	if (ws_info.webs_key[0] == '\0') {
+		__webs_http_respond(self, &ws_info, soc_buffer->data);
+		goto ABORT;
+	}
+	
+	/* give the client a session, resuming the one it asked for if
+	 * that's possible (see webs_enable_resume()) */
+	if (self->srv->sessions && __webs_session_attach(self, &ws_info, &missed) > 0)
+		self->resumed = 1;
+	
+	/* if we succeeded, generate + tansmit response */
+	soc_buffer->len = __webs_generate_handshake(soc_buffer->data,
+		ws_info.webs_key);
+	
+	/* (the session's token is added to the end of the response) */
+	pthread_mutex_lock(&self->lock);
+	
+	if (self->session)
+		soc_buffer->len += sprintf(soc_buffer->data + soc_buffer->len - 2,
+			WEBS_RESUME_FMT, self->session->token) - 2;
+	
+	pthread_mutex_unlock(&self->lock);
+	
+	__webs_write(self, soc_buffer->data, soc_buffer->len);
+	__webs_put_buffer(soc_buffer);
+	__webs_end_handshake(self);
+	
+	/* the messages that a resumed session missed (and any published
+	 * to it meanwhile) are sent before it opens, so that they aren't
+	 * recorded in it again */
+	do {
+		if (missed) {
+			__webs_enqueue_frames(self, missed, 0, WEBS_PRIO_NORMAL);
+			
+			if (webs_flush(self) < 0)
+				webs_eject(self);
+		}
+	} while ((missed = __webs_session_open(self)));
+	__webs_capture(self, WEBS_CAPTURE_OPEN, NULL, 0);
+	
+	WEBS_PROBE1(handshake, self->id);
+	
+	/* call client on_open function */
+	if (*self->srv->events.on_open)
+		(*self->srv->events.on_open)(self);
+	
+	__webs_client_loop(self);
+	
+	return NULL;
+	
+	ABORT:
+	
+	__webs_put_buffer(soc_buffer);
+	__webs_end_handshake(self);
+	__webs_remove_client((struct webs_client_node*) self);
+	
+	return NULL;
+}
+
+/* 
+ * main function for a thread that picks up a parked connection once
+ * it has data to be read.
+ * @param _self: the client whose connection was parked.
+ */
+static void* __webs_client_resume(void* _self) {
+	webs_client* self = _self;
+	
+	pthread_mutex_lock(&self->lock);
+	self->thread = pthread_self();
+	self->parked = 0;
+	pthread_mutex_unlock(&self->lock);
+	
+	__webs_client_loop(self);
+	
+	return NULL;
+}
+
+/* 
+ * picks the CPU that a new client's thread should run on, and sets
+ * it in the thread's attributes. a client is kept on the CPU that
+ * recieved its packets (as reported by SO_INCOMING_CPU) if that is
+ * one of the server's CPUs, and is otherwise given the next CPU in
+ * turn.
+ * @param _srv: the server that accepted the client.
+ * @param _cli: the client (its `cpu` is set).
+ * @param _attr: the attributes the client's thread is created with.
+ */
+static void __webs_place_client(webs_server* _srv, webs_client* _cli,
+pthread_attr_t* _attr) {
+	socklen_t len = sizeof(int);
+	cpu_set_t set;
+	size_t i;
+	
+	if (getsockopt(_cli->fd, SOL_SOCKET, SO_INCOMING_CPU, &_cli->cpu, &len) < 0
+	|| _cli->cpu < 0 || (size_t) _cli->cpu >= _srv->max_cpus)
+		_cli->cpu = -1;
+	
+	pthread_mutex_lock(&_srv->lock);
+	
+	if (_srv->num_cpus == 0) {
+		pthread_mutex_unlock(&_srv->lock);
+		return;
+	}
+	
+	for (i = 0; i < _srv->num_cpus; i++)
+		if (_srv->cpus[i] == _cli->cpu)
+			break;
+	
+	if (i == _srv->num_cpus) {
+		_cli->cpu = _srv->cpus[_srv->next_cpu];
+		_srv->next_cpu = (_srv->next_cpu + 1) % _srv->num_cpus;
+	}
+	
+	pthread_mutex_unlock(&_srv->lock);
+	
+	CPU_ZERO(&set);
+	CPU_SET(_cli->cpu, &set);
+	pthread_attr_setaffinity_np(_attr, sizeof(cpu_set_t), &set);
+	
+	return;
+}
+
+/* 
+ * cancellation handler that releases a mutex.
+ * @param _lock: the mutex to be released.
+ */
+static void __webs_unlock(void* _lock) {
+	pthread_mutex_unlock(_lock);
+	return;
+}
+
+/* 
+ * if a server delays accepting connections while at capacity (see
+ * webs_set_admission()), waits until it has room for another one. new
+ * connections are left in the listen backlog meanwhile.
+ * @param _srv: the server that is accepting connections.
+ */
+static void __webs_wait_for_room(webs_server* _srv) {
+	pthread_mutex_lock(&_srv->lock);
+	pthread_cleanup_push(__webs_unlock, &_srv->lock);
+	
+	if (_srv->retry_after == 0 && __webs_at_capacity(_srv)) {
+		_srv->stats.deferred++;
+		
+		while (__webs_at_capacity(_srv))
+			pthread_cond_wait(&_srv->left, &_srv->lock);
+	}
+	
+	pthread_cleanup_pop(1);
+	
+	return;
+}
+
+/* 
+ * counts a newly accepted connection against a server's limits.
+ * @param _srv: the server that accepted the connection.
+ * @return -1 if the server is at capacity (and the connection should
+ * be turned away), or 0 otherwise.
+ */
+static int __webs_admit(webs_server* _srv) {
+	int full;
+	
+	pthread_mutex_lock(&_srv->lock);
+	
+	full = __webs_at_capacity(_srv);
+	
+	if (full) _srv->stats.shed++;
+	
+	else {
+		_srv->num_clients++;
+		_srv->num_handshakes++;
+	}
+	
+	pthread_mutex_unlock(&_srv->lock);
+	
+	return -full;
+}
+
+/* 
+ * turns a connection away, with the server's pre-built 503 response
+ * (or, for TLS servers, by just closing it).
+ * @param _srv: the server that accepted the connection.
+ * @param _fd: the connection's descriptor (closed).
+ */
+static void __webs_shed(webs_server* _srv, int _fd) {
+	if (!_srv->tls)
+		send(_fd, _srv->shed_response, strlen(_srv->shed_response),
+			MSG_NOSIGNAL | MSG_DONTWAIT);
+	
+	close(_fd);
+	
+	return;
+}
+
+/* 
+ * accepts a connection on a server's socket, then forks it off (to a
+ * thread of its own) for further initialisation.
+ * @param _srv: the server whose socket is to be accepted from.
+ * @return -1 if no connection could be accepted, or 0 otherwise.
+ */
+static int __webs_accept_one(webs_server* _srv) {
+	webs_client* user;
+	pthread_attr_t attr;
+	pthread_t thread;
+	
+	user = malloc(sizeof(webs_client));
+	
+	if (user == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
+	
+	if (__webs_accept_connection(_srv->soc, user) < 0) {
+		free(user);
+		return -1;
+	}
+	
+	user->srv = _srv;
+	WEBS_PROBE2(accept, user->id, user->fd);
+	
+	/* count the client straight away (so the server isn't freed
+	 * before its thread has added it to the listing), or turn it
+	 * away if the server is at capacity */
+	if (__webs_admit(_srv) < 0) {
+		__webs_shed(_srv, user->fd);
+		free(user);
+		return 0;
+	}
+	
+	/* client threads clean up after themselves */
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	
+	__webs_place_client(_srv, user, &attr);
+	
+	if (pthread_create(&thread, &attr, __webs_client_main, user) != 0) {
+		pthread_mutex_lock(&_srv->lock);
+		_srv->num_clients--;
+		_srv->num_handshakes--;
+		pthread_mutex_unlock(&_srv->lock);
+		
+		close(user->fd);
+		free(user);
+	}
+	
+	pthread_attr_destroy(&attr);
+	
+	return 0;
+}
+
+/* 
+ * main loop for a server, listens for connections and forks
+ * them off for further initialisation.
+ * @param _srv: the server that is calling.
+ */
+static void* __webs_main(void* _srv) {
+	webs_server* srv = (webs_server*) _srv;
+	
+	for (;;) {
+		__webs_wait_for_room(srv);
+		__webs_accept_one(srv);
+	}
+	
+	return NULL;
+}
+
+/* 
+ * accepts every connection waiting on a runtime server's (non-blocking)
+ * socket, then waits for more. if the server has stopped listening,
+ * its socket is closed instead.
+ * @param _srv: the server whose socket is ready.
+ */
+static void __webs_accept_ready(webs_server* _srv) {
+	struct epoll_event ev;
+	int stopped, empty = 0;
+	
+	for (;;) {
+		pthread_mutex_lock(&_srv->lock);
+		
+		stopped = _srv->stopped;
+		
+		/* at capacity, leave connections in the backlog until there
+		 * is room (see __webs_check_room()) */
+		if (!stopped && _srv->retry_after == 0 && __webs_at_capacity(_srv)) {
+			_srv->stats.deferred++;
+			_srv->paused = 1;
+			pthread_mutex_unlock(&_srv->lock);
+			return;
+		}
+		
+		pthread_mutex_unlock(&_srv->lock);
+		
+		if (stopped || __webs_accept_one(_srv) < 0)
+			break;
+	}
+	
+	if (!stopped) {
+		ev.events = EPOLLIN | EPOLLONESHOT;
+		ev.data.ptr = &_srv->watch;
+		epoll_ctl(_srv->runtime->epfd, EPOLL_CTL_MOD, _srv->soc, &ev);
+		return;
+	}
+	
+	close(_srv->soc);
+	
+	pthread_mutex_lock(&_srv->lock);
+	_srv->listening = 0;
+	empty = _srv->closing && _srv->num_clients == 0;
+	pthread_mutex_unlock(&_srv->lock);
+	
+	/* a closed server is freed once its last client has left, and its
+	 * runtime has let go of it */
+	if (empty)
+		__webs_free_server(_srv);
+	
+	return;
+}
+
+/* 
+ * starts a thread for a parked connection that has woken up.
+ * @param _cli: the client whose connection was parked.
+ */
+static void __webs_resume(webs_client* _cli) {
+	pthread_attr_t attr;
+	pthread_t thread;
+	cpu_set_t set;
+	
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	
+	/* keep the client on the CPU it was placed on */
+	if (_cli->cpu >= 0 && _cli->srv->num_cpus) {
+		CPU_ZERO(&set);
+		CPU_SET(_cli->cpu, &set);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &set);
+	}
+	
+	/* if no thread could be started, try again later */
+	if (pthread_create(&thread, &attr, __webs_client_resume, _cli) != 0) {
+		pthread_mutex_lock(&_cli->lock);
+		_cli->parked = 1;
+		__webs_watch(_cli);
+		pthread_mutex_unlock(&_cli->lock);
+	}
+	
+	pthread_attr_destroy(&attr);
+	
+	return;
+}
+
+/* 
+ * puts a client whose jobs were held back, while it was too far behind,
+ * back in its worker pool's run queue once it has caught up. the caller
+ * must hold the client's lock.
+ * @param _cli: the client.
+ */
+static void __webs_unstall(webs_client* _cli) {
+	webs_pool* pool = _cli->srv->pool;
+	
+	if (pool == NULL || (_cli->writing && __webs_is_behind(_cli)))
+		return;
+	
+	pthread_mutex_lock(&pool->lock);
+	
+	if (_cli->stalled) {
+		_cli->stalled = 0;
+		__webs_schedule(pool, _cli);
+	}
+	
+	pthread_mutex_unlock(&pool->lock);
+	
+	return;
+}
+
+/* 
+ * handles a client's connection becoming ready: the backlog left to
+ * the poller is written out as the connection drains, and a parked
+ * connection that has woken up is given a thread.
+ * @param _cli: the client.
+ * @param _events: the events reported by epoll(7).
+ */
+static void __webs_client_ready(webs_client* _cli, uint32_t _events) {
+	int wake;
+	
+	pthread_mutex_lock(&_cli->lock);
+	
+	/* the backlog of a client that is leaving is left to
+	 * __webs_remove_client() (which waits for this) */
+	if (_cli->writing && (_events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+	&& (_cli->state == WEBS_STATE_CLOSING
+	|| __webs_write_queue(_cli, MSG_DONTWAIT) != 1)) {
+		_cli->writing = 0;
+		pthread_cond_broadcast(&_cli->written);
+	}
+	
+	if (_events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+		__webs_unstall(_cli);
+	
+	/* (the thread started for it owns the connection from now on) */
+	wake = _cli->parked && (_events & ~EPOLLOUT);
+	
+	if (wake)
+		_cli->parked = 0;
+	
+	if (_cli->parked || _cli->writing)
+		__webs_watch(_cli);
+	
+	pthread_mutex_unlock(&_cli->lock);
+	
+	if (wake)
+		__webs_resume(_cli);
+	
+	return;
+}
+
+/* 
+ * waits on an epoll(7) instance forever, handing each parked connection
+ * that wakes to a thread of its own, writing out backlogs as their
+ * connections drain, and accepting connections on each (runtime)
+ * server's socket that becomes ready.
+ * @param _epfd: the epoll(7) instance to wait on.
+ */
+static void __webs_poll_events(int _epfd) {
+	struct epoll_event events[WEBS_MAX_EVENTS];
+	struct webs_watch* watch;
+	int i, n;
+	
+	for (;;) {
+		n = epoll_wait(_epfd, events, WEBS_MAX_EVENTS, -1);
+		
+		for (i = 0; i < n; i++) {
+			watch = events[i].data.ptr;
+			
+			if (watch->type == WEBS_WATCH_LISTENER)
+				__webs_accept_ready(watch->ptr);
+			else
+				__webs_client_ready(watch->ptr, events[i].events);
+		}
+	}
+	
+	return;
+}
+
+/* 
+ * main function for a server's park thread, which waits on every
+ * parked connection and starts a thread for each one that wakes (and
+ * drains the server's backlogs).
+ * @param _srv: the server whose connections are parked.
+ */
+static void* __webs_park_main(void* _srv) {
+	__webs_poll_events(((webs_server*) _srv)->epfd);
+	return NULL;
+}
+
+/* 
+ * main function for a runtime's thread, which accepts connections for
+ * every server started on the runtime, and wakes their parked ones.
+ * @param _rt: the runtime.
+ */
+static void* __webs_runtime_main(void* _rt) {
+	__webs_poll_events(((webs_runtime*) _rt)->epfd);
+	return NULL;
+}
+
+/* 
+ * takes a server off its runtime's list of listening servers, waking
+ * anything waiting in webs_hold().
+ * @param _srv: the server (started on a runtime).
+ */
+static void __webs_runtime_remove(webs_server* _srv) {
+	webs_runtime* rt = _srv->runtime;
+	webs_server** link;
+	
+	pthread_mutex_lock(&rt->lock);
+	
+	for (link = &rt->servers; *link; link = &(*link)->rt_next) {
+		if (*link == _srv) {
+			*link = _srv->rt_next;
+			break;
+		}
+	}
+	
+	pthread_cond_broadcast(&rt->stopped);
+	pthread_mutex_unlock(&rt->lock);
+	
+	return;
+}
+
+/* 
+ * takes a reference to each open client of a server, so that frames
+ * can be queued for them without holding the server's lock (a client
+ * that leaves waits for its references to be put back). the server's
+ * poller is started too, to write out whatever a client's connection
+ * can't take at once. the caller must hold the server's lock.
+ * @param _srv: the server.
+ * @param _count: set to the number of clients taken.
+ * @return the clients, to be put back with __webs_put_clients().
+ */
+static webs_client** __webs_get_clients(webs_server* _srv, size_t* _count) {
+	struct webs_client_node* node;
+	webs_client** clients;
+	size_t n = 0;
+	
+	for (node = _srv->head; node; node = node->next)
+		n++;
+	
+	clients = malloc((n + 1) * sizeof(webs_client*));
+	
+	if (clients == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
+	
+	__webs_start_poller(_srv);
+	*_count = 0;
+	
+	for (node = _srv->head; node; node = node->next) {
+		pthread_mutex_lock(&node->client.lock);
+		
+		if (node->client.state == WEBS_STATE_OPEN) {
+			node->client.refs++;
+			clients[(*_count)++] = &node->client;
+		}
+		
+		pthread_mutex_unlock(&node->client.lock);
+	}
+	
+	return clients;
+}
+
+/* 
+ * puts back a reference to a client (see __webs_get_clients()).
+ * @param _self: the client.
+ */
+static void __webs_put_client(webs_client* _self) {
+	pthread_mutex_lock(&_self->lock);
+	
+	if (--_self->refs == 0)
+		pthread_cond_broadcast(&_self->written);
+	
+	pthread_mutex_unlock(&_self->lock);
+	
+	return;
+}
+
+/* 
+ * puts back the references taken by __webs_get_clients().
+ * @param _clients: the clients.
+ * @param _count: the number of clients.
+ */
+static void __webs_put_clients(webs_client** _clients, size_t _count) {
+	size_t i;
+	
+	for (i = 0; i < _count; i++)
+		__webs_put_client(_clients[i]);
+	
+	free(_clients);
+	
+	return;
+}
+
+/* 
+ * stops a server accepting connections (once).
+ * @param _srv: the server to be stopped.
+ */
+static void __webs_stop_listening(webs_server* _srv) {
+	struct epoll_event ev;
+	int stopped;
+	
+	pthread_mutex_lock(&_srv->lock);
+	stopped = _srv->stopped;
+	_srv->stopped = 1;
+	pthread_mutex_unlock(&_srv->lock);
+	
+	if (stopped) return;
+	
+	if (_srv->runtime == NULL) {
+		pthread_cancel(_srv->thread);
+		close(_srv->soc);
+		return;
+	}
+	
+	__webs_runtime_remove(_srv);
+	
+	/* the runtime's thread owns the socket, so wake it (even if it
+	 * was paused) to close it */
+	shutdown(_srv->soc, SHUT_RDWR);
+	
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = &_srv->watch;
+	epoll_ctl(_srv->runtime->epfd, EPOLL_CTL_MOD, _srv->soc, &ev);
+	
+	return;
+}
+
+void webs_eject(webs_client* _self) {
+	/* wake the client's thread, which calls `on_close` and cleans up
+	 * once any handler that is running for the client has returned */
+	_self->ejected = 1;
+	shutdown(_self->fd, SHUT_RDWR);
+	
+	return;
+}
+
+void webs_close(webs_server* _srv) {
+	struct webs_client_node* node;
+	webs_client** clients;
+	size_t count, i;
+	int empty;
+	
+	__webs_stop_listening(_srv);
+	
+	pthread_mutex_lock(&_srv->lock);
+	
+	_srv->closing = 1;
+	clients = __webs_get_clients(_srv, &count);
+	
+	/* clients that aren't open yet are simply hung up on */
+	for (node = _srv->head; node; node = node->next) {
+		pthread_mutex_lock(&node->client.lock);
+		
+		if (node->client.state != WEBS_STATE_OPEN)
+			webs_eject(&node->client);
+		
+		pthread_mutex_unlock(&node->client.lock);
+	}
+	
+	empty = _srv->num_clients == 0 && !_srv->listening;
+	
+	pthread_mutex_unlock(&_srv->lock);
+	
+	/* let the others know we are going away before hanging up (the
+	 * frames are sent as far as each connection takes them at once) */
+	for (i = 0; i < count; i++) {
+		__webs_send_close(clients[i], WEBS_CLOSE_GOING_AWAY, WEBS_QUEUE_NOWAIT);
+		webs_eject(clients[i]);
+	}
+	
+	__webs_put_clients(clients, count);
+	
+	/* otherwise the last client to leave (or the server's runtime)
+	 * frees the server */
+	if (empty)
+		__webs_free_server(_srv);
+	
+	return;
+}
+
+int webs_handoff(webs_server* _srv, char* _path) {
+	struct sockaddr_un addr = {0};
+	struct msghdr msg = {0};
+	struct cmsghdr* cmsg;
+	struct iovec iov;
+	char ctl[CMSG_SPACE(sizeof(int))];
+	char byte = 0;
+	int fd, con, error = -1;
+	
+	if (strlen(_path) >= sizeof(addr.sun_path))
+		return -1;
+	
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, _path);
+	unlink(_path);
+	
+	if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0
+	|| listen(fd, 1) < 0)
+		goto DONE;
+	
+	/* wait for the new process to ask for the socket */
+	con = accept(fd, NULL, NULL);
+	if (con < 0) goto DONE;
+	
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl;
+	msg.msg_controllen = sizeof(ctl);
+	
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &_srv->soc, sizeof(int));
+	
+	if (sendmsg(con, &msg, 0) == 1)
+		error = 0;
+	
+	close(con);
+	
+	DONE:
+	
+	close(fd);
+	unlink(_path);
+	
+	return error;
+}
+
+void webs_drain(webs_server* _srv, size_t _rate) {
+	struct timespec deadline;
+	struct timespec gap;
+	webs_client** clients;
+	size_t count, i;
+	
+	/* stop accepting (if the socket was handed off, the new process
+	 * keeps its own copy of it open) */
+	__webs_stop_listening(_srv);
+	
+	if (_rate) {
+		gap.tv_sec = 1 / _rate;
+		gap.tv_nsec = (1000000000 / _rate) % 1000000000;
+	}
+	
+	pthread_mutex_lock(&_srv->lock);
+	clients = __webs_get_clients(_srv, &count);
+	pthread_mutex_unlock(&_srv->lock);
+	
+	/* ask one client at a time to close, at no more than `_rate`
+	 * clients per second (without waiting on any connection, what it
+	 * can't take is left to the server's poller). each client is let
+	 * go as soon as it has been asked, so that it can leave */
+	for (i = 0; i < count; i++) {
+		__webs_send_close(clients[i], WEBS_CLOSE_GOING_AWAY,
+			WEBS_QUEUE_NOWAIT);
+		__webs_put_client(clients[i]);
+		
+		if (_rate && i + 1 < count) nanosleep(&gap, NULL);
+	}
+	
+	free(clients);
+	
+	/* give clients a while to reply, before hanging up on them */
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += WEBS_DRAIN_TIMEOUT;
+	
+	pthread_mutex_lock(&_srv->lock);
+	
+	while (_srv->num_clients)
+		if (pthread_cond_timedwait(&_srv->left, &_srv->lock, &deadline))
+			break;
+	
+	pthread_mutex_unlock(&_srv->lock);
+	
+	webs_close(_srv);
+	
+	return;
+}
+
+void webs_set_admission(webs_server* _srv, size_t _max_clients,
+size_t _max_handshakes, int _retry_after) {
+	pthread_mutex_lock(&_srv->lock);
+	
+	_srv->max_clients = _max_clients;
+	_srv->max_handshakes = _max_handshakes;
+	_srv->retry_after = _retry_after < 0 ? 0 : _retry_after;
+	sprintf(_srv->shed_response, WEBS_SHED_FMT, _srv->retry_after);
+	
+	/* let a waiting accept loop re-check its limits */
+	__webs_check_room(_srv);
+	
+	pthread_mutex_unlock(&_srv->lock);
+	
+	return;
+}
+
+int webs_serve_files(webs_server* _srv, char* _dir) {
+	int fd = -1;
+	
+	if (_dir && (fd = open(_dir, O_RDONLY | O_DIRECTORY)) < 0)
+		return -1;
+	
+	pthread_mutex_lock(&_srv->lock);
+	
+	if (_srv->http_cache == NULL) {
+		_srv->http_cache = calloc(WEBS_HTTP_CACHE, sizeof(struct webs_http_file));
+		
+		if (_srv->http_cache == NULL)
+			WEBS_XERR("Failed to allocate memory!", ENOMEM);
+	}
+	
+	/* headers cached for the last directory don't apply to this one */
+	else
+		memset(_srv->http_cache, 0, WEBS_HTTP_CACHE * sizeof(struct webs_http_file));
+	
+	if (_srv->http_root >= 0)
+		close(_srv->http_root);
+	
+	_srv->http_root = fd;
+	
+	pthread_mutex_unlock(&_srv->lock);
+	
+	return 0;
+}
+
+void webs_set_health(webs_server* _srv, char* _path, char* _body) {
+	char* path = NULL;
+	char* response = NULL;
+	
+	if (_path) {
+		path = malloc(strlen(_path) + 1);
+		response = malloc(sizeof(WEBS_HTTP_HEALTH_FMT) + 20 + strlen(_body));
+		
+		if (path == NULL || response == NULL)
+			WEBS_XERR("Failed to allocate memory!", ENOMEM);
+		
+		strcpy(path, _path);
+		sprintf(response, WEBS_HTTP_HEALTH_FMT, (unsigned long) strlen(_body), _body);
+	}
+	
+	pthread_mutex_lock(&_srv->lock);
+	
+	free(_srv->health_path);
+	free(_srv->health_response);
+	_srv->health_path = path;
+	_srv->health_response = response;
+	
+	pthread_mutex_unlock(&_srv->lock);
+	
+	return;
+}
+
+int webs_enable_resume(webs_server* _srv, size_t _frames, size_t _bytes,
+size_t _ms) {
+	int error = 0;
+	
+	if (_frames == 0 || _bytes == 0)
+		return -1;
+	
+	pthread_mutex_lock(&_srv->lock);
+	
+	_srv->resume_frames = _frames;
+	_srv->resume_bytes = _bytes;
+	_srv->resume_ms = _ms;
+	
+	/* sessions are kept from the next client on */
+	if (_srv->sessions == NULL) {
+		_srv->sessions = calloc(WEBS_RESUME_BUCKETS,
+			sizeof(struct webs_session*));
+		
+		if (_srv->sessions == NULL)
+			WEBS_XERR("Failed to allocate memory!", ENOMEM);
+		
+		if (pthread_create(&_srv->resume_thread, 0, __webs_session_main, _srv)) {
+			free(_srv->sessions);
+			_srv->sessions = NULL;
+			error = -1;
+		}
+	}
+	
+	pthread_mutex_unlock(&_srv->lock);
+	
+	return error;
+}
+
+char* webs_resume_token(webs_client* _self) {
+	char* token = NULL;
+	
+	pthread_mutex_lock(&_self->lock);
+	
+	if (_self->session)
+		token = _self->session->token;
+	
+	pthread_mutex_unlock(&_self->lock);
+	
+	return token;
+}
+
+int webs_capture_start(webs_server* _srv, char* _path, int _payloads) {
+	FILE* f = fopen(_path, "wb");
+	
+	if (f == NULL)
+		return -1;
+	
+	fwrite(WEBS_CAPTURE_MAGIC, 1, 8, f);
+	
+	pthread_mutex_lock(&_srv->capture_lock);
+	
+	if (_srv->capture)
+		fclose(_srv->capture);
+	
+	_srv->capture = f;
+	_srv->capture_start = __webs_now_us();
+	_srv->capture_payloads = _payloads;
+	
+	pthread_mutex_unlock(&_srv->capture_lock);
+	
+	return 0;
+}
+
+void webs_capture_stop(webs_server* _srv) {
+	pthread_mutex_lock(&_srv->capture_lock);
+	
+	if (_srv->capture)
+		fclose(_srv->capture);
+	
+	_srv->capture = NULL;
+	
+	pthread_mutex_unlock(&_srv->capture_lock);
+	
+	return;
+}
+
+int webs_set_cpus(webs_server* _srv, int* _cpus, size_t _n) {
+	cpu_set_t set;
+	size_t i;
+	
+	CPU_ZERO(&set);
+	
+	for (i = 0; i < _n; i++) {
+		if (_cpus[i] < 0 || (size_t) _cpus[i] >= _srv->max_cpus)
+			return -1;
+		
+		CPU_SET(_cpus[i], &set);
+	}
+	
+	pthread_mutex_lock(&_srv->lock);
+	
+	free(_srv->cpus);
+	_srv->cpus = NULL;
+	_srv->num_cpus = 0;
+	_srv->next_cpu = 0;
+	
+	if (_n) {
+		_srv->cpus = malloc(_n * sizeof(int));
+		
+		if (_srv->cpus == NULL)
+			WEBS_XERR("Failed to allocate memory!", ENOMEM);
+		
+		memcpy(_srv->cpus, _cpus, _n * sizeof(int));
+		_srv->num_cpus = _n;
+		
+		if (_srv->runtime == NULL)
+			pthread_setaffinity_np(_srv->thread, sizeof(cpu_set_t), &set);
+	}
+	
+	pthread_mutex_unlock(&_srv->lock);
+	
+	return 0;
+}
+
+size_t webs_get_cpu_stats(webs_server* _srv, struct webs_stats* _dst,
+size_t _n) {
+	struct webs_client_node* node;
+	size_t i;
+	
+	if (_n > _srv->max_cpus)
+		_n = _srv->max_cpus;
+	
+	pthread_mutex_lock(&_srv->lock);
+	
+	for (i = 0; i < _n; i++)
+		_dst[i] = _srv->cpu_stats[i];
+	
+	for (node = _srv->head; node; node = node->next)
+		if (node->client.cpu >= 0 && (size_t) node->client.cpu < _n) {
+			pthread_mutex_lock(&node->client.lock);
+			__webs_add_stats(&_dst[node->client.cpu], &node->client.stats);
+			pthread_mutex_unlock(&node->client.lock);
+		}
+	
+	pthread_mutex_unlock(&_srv->lock);
+	
+	return _n;
+}
+
+webs_pool* webs_pool_create(size_t _threads, size_t _max_jobs) {
+	webs_pool* pool;
+	size_t i;
+	
+	if (_threads == 0 || _max_jobs == 0)
+		return NULL;
+	
+	pool = malloc(sizeof(webs_pool));
+	
+	if (pool == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
+	
+	pool->threads = malloc(_threads * sizeof(pthread_t));
+	
+	if (pool->threads == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
+	
+	pool->head = pool->tail = NULL;
+	pool->num_threads = _threads;
+	pool->max_jobs = _max_jobs;
+	pool->stop = 0;
+	
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->ready, NULL);
+	
+	for (i = 0; i < _threads; i++)
+		if (pthread_create(&pool->threads[i], 0, __webs_worker_main, pool) != 0) {
+			/* (stopping the workers that did start) */
+			pool->num_threads = i;
+			webs_pool_free(pool);
+			return NULL;
+		}
+	
+	return pool;
+}
+
+void webs_pool_free(webs_pool* _pool) {
+	size_t i;
+	
+	pthread_mutex_lock(&_pool->lock);
+	_pool->stop = 1;
+	pthread_cond_broadcast(&_pool->ready);
+	pthread_mutex_unlock(&_pool->lock);
+	
+	for (i = 0; i < _pool->num_threads; i++)
+		pthread_join(_pool->threads[i], 0);
+	
+	pthread_mutex_destroy(&_pool->lock);
+	pthread_cond_destroy(&_pool->ready);
+	free(_pool->threads);
+	free(_pool);
+	
+	return;
+}
+
+int webs_send(webs_client* _self, char* _data) {
+	int len = 0;
+	
+	/* check for nullptr or empty string */
+	if (!_data || !*_data) return 0;
+	
+	/* get length of data */
+	while (_data[++len]);
+	
+	return __webs_enqueue(_self, __webs_make_packet(_data, len, 0x1));
+}
+
+int webs_sendn(webs_client* _self, char* _data, ssize_t _n) {
+	/* check for NULL or empty string */
+	if (!_data || !*_data) return 0;
+	
+	return __webs_enqueue(_self, __webs_make_packet(_data, _n, 0x1));
+}
+
+int webs_send_prio(webs_client* _self, char* _data, ssize_t _n, int _op,
+	int _prio) {
+	if (_op != 0x1 && _op != 0x2)
+		return -1;
+	
+	/* check for NULL or no data (binary data may well start with a 0) */
+	if (!_data || _n <= 0) return 0;
+	
+	return __webs_enqueue_frames(_self, __webs_make_packet(_data, _n, _op),
+		0, _prio);
+}
+
+int webs_send_begin(webs_client* _self, int _op) {
+	if (_op != 0x1 && _op != 0x2)
+		return -1;
+	
+	pthread_mutex_lock(&_self->lock);
+	
+	/* only one message can be streamed at a time */
+	if (_self->stream_op >= 0) {
+		pthread_mutex_unlock(&_self->lock);
+		return -1;
+	}
+	
+	_self->stream_op = _op;
+	
+	pthread_mutex_unlock(&_self->lock);
+	
+	return 0;
+}
+
+int webs_send_chunk(webs_client* _self, char* _data, size_t _n) {
+	struct webs_packet* pkt;
+	int len;
+	
+	/* (made as a continuation frame, not marked final, so that only
+	 * its opcode needs to be set under the lock) */
+	pkt = __webs_make_packet(_data, _n, 0x0);
+	pkt->data[0] &= ~0x80;
+	
+	pthread_mutex_lock(&_self->lock);
+	
+	if (_self->stream_op < 0) {
+		pthread_mutex_unlock(&_self->lock);
+		__webs_free_packet(pkt);
+		return -1;
+	}
+	
+	/* the first fragment carries the message's opcode, the rest are
+	 * continuation frames */
+	pkt->data[0] |= _self->stream_op;
+	_self->stream_op = 0x0;
+	
+	len = __webs_queue_frames(_self, pkt, WEBS_QUEUE_FRAGMENT,
+		WEBS_PRIO_NORMAL);
+	
+	pthread_mutex_unlock(&_self->lock);
+	
+	return len;
+}
+
+int webs_send_end(webs_client* _self) {
+	struct webs_packet* pkt;
+	int error;
+	
+	pthread_mutex_lock(&_self->lock);
+	
+	if (_self->stream_op < 0) {
+		pthread_mutex_unlock(&_self->lock);
+		return -1;
+	}
+	
+	/* finish the message with an empty final frame */
+	pkt = __webs_make_packet("", 0, _self->stream_op);
+	error = __webs_queue_frames(_self, pkt, WEBS_QUEUE_FRAGMENT,
+		WEBS_PRIO_NORMAL);
+	
+	/* then release any data frames that were held back meanwhile */
+	_self->stream_op = -1;
+	
+	if (_self->held.head) {
+		if (_self->out.tail)
+			_self->out.tail->next = _self->held.head;
+		else
+			_self->out.head = _self->held.head;
+		
+		_self->out.tail = _self->held.tail;
+		_self->out.num_bytes += _self->held.num_bytes;
+		_self->out.file_bytes += _self->held.file_bytes;
+		memset(&_self->held, 0, sizeof(struct webs_queue));
+		
+		if (!__webs_on_own_thread(_self)
+		|| _self->out.num_bytes + _self->urgent.num_bytes >= WEBS_MAX_QUEUE)
+			if (__webs_flush_queue(_self) < 0)
+				error = -1;
+	}
+	
+	pthread_mutex_unlock(&_self->lock);
+	
+	return error < 0 ? -1 : 0;
+}
+
+int webs_send_file(webs_client* _self, int _fd, off_t _off, size_t _n) {
+	struct webs_file* file = __webs_open_file(_fd);
+	int error;
+	
+	if (file == NULL)
+		return -1;
+	
+	/* the packet holds the only reference, so the file is closed
+	 * once it has been sent */
+	error = __webs_enqueue(_self, __webs_make_file_packet(file, _off, _n));
+	
+	return error < 0 ? -1 : 0;
+}
+
+int webs_broadcast_file(webs_server* _srv, int _fd, off_t _off, size_t _n) {
+	struct webs_file* file = __webs_open_file(_fd);
+	webs_client** clients;
+	char fin = (char) 0x82;
+	size_t count, i;
+	int sent = 0;
+	
+	if (file == NULL)
+		return -1;
+	
+	/* hold a reference of our own while queueing, so that the file
+	 * isn't closed by the first client to finish sending it */
+	file->refs = 1;
+	
+	/* a file isn't held for sessions without an open client, so they
+	 * are left with a gap (and can't be resumed past it) */
+	pthread_mutex_lock(&_srv->lock);
+	clients = __webs_get_clients(_srv, &count);
+	__webs_record_sessions(_srv, &fin, 1, 0);
+	pthread_mutex_unlock(&_srv->lock);
+	
+	/* (each client's connection takes what it can, the rest is
+	 * written by the server's poller as it drains) */
+	for (i = 0; i < count; i++)
+		if (__webs_enqueue_frames(clients[i], __webs_make_file_packet(file,
+		_off, _n), WEBS_QUEUE_NOWAIT, WEBS_PRIO_NORMAL) >= 0)
+			sent++;
+	
+	__webs_put_clients(clients, count);
+	__webs_release_file(file);
+	
+	return sent;
+}
+
+webs_ring* webs_ring_create(size_t _frames, size_t _bytes, char* _path) {
+	webs_ring* ring;
+	
+	if (_frames == 0 || _bytes == 0)
+		return NULL;
+	
+	ring = malloc(sizeof(webs_ring));
+	
+	if (ring == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
+	
+	ring->entries = malloc(_frames * sizeof(struct webs_ring_entry));
+	
+	if (ring->entries == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
+	
+	ring->fd = -1;
+	ring->prio = WEBS_PRIO_NORMAL;
+	
+	/* large rings can be backed by a file, so that the kernel can
+	 * page frames out to it rather than to swap */
+	if (_path) {
+		ring->fd = open(_path, O_RDWR | O_CREAT, 0600);
+		
+		if (ring->fd < 0 || ftruncate(ring->fd, _bytes) < 0)
+			goto FAIL;
+		
+		ring->data = mmap(NULL, _bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+			ring->fd, 0);
+	}
+	
+	else ring->data = mmap(NULL, _bytes, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	
+	if (ring->data == MAP_FAILED)
+		goto FAIL;
+	
+	ring->max_frames = _frames;
+	ring->size = _bytes;
+	ring->first = 0;
+	ring->count = 0;
+	ring->write_off = 0;
+	ring->next_seq = 1;
+	
+	pthread_mutex_init(&ring->lock, NULL);
+	
+	return ring;
+	
+	FAIL:
+	
+	if (ring->fd >= 0)
+		close(ring->fd);
+	
+	free(ring->entries);
+	free(ring);
+	
+	return NULL;
+}
+
+void webs_ring_free(webs_ring* _ring) {
+	munmap(_ring->data, _ring->size);
+	
+	if (_ring->fd >= 0)
+		close(_ring->fd);
+	
+	pthread_mutex_destroy(&_ring->lock);
+	free(_ring->entries);
+	free(_ring);
+	
+	return;
+}
+
+/* 
+ * drops the oldest frame held in a ring.
+ * @param _ring: the ring to be trimmed.
+ */
+static void __webs_ring_pop(webs_ring* _ring) {
+	_ring->first = (_ring->first + 1) % _ring->max_frames;
+	_ring->count--;
+	
+	return;
+}
+
+/* 
+ * makes room for a frame in a ring, evicting the oldest frames to do
+ * so. frames are laid out one after another, wrapping back to the
+ * start of the ring when the next one doesn't fit in the space left.
+ * the caller must hold the ring's lock, and then writes the frame at
+ * the entry's offset, setting its length and advancing `write_off`.
+ * @param _ring: the ring to be written to.
+ * @param _len: the most the frame can take up.
+ * @return the new frame's entry, or NULL if it can never fit.
+ */
+static struct webs_ring_entry* __webs_ring_reserve(webs_ring* _ring,
+size_t _len) {
+	struct webs_ring_entry* e;
+	size_t off;
+	
+	if (_len > _ring->size)
+		return NULL;
+	
+	/* when wrapping, anything left past the write offset is from the
+	 * previous lap, so it's older than everything else in the ring */
+	if (_ring->write_off + _len > _ring->size) {
+		while (_ring->count
+		&& _ring->entries[_ring->first].off >= _ring->write_off)
+			__webs_ring_pop(_ring);
+		
+		_ring->write_off = 0;
+	}
+	
+	/* evict frames that the new one will overwrite (these are always
+	 * the oldest), or the oldest frame if every entry is in use */
+	while (_ring->count) {
+		e = &_ring->entries[_ring->first];
+		
+		if (_ring->count < _ring->max_frames && (e->off < _ring->write_off
+		|| e->off >= _ring->write_off + _len))
+			break;
+		
+		__webs_ring_pop(_ring);
+	}
+	
+	off = (_ring->first + _ring->count) % _ring->max_frames;
+	e = &_ring->entries[off];
+	
+	e->seq = _ring->next_seq++;
+	e->off = _ring->write_off;
+	e->len = 0;
+	
+	_ring->count++;
+	
+	return e;
+}
+
+/* 
+ * encodes a frame into a ring (see __webs_ring_reserve()).
+ * the caller must hold the ring's lock.
+ * @param _ring: the ring to be written to.
+ * @param _src: a pointer to the frame's payload data.
+ * @param _n: the size of the frame's payload data.
+ * @return the new frame's entry, or NULL if it can never fit.
+ */
+static struct webs_ring_entry* __webs_ring_push(webs_ring* _ring,
+char* _src, size_t _n) {
+	/* (10 bytes is the largest the frame's header can be) */
+	struct webs_ring_entry* e = __webs_ring_reserve(_ring, _n + 10);
+	
+	if (e == NULL)
+		return NULL;
+	
+	e->len = __webs_make_frame(_src, _ring->data + e->off, _n, 0x1);
+	_ring->write_off += e->len;
+	
+	return e;
+}
+
+/* 
+ * queues a copy of an encoded frame for every open client of a server
+ * (without holding the server's lock, or waiting on any connection),
+ * and keeps it for every session that has no open client.
+ * @param _srv: the server whose clients are to be sent the frame.
+ * @param _frm: the encoded frame.
+ * @param _n: the size of the encoded frame.
+ * @param _prio: the class to send the frame in.
+ */
+static void __webs_broadcast_frame(webs_server* _srv, char* _frm, size_t _n,
+int _prio) {
+	webs_client** clients;
+	size_t count, i;
+	
+	pthread_mutex_lock(&_srv->lock);
+	clients = __webs_get_clients(_srv, &count);
+	__webs_record_sessions(_srv, _frm, _n, 1);
+	pthread_mutex_unlock(&_srv->lock);
+	
+	/* (no client's connection is waited on, see __webs_queue_frames()) */
+	for (i = 0; i < count; i++)
+		__webs_enqueue_frames(clients[i], __webs_copy_packet(_frm, _n),
+			WEBS_QUEUE_NOWAIT, _prio);
+	
+	__webs_put_clients(clients, count);
+	
+	return;
+}
+
+size_t webs_publish(webs_server* _srv, webs_ring* _ring, char* _data,
+ssize_t _n) {
+	struct webs_ring_entry* e;
+	struct webs_packet* pkt;
+	size_t seq;
+	
+	if (_ring == NULL) {
+		if (_srv == NULL) return 0;
+		
+		pkt = __webs_make_packet(_data, _n, 0x1);
+		seq = 0;
+	}
+	
+	else {
+		pthread_mutex_lock(&_ring->lock);
+		
+		e = __webs_ring_push(_ring, _data, _n);
+		
+		if (e == NULL) {
+			pthread_mutex_unlock(&_ring->lock);
+			return 0;
+		}
+		
+		seq = e->seq;
+		pkt = _srv ? __webs_copy_packet(_ring->data + e->off, e->len) : NULL;
+		
+		pthread_mutex_unlock(&_ring->lock);
+		
+		if (pkt == NULL) return seq;
+	}
+	
+	/* every client is sent a copy of the same encoded frame */
+	__webs_broadcast_frame(_srv, pkt->data, pkt->len,
+		_ring ? _ring->prio : WEBS_PRIO_NORMAL);
+	
+	free(pkt);
+	
+	return seq;
+}
+
+/* 
+ * copies the frames held in a ring that were added after a given
+ * sequence number.
+ * @param _ring: the ring.
+ * @param _since: the sequence number of the last frame not wanted.
+ * @param _count: set to the number of frames copied.
+ * @return the copies, linked through `next` (or NULL if none).
+ */
+static struct webs_packet* __webs_ring_copy(webs_ring* _ring, size_t _since,
+int* _count) {
+	struct webs_packet* head = NULL;
+	struct webs_packet* tail = NULL;
+	struct webs_packet* pkt;
+	struct webs_ring_entry* e;
+	size_t i;
+	
+	*_count = 0;
+	
+	pthread_mutex_lock(&_ring->lock);
+	
+	for (i = 0; i < _ring->count; i++) {
+		e = &_ring->entries[(_ring->first + i) % _ring->max_frames];
+		
+		if (e->seq <= _since)
+			continue;
+		
+		pkt = __webs_copy_packet(_ring->data + e->off, e->len);
+		
+		if (tail) tail->next = pkt;
+		else head = pkt;
+		
+		tail = pkt;
+		(*_count)++;
+	}
+	
+	pthread_mutex_unlock(&_ring->lock);
+	
+	return head;
+}
+
+int webs_replay(webs_client* _self, webs_ring* _ring, size_t _since) {
+	struct webs_packet* head;
+	int count;
+	
+	head = __webs_ring_copy(_ring, _since, &count);
+	
+	if (head && __webs_enqueue_frames(_self, head, 0, _ring->prio) < 0)
+		return -1;
+	
+	return count;
+}
+
+int webs_publish_latest(webs_server* _srv, size_t _key, char* _data,
+ssize_t _n) {
+	struct webs_packet* frm;
+	struct webs_packet* pkt;
+	webs_client** clients;
+	size_t count, i;
+	
+	if (_srv == NULL) return 0;
+	
+	frm = __webs_make_packet(_data, _n, 0x1);
+	
+	/* (a session without an open client keeps every value, as it
+	 * can't tell which it would have been sent) */
+	pthread_mutex_lock(&_srv->lock);
+	clients = __webs_get_clients(_srv, &count);
+	__webs_record_sessions(_srv, frm->data, frm->len, 1);
+	pthread_mutex_unlock(&_srv->lock);
+	
+	/* (a client's backlog is left to the server's poller, so this
+	 * never waits on a connection) */
+	for (i = 0; i < count; i++) {
+		pkt = __webs_copy_packet(frm->data, frm->len);
+		pkt->keyed = 1;
+		pkt->key = _key;
+		
+		__webs_enqueue_frames(clients[i], pkt, WEBS_QUEUE_NOWAIT,
+			WEBS_PRIO_NORMAL);
+	}
+	
+	__webs_put_clients(clients, count);
+	free(frm);
+	
+	return (int) count;
+}
+
+/* 
+ * rounds a fanout record's size up to keep records 8-byte aligned.
+ */
+#define __WEBS_FANOUT_ALIGN(N) (((N) + 7) & ~((uint64_t) 7))
+
+/* 
+ * waits on a futex shared between processes.
+ * @param _addr: the futex.
+ * @param _val: the value it is expected to hold (returns at once if
+ * it doesn't).
+ */
+static void __webs_futex_wait(uint32_t* _addr, uint32_t _val) {
+	syscall(SYS_futex, _addr, FUTEX_WAIT, _val, NULL, NULL, 0);
+	return;
+}
+
+/* 
+ * wakes everything waiting on a futex shared between processes.
+ * @param _addr: the futex.
+ */
+static void __webs_futex_wake(uint32_t* _addr) {
+	syscall(SYS_futex, _addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	return;
+}
+
+/* 
+ * maps a fanout ring's memfd, the header first to learn its size.
+ * @param _fd: the ring's descriptor (owned by the new handle).
+ * @return a pointer to the new handle, or NULL on error.
+ */
+static webs_fanout* __webs_fanout_map(int _fd) {
+	struct webs_fanout_shared* shm;
+	webs_fanout* fan;
+	uint64_t size;
+	
+	shm = mmap(NULL, sizeof(struct webs_fanout_shared), PROT_READ,
+		MAP_SHARED, _fd, 0);
+	
+	if (shm == MAP_FAILED) {
+		close(_fd);
+		return NULL;
+	}
+	
+	size = shm->size;
+	munmap(shm, sizeof(struct webs_fanout_shared));
+	
+	shm = mmap(NULL, sizeof(struct webs_fanout_shared) + size,
+		PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	
+	if (shm == MAP_FAILED) {
+		close(_fd);
+		return NULL;
+	}
+	
+	fan = malloc(sizeof(webs_fanout));
+	
+	if (fan == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
+	
+	fan->shm = shm;
+	fan->data = (char*) (shm + 1);
+	fan->fd = _fd;
+	fan->srv = NULL;
+	fan->stopped = 0;
+	memset(&fan->stats, 0, sizeof(struct webs_fanout_stats));
+	pthread_mutex_init(&fan->lock, NULL);
+	
+	return fan;
+}
+
+/* 
+ * locks a fanout ring for publishing, recovering the lock if its last
+ * holder died with it.
+ * @param _shm: the ring's shared header.
+ */
+static void __webs_fanout_lock(struct webs_fanout_shared* _shm) {
+	if (pthread_mutex_lock(&_shm->lock) == EOWNERDEAD)
+		pthread_mutex_consistent(&_shm->lock);
+	
+	return;
+}
+
+webs_fanout* webs_fanout_create(size_t _bytes) {
+	struct webs_fanout_shared shm;
+	pthread_mutexattr_t attr;
+	webs_fanout* fan;
+	int fd;
+	
+	_bytes = __WEBS_FANOUT_ALIGN(_bytes);
+	
+	if (_bytes < 2 * sizeof(struct webs_fanout_record))
+		return NULL;
+	
+	fd = memfd_create("webs-fanout", 0);
+	
+	if (fd < 0) return NULL;
+	
+	if (ftruncate(fd, sizeof(struct webs_fanout_shared) + _bytes) < 0) {
+		close(fd);
+		return NULL;
+	}
+	
+	/* the header is written before mapping, so that the size can be
+	 * read back as it would be by any other process */
+	memset(&shm, 0, sizeof(shm));
+	shm.size = _bytes;
+	shm.next_seq = 1;
+	
+	if (pwrite(fd, &shm, sizeof(shm), 0) != sizeof(shm)) {
+		close(fd);
+		return NULL;
+	}
+	
+	fan = __webs_fanout_map(fd);
+	
+	if (fan == NULL) return NULL;
+	
+	/* publishers in any process share the lock, and a publisher that
+	 * dies holding it doesn't leave the ring locked forever */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&fan->shm->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	
+	return fan;
+}
+
+webs_fanout* webs_fanout_open(int _fd) {
+	int fd = dup(_fd);
+	
+	if (fd < 0) return NULL;
+	
+	return __webs_fanout_map(fd);
+}
+
+size_t webs_fanout_publish(webs_fanout* _fan, char* _data, ssize_t _n) {
+	struct webs_fanout_shared* shm = _fan->shm;
+	struct webs_fanout_record* rec;
+	uint64_t head, need, off, skip;
+	size_t seq;
+	
+	/* room for the largest the encoded frame can be */
+	need = __WEBS_FANOUT_ALIGN(sizeof(struct webs_fanout_record) + _n + 10);
+	
+	if (need > shm->size / 2)
+		return 0;
+	
+	__webs_fanout_lock(shm);
+	
+	head = shm->head;
+	off = head % shm->size;
+	skip = off + need > shm->size ? shm->size - off : 0;
+	
+	/* consumers check `reserved` after reading a record, so it must
+	 * move past the space being overwritten before it is */
+	__atomic_store_n(&shm->reserved, head + skip + need, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	
+	/* records don't wrap, a record that won't fit in the space left
+	 * starts back at the beginning (after a marker, if there's room
+	 * for one) */
+	if (skip) {
+		if (skip >= sizeof(struct webs_fanout_record)) {
+			rec = (struct webs_fanout_record*) (_fan->data + off);
+			rec->len = 0;
+		}
+		
+		head += skip;
+		off = 0;
+	}
+	
+	rec = (struct webs_fanout_record*) (_fan->data + off);
+	rec->seq = seq = shm->next_seq++;
+	rec->len = __webs_make_frame(_data, (char*) (rec + 1), _n, 0x1);
+	
+	head += __WEBS_FANOUT_ALIGN(sizeof(struct webs_fanout_record) + rec->len);
+	__atomic_store_n(&shm->head, head, __ATOMIC_SEQ_CST);
+	
+	pthread_mutex_unlock(&shm->lock);
+	
+	/* only make a system call if a consumer is asleep */
+	__atomic_add_fetch(&shm->wake, 1, __ATOMIC_SEQ_CST);
+	
+	if (__atomic_load_n(&shm->waiters, __ATOMIC_SEQ_CST))
+		__webs_futex_wake(&shm->wake);
+	
+	return seq;
+}
+
+/* 
+ * reads the next record from a fanout ring into a packet.
+ * @param _fan: the consumer's handle.
+ * @param _head: the ring's head, as last read.
+ * @param _dst: a pointer to store the packet.
+ * @param _seq: a pointer to store the frame's sequence number.
+ * @return 1 if a frame was read, 0 if a wrap was skipped, or -1 if the
+ * consumer has been overrun (and the record overwritten).
+ */
+static int __webs_fanout_read(webs_fanout* _fan, uint64_t _head,
+struct webs_packet** _dst, uint64_t* _seq) {
+	struct webs_fanout_record rec;
+	uint64_t size = _fan->shm->size;
+	uint64_t off = _fan->pos % size;
+	
+	*_dst = NULL;
+	
+	if (_head - _fan->pos > size)
+		return -1;
+	
+	/* no room was left for a wrap marker */
+	if (size - off < sizeof(rec)) {
+		_fan->pos += size - off;
+		return 0;
+	}
+	
+	memcpy(&rec, _fan->data + off, sizeof(rec));
+	
+	if (rec.len && rec.len <= size - off - sizeof(rec))
+		*_dst = __webs_copy_packet(_fan->data + off + sizeof(rec), rec.len);
+	
+	/* make sure the copy was taken before checking that the record
+	 * wasn't overwritten meanwhile */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	
+	if (__atomic_load_n(&_fan->shm->reserved, __ATOMIC_SEQ_CST) > _fan->pos + size
+	|| (rec.len && *_dst == NULL)) {
+		free(*_dst);
+		*_dst = NULL;
+		return -1;
+	}
+	
+	if (rec.len == 0) {
+		_fan->pos += size - off;
+		return 0;
+	}
+	
+	*_seq = rec.seq;
+	_fan->pos += __WEBS_FANOUT_ALIGN(sizeof(rec) + rec.len);
+	
+	return 1;
+}
+
+/* 
+ * main function for a fanout ring consumer, broadcasts every frame
+ * published to the ring to its server's clients.
+ * @param _fan: the consumer's handle.
+ */
+static void* __webs_fanout_main(void* _fan) {
+	webs_fanout* fan = (webs_fanout*) _fan;
+	struct webs_fanout_shared* shm = fan->shm;
+	struct webs_packet* pkt;
+	uint64_t head, seq = 0;
+	uint32_t wake;
+	int n;
+	
+	while (!__atomic_load_n(&fan->stopped, __ATOMIC_SEQ_CST)) {
+		wake = __atomic_load_n(&shm->wake, __ATOMIC_SEQ_CST);
+		head = __atomic_load_n(&shm->head, __ATOMIC_SEQ_CST);
+		
+		/* sleep until something is published */
+		if (fan->pos == head) {
+			__atomic_add_fetch(&shm->waiters, 1, __ATOMIC_SEQ_CST);
 			
-			if (*self->srv->events.on_ping)
-				(*self->srv->events.on_ping)(self);
-			
-			else
-				webs_pong(self);
+			if (__atomic_load_n(&shm->head, __ATOMIC_SEQ_CST) == head)
+				__webs_futex_wait(&shm->wake, wake);
 			
+			__atomic_sub_fetch(&shm->waiters, 1, __ATOMIC_SEQ_CST);
 			continue;
 		}
 		
-		/* handle pong */
-		if (WEBSFR_GET_OPCODE(frm.info) == 0xA) {
-			__webs_flush(self->fd, frm.off + frm.length - 2);
-			
-			if (*self->srv->events.on_pong)
-				(*self->srv->events.on_pong)(self);
-		}
-		
-		/* deal with normal frames (non-fragmented) */
-		if (WEBSFR_GET_OPCODE(frm.info) != 0x0) {
-			/* read data */
-			if (data) free(data);
-			data = malloc(frm.length + 1);
-			
-			if (data == NULL)
-				WEBS_XERR("Failed to allocate memory!", ENOMEM);
-			
-			if (__webs_asserted_read(self->fd, data, frm.length) < 0) {
-				error = WEBS_ERR_READ_FAILED;
-				free(data);
-				break;
-			}
-			
-			total = frm.length;
-			__webs_decode_data(data, frm.key, frm.length);
-			
-			if (!WEBSFR_GET_FINISH(frm.info)) {
-				cont = 1;
-				continue;
-			}
-		}
-		
-		/* otherwise deal with fragmentation */
-		else if (cont == 1) {
-			data = realloc(data, total + frm.length);
+		while (fan->pos < head) {
+			n = __webs_fanout_read(fan, head, &pkt, &seq);
 			
-			if (data == NULL)
-				WEBS_XERR("Failed to allocate memory!", ENOMEM);
-			
-			if (__webs_asserted_read(self->fd, data + total,
-			frm.length) < 0) {
-				error = WEBS_ERR_READ_FAILED;
-				free(data);
+			/* overrun, skip ahead to the newest frame */
+			if (n < 0) {
+				pthread_mutex_lock(&fan->lock);
+				fan->stats.overruns++;
+				pthread_mutex_unlock(&fan->lock);
+				
+				fan->pos = __atomic_load_n(&shm->head, __ATOMIC_SEQ_CST);
 				break;
 			}
 			
-			__webs_decode_data(data + total, frm.key, frm.length);
-			
-			total += frm.length;
+			if (n == 0) continue;
 			
-			if (!WEBSFR_GET_FINISH(frm.info))
-				continue;
+			__webs_broadcast_frame(fan->srv, pkt->data, pkt->len,
+				WEBS_PRIO_NORMAL);
+			free(pkt);
 			
-			cont = 0;
-		}
-		
-		/* or if we aren't expecting a continuation frame,
-		 * set error and skip the frame */
-		else {
-			if (*self->srv->events.on_error)
-				(*self->srv->events.on_error)(self,
-					WEBS_ERR_UNEXPECTED_CONTINUTATION);
+			pthread_mutex_lock(&fan->lock);
 			
-			__webs_flush(self->fd, frm.off + frm.length - 2);
-			continue;
-		}
-		
-		/* respond to close */
-		if (WEBSFR_GET_OPCODE(frm.info) == 0x8) {
-			soc_buffer.len = __webs_make_frame(data, soc_buffer.data,
-				frm.length, 0x8);
+			if (seq > fan->seq + 1)
+				fan->stats.missed += seq - fan->seq - 1;
 			
-			send(self->fd, soc_buffer.data, soc_buffer.len, 0);
+			fan->stats.frames++;
+			fan->seq = seq;
 			
-			error = 0;
-			break;
-		}
-		
-		/* call clinet on_data function */
-		data[total] = '\0';
-		
-		if (data) {
-			if (*self->srv->events.on_data)
-				(*self->srv->events.on_data)(self, data, total);
+			pthread_mutex_unlock(&fan->lock);
 		}
-		
-		free(data);
-		
-		data = 0;
-		continue;
 	}
 	
-	/* call client on_error if there was an error */
-	if (error > 0) {
-		if (*self->srv->events.on_error)
-			(*self->srv->events.on_error)(self, error);
-	}
+	return NULL;
+}
+
+int webs_fanout_attach(webs_fanout* _fan, webs_server* _srv) {
+	if (_fan->srv || _srv == NULL)
+		return -1;
 	
-	if (*self->srv->events.on_close)
-		(*self->srv->events.on_close)(self);
+	/* start from the newest frame */
+	__webs_fanout_lock(_fan->shm);
+	_fan->pos = _fan->shm->head;
+	_fan->seq = _fan->shm->next_seq - 1;
+	pthread_mutex_unlock(&_fan->shm->lock);
 	
-	ABORT:
+	_fan->srv = _srv;
 	
-	close(self->fd);
-	__webs_remove_client((struct webs_client_node*) self);
+	if (pthread_create(&_fan->thread, 0, __webs_fanout_main, _fan) != 0) {
+		_fan->srv = NULL;
+		return -1;
+	}
 	
-	return NULL;
+	return 0;
 }
 
-/* 
- * main loop for a server, listens for connections and forks
- * them off for further initialisation.
- * @param _srv: the server that is calling.
- */
-static void* __webs_main(void* _srv) {
-	webs_server* srv = (webs_server*) _srv;
-	webs_client* user_ptr;
-	webs_client user;
+void webs_fanout_get_stats(webs_fanout* _fan, struct webs_fanout_stats* _dst) {
+	uint64_t last = __atomic_load_n(&_fan->shm->next_seq, __ATOMIC_SEQ_CST) - 1;
 	
-	for (;;) {
-		user.fd = __webs_accept_connection(srv->soc, &user);
-		user.srv = srv;
+	pthread_mutex_lock(&_fan->lock);
+	*_dst = _fan->stats;
+	_dst->lag = _fan->srv && last > _fan->seq ? last - _fan->seq : 0;
+	pthread_mutex_unlock(&_fan->lock);
+	
+	return;
+}
+
+void webs_fanout_free(webs_fanout* _fan) {
+	if (_fan->srv) {
+		__atomic_store_n(&_fan->stopped, 1, __ATOMIC_SEQ_CST);
 		
-		if (user.fd >= 0) {
-			user_ptr = __webs_add_client(srv, user);
-			pthread_create(&user_ptr->thread, 0, __webs_client_main, user_ptr);
-		}
+		/* wake the consumer (others just go back to sleep) */
+		__atomic_add_fetch(&_fan->shm->wake, 1, __ATOMIC_SEQ_CST);
+		__webs_futex_wake(&_fan->shm->wake);
+		
+		pthread_join(_fan->thread, NULL);
 	}
 	
-	return NULL;
+	munmap(_fan->shm, sizeof(struct webs_fanout_shared) + _fan->shm->size);
+	close(_fan->fd);
+	pthread_mutex_destroy(&_fan->lock);
+	free(_fan);
+	
+	return;
 }
 
-void webs_eject(webs_client* _self) {
-	if (*_self->srv->events.on_close)
-		(*_self->srv->events.on_close)(_self);
+int webs_flush(webs_client* _self) {
+	int error;
 	
-	close(_self->fd);
-	pthread_cancel(_self->thread);
-	__webs_remove_client((struct webs_client_node*) _self);
+	pthread_mutex_lock(&_self->lock);
+	error = __webs_flush_queue(_self);
+	pthread_mutex_unlock(&_self->lock);
 	
-	return;
+	return error;
 }
 
-void webs_close(webs_server* _srv) {
-	struct webs_client_node* node = _srv->head;
-	struct webs_client_node* temp;
+void webs_get_stats(webs_server* _srv, struct webs_stats* _dst) {
+	struct webs_client_node* node;
 	
-	pthread_cancel(_srv->thread);
-	close(_srv->soc);
+	pthread_mutex_lock(&_srv->lock);
 	
-	while (node) {
-		temp = node->next;
-		webs_eject(&node->client);
-		node = temp;
+	*_dst = _srv->stats;
+	
+	for (node = _srv->head; node; node = node->next) {
+		pthread_mutex_lock(&node->client.lock);
+		__webs_sample_segments(&node->client);
+		__webs_add_stats(_dst, &node->client.stats);
+		pthread_mutex_unlock(&node->client.lock);
 	}
 	
-	free(_srv);
+	pthread_mutex_unlock(&_srv->lock);
 	
 	return;
 }
 
-int webs_send(webs_client* _self, char* _data) {
-	/* general-purpose recv/send buffer */
-	struct webs_buffer soc_buffer = {0};
+void webs_get_latency(webs_server* _srv, struct webs_latency* _dst) {
+	pthread_mutex_lock(&_srv->lock);
+	*_dst = _srv->latency;
+	pthread_mutex_unlock(&_srv->lock);
 	
-	int len = 0;
-	
-	/* check for nullptr or empty string */
-	if (!_data || !*_data) return 0;
-	
-	/* get length of data */
-	while (_data[++len]);
-	
-	/* write data */
-	return write(
-		_self->fd,
-		soc_buffer.data,
-		__webs_make_frame(_data, soc_buffer.data, len, 0x1)
-	);
-	
-	return 0;
+	return;
 }
 
-int webs_sendn(webs_client* _self, char* _data, ssize_t _n) {
-	/* general-purpose recv/send buffer */
-	struct webs_buffer soc_buffer = {0};
+size_t webs_latency_percentile(struct webs_latency* _lat, double _p) {
+	size_t want = (size_t) (_lat->samples * _p / 100);
+	size_t seen = 0;
+	size_t i;
 	
-	/* check for NULL or empty string */
-	if (!_data || !*_data) return 0;
+	if (_lat->samples == 0)
+		return 0;
+	
+	if (want >= _lat->samples)
+		want = _lat->samples - 1;
 	
-	return write(
-		_self->fd,
-		soc_buffer.data,
-		__webs_make_frame(_data, soc_buffer.data, _n, 0x1)
-	);
+	for (i = 0; i < WEBS_LATENCY_BUCKETS; i++) {
+		seen += _lat->buckets[i];
+		if (seen > want) break;
+	}
+	
+	/* report the bucket's upper bound */
+	return i == 0 ? 0 : (size_t) 1 << i;
 }
 
 void webs_pong(webs_client* _self) {
-	webs_sendn(_self, (char*) &WEBS_PONG, 2);
+	__webs_enqueue(_self, __webs_copy_packet((char*) WEBS_PONG, 2));
 	return;
 }
 
 int webs_hold(webs_server* _srv) {
+	webs_runtime* rt;
+	webs_server* srv;
+	size_t id;
+	
 	if (_srv == NULL) return -1;
-	return pthread_join(_srv->thread, 0);
+	
+	if (_srv->runtime == NULL)
+		return pthread_join(_srv->thread, 0);
+	
+	/* the runtime's thread isn't the server's to join. the server may
+	 * be freed once it stops listening, so it is only looked for
+	 * among the runtime's listening servers */
+	rt = _srv->runtime;
+	id = _srv->id;
+	
+	pthread_mutex_lock(&rt->lock);
+	
+	for (;;) {
+		for (srv = rt->servers; srv; srv = srv->rt_next)
+			if (srv == _srv && srv->id == id)
+				break;
+		
+		if (srv == NULL)
+			break;
+		
+		pthread_cond_wait(&rt->stopped, &rt->lock);
+	}
+	
+	pthread_mutex_unlock(&rt->lock);
+	
+	return 0;
 }
 
-webs_server* webs_start(int _port) {
+#ifdef WEBS_TLS
+/* 
+ * creates the OpenSSL context a TLS server's connections are set up
+ * from.
+ * @param _cert: path to a PEM certificate (chain) file.
+ * @param _key: path to the PEM private key for `_cert`.
+ * @return the context, or NULL on error.
+ */
+static SSL_CTX* __webs_tls_context(char* _cert, char* _key) {
+	SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+	
+	if (ctx == NULL)
+		return NULL;
+	
+	/* ask OpenSSL to hand the record layer to the kernel once
+	 * the handshake is done (it quietly falls back if it can't) */
+	#ifdef SSL_OP_ENABLE_KTLS
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+	#endif
+	
+	if (SSL_CTX_use_certificate_chain_file(ctx, _cert) <= 0
+	|| SSL_CTX_use_PrivateKey_file(ctx, _key, SSL_FILETYPE_PEM) <= 0) {
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
+	
+	return ctx;
+}
+#endif
+
+/* 
+ * starts listening on a bound socket.
+ * @param _soc: the socket to listen on (closed on error).
+ * @return the socket, or -1 on error.
+ */
+static int __webs_listen(int _soc) {
+	if (_soc < 0) return -1;
+	
+	if (listen(_soc, WEBS_MAX_BACKLOG) < 0) {
+		close(_soc);
+		return -1;
+	}
+	
+	return _soc;
+}
+
+/* 
+ * creates a server around a listening socket, then forks off its
+ * accept loop.
+ * @param _soc: the socket to accept connections from.
+ * @param _tls: an OpenSSL context for TLS connections, or NULL.
+ * @param _rt: the runtime to accept connections on, or NULL for a
+ * thread of the server's own.
+ * @param _opts: the server's handlers and `user` (see webs_start_with()),
+ * or NULL for none (yet).
+ * @return 0 if the server could not be created, or a pointer
+ * to the newly created server otherwise.
+ */
+static webs_server* __webs_create(int _soc, void* _tls, webs_runtime* _rt,
+struct webs_start_opts* _opts) {
+	struct epoll_event ev;
+	
 	/* static id counter variable */
 	static size_t server_id_counter = 0;
 	
-	const int ONE = 1;
-	int error = 0;
-	
 	webs_server* server = malloc(sizeof(webs_server));
 	
-	/* basic socket setup */
-	int soc = socket(AF_INET, SOCK_STREAM, 0);
-	if (soc < 0) return NULL;
+	if (server == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
 	
-	/* allow reconnection to socket (for sanity) */
-	setsockopt(soc, SOL_SOCKET, SO_REUSEADDR, &ONE, sizeof(int));
+	server->soc = _soc;
+	server->tls = _tls;
+	server->pool = NULL;
+	server->closing = 0;
+	server->park_ms = 0;
+	server->busy_poll_us = 0;
+	server->sample_every = 0;
+	server->max_clients = 0;
+	server->max_handshakes = 0;
+	server->num_handshakes = 0;
+	server->retry_after = 1;
+	sprintf(server->shed_response, WEBS_SHED_FMT, 1);
+	server->http_root = -1;
+	server->http_cache = NULL;
+	server->health_path = NULL;
+	server->health_response = NULL;
+	server->capture = NULL;
+	server->capture_start = 0;
+	server->capture_payloads = 0;
+	pthread_mutex_init(&server->capture_lock, NULL);
+	server->sessions = NULL;
+	server->waiting = server->waiting_tail = NULL;
+	server->num_waiting = 0;
+	server->num_resuming = 0;
+	server->resume_frames = 0;
+	server->resume_bytes = 0;
+	server->resume_ms = 0;
+	pthread_cond_init(&server->resume_cond, NULL);
+	memset(&server->latency, 0, sizeof(struct webs_latency));
+	server->epfd = _rt ? _rt->epfd : -1;
+	server->runtime = _rt;
+	server->rt_next = NULL;
+	server->stopped = 0;
+	server->paused = 0;
+	server->listening = _rt != NULL;
+	server->watch.type = WEBS_WATCH_LISTENER;
+	server->watch.ptr = server;
+	memset(&server->limits, 0, sizeof(struct webs_limits));
+	server->cpus = NULL;
+	server->num_cpus = 0;
+	server->next_cpu = 0;
+	server->max_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	server->cpu_stats = calloc(server->max_cpus, sizeof(struct webs_stats));
 	
-	error = __webs_bind_address(soc, _port);
-	if (error < 0) return NULL;
+	if (server->cpu_stats == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
 	
-	error = listen(soc, WEBS_MAX_BACKLOG);
-	if (error < 0) return NULL;
+	server->head = server->tail = NULL;
+	server->user = _opts ? _opts->user : NULL;
+	server->on_free = _opts ? _opts->on_free : NULL;
+	server->num_clients = 0;
 	
-	server->soc = soc;
+	memset(&server->stats, 0, sizeof(struct webs_stats));
+	pthread_mutex_init(&server->lock, NULL);
+	pthread_cond_init(&server->left, NULL);
 	
 	/* initialise default handlers */
 	server->events.on_error = NULL;
@@ -882,12 +5991,207 @@ webs_server* webs_start(int _port) {
 	server->events.on_close = NULL;
 	server->events.on_pong  = NULL;
 	server->events.on_ping  = NULL;
+	server->events.on_data_batch = NULL;
+	
+	if (_opts && _opts->events)
+		server->events = *_opts->events;
 	
 	server->id = server_id_counter;
 	server_id_counter++;
 	
+	/* a runtime's servers share its thread (and worker pool) */
+	if (_rt) {
+		server->pool = _rt->pool;
+		server->park_ms = WEBS_RUNTIME_PARK_MS;
+		
+		pthread_mutex_lock(&_rt->lock);
+		server->rt_next = _rt->servers;
+		_rt->servers = server;
+		pthread_mutex_unlock(&_rt->lock);
+		
+		fcntl(_soc, F_SETFL, fcntl(_soc, F_GETFL) | O_NONBLOCK);
+		
+		ev.events = EPOLLIN | EPOLLONESHOT;
+		ev.data.ptr = &server->watch;
+		epoll_ctl(_rt->epfd, EPOLL_CTL_ADD, _soc, &ev);
+		
+		return server;
+	}
+	
 	/* fork further processing to seperate thread */
 	pthread_create(&server->thread, 0, __webs_main, server);
 	
 	return server;
 }
+
+webs_server* webs_start(int _port) {
+	return webs_start_at(NULL, _port);
+}
+
+webs_server* webs_start_at(char* _addr, int _port) {
+	struct webs_start_opts opts = {0};
+	
+	opts.addr = _addr;
+	opts.port = _port;
+	
+	return webs_start_with(&opts);
+}
+
+webs_server* webs_start_on(webs_runtime* _rt, int _port,
+struct webs_event_list* _events) {
+	struct webs_start_opts opts = {0};
+	
+	opts.port = _port;
+	opts.runtime = _rt;
+	opts.events = _events;
+	
+	return webs_start_with(&opts);
+}
+
+webs_runtime* webs_runtime_create(size_t _workers, size_t _max_jobs) {
+	webs_runtime* rt = malloc(sizeof(webs_runtime));
+	
+	if (rt == NULL)
+		WEBS_XERR("Failed to allocate memory!", ENOMEM);
+	
+	rt->epfd = epoll_create1(EPOLL_CLOEXEC);
+	
+	if (rt->epfd < 0) {
+		free(rt);
+		return NULL;
+	}
+	
+	rt->pool = _workers ? webs_pool_create(_workers, _max_jobs) : NULL;
+	
+	if (_workers && rt->pool == NULL) {
+		close(rt->epfd);
+		free(rt);
+		return NULL;
+	}
+	
+	rt->servers = NULL;
+	pthread_mutex_init(&rt->lock, NULL);
+	pthread_cond_init(&rt->stopped, NULL);
+	
+	if (pthread_create(&rt->thread, 0, __webs_runtime_main, rt) != 0) {
+		if (rt->pool) webs_pool_free(rt->pool);
+		pthread_mutex_destroy(&rt->lock);
+		pthread_cond_destroy(&rt->stopped);
+		close(rt->epfd);
+		free(rt);
+		return NULL;
+	}
+	
+	return rt;
+}
+
+void webs_runtime_free(webs_runtime* _rt) {
+	pthread_cancel(_rt->thread);
+	pthread_join(_rt->thread, NULL);
+	close(_rt->epfd);
+	
+	if (_rt->pool)
+		webs_pool_free(_rt->pool);
+	
+	pthread_mutex_destroy(&_rt->lock);
+	pthread_cond_destroy(&_rt->stopped);
+	free(_rt);
+	
+	return;
+}
+
+webs_server* webs_start_unix(char* _path) {
+	struct webs_start_opts opts = {0};
+	
+	opts.path = _path;
+	
+	return webs_start_with(&opts);
+}
+
+webs_server* webs_start_inherit(char* _path) {
+	struct sockaddr_un addr = {0};
+	struct msghdr msg = {0};
+	struct cmsghdr* cmsg;
+	struct iovec iov;
+	char ctl[CMSG_SPACE(sizeof(int))];
+	char byte;
+	int fd, soc = -1;
+	
+	if (strlen(_path) >= sizeof(addr.sun_path))
+		return NULL;
+	
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return NULL;
+	
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, _path);
+	
+	if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+		close(fd);
+		return NULL;
+	}
+	
+	/* the listening socket arrives as ancillary data, alongside a
+	 * single byte of normal data */
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl;
+	msg.msg_controllen = sizeof(ctl);
+	
+	if (recvmsg(fd, &msg, 0) > 0) {
+		cmsg = CMSG_FIRSTHDR(&msg);
+		
+		if (cmsg && cmsg->cmsg_level == SOL_SOCKET
+		&& cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(&soc, CMSG_DATA(cmsg), sizeof(int));
+	}
+	
+	close(fd);
+	
+	if (soc < 0) return NULL;
+	
+	return __webs_create(soc, NULL, NULL, NULL);
+}
+
+webs_server* webs_start_tls(int _port, char* _cert, char* _key) {
+	struct webs_start_opts opts = {0};
+	
+	opts.port = _port;
+	opts.cert = _cert;
+	opts.key = _key;
+	
+	return webs_start_with(&opts);
+}
+
+webs_server* webs_start_with(struct webs_start_opts* _opts) {
+	void* tls = NULL;
+	int soc;
+	
+	if (_opts->cert) {
+		#ifdef WEBS_TLS
+			tls = __webs_tls_context(_opts->cert, _opts->key);
+			
+			if (tls == NULL)
+				return NULL;
+		#else
+			return NULL;
+		#endif
+	}
+	
+	if (_opts->path)
+		soc = __webs_listen(__webs_bind_path(_opts->path));
+	
+	else soc = __webs_listen(__webs_bind_address(_opts->addr, _opts->port));
+	
+	if (soc < 0) {
+		#ifdef WEBS_TLS
+			if (tls) SSL_CTX_free(tls);
+		#endif
+		
+		return NULL;
+	}
+	
+	return __webs_create(soc, tls, _opts->runtime, _opts);
+}
@@ -14,6 +14,10 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* 
  * macros to report runtime errors...
  */
@@ -23,15 +27,15 @@
 
 #if __STDC_VERSION__ > 199409L
 	#ifdef NOESCAPE
-		#define WEBS_XERR(MESG, ERR) { printf("Runtime Error: (in "__WEBS_XE_PASTE(__FILE__)", func: %s [line "__WEBS_XE_PASTE(__LINE__)"]) : "MESG"\n", __func__); exit(ERR); }
+		#define WEBS_XERR(MESG, ERR) { printf("Runtime Error: (in " __WEBS_XE_PASTE(__FILE__) ", func: %s [line " __WEBS_XE_PASTE(__LINE__) "]) : " MESG "\n", __func__); exit(ERR); }
 	#else
-		#define WEBS_XERR(MESG, ERR) { printf("\x1b[31m\x1b[1mRuntime Error: \x1b[0m(in "__WEBS_XE_PASTE(__FILE__)", func: \x1b[1m%s\x1b[0m [line \x1b[1m"__WEBS_XE_PASTE(__LINE__)"\x1b[0m]) : "MESG"\n", __func__); exit(ERR); }
+		#define WEBS_XERR(MESG, ERR) { printf("\x1b[31m\x1b[1mRuntime Error: \x1b[0m(in " __WEBS_XE_PASTE(__FILE__) ", func: \x1b[1m%s\x1b[0m [line \x1b[1m" __WEBS_XE_PASTE(__LINE__) "\x1b[0m]) : " MESG "\n", __func__); exit(ERR); }
 	#endif
 #else
 	#ifdef NOESCAPE
-		#define WEBS_XERR(MESG, ERR) { printf("Runtime Error: (in "__WEBS_XE_PASTE(__FILE__)", line "__WEBS_XE_PASTE(__LINE__)") : "MESG"\n"); exit(ERR); }
+		#define WEBS_XERR(MESG, ERR) { printf("Runtime Error: (in " __WEBS_XE_PASTE(__FILE__) ", line " __WEBS_XE_PASTE(__LINE__) ") : " MESG "\n"); exit(ERR); }
 	#else
-		#define WEBS_XERR(MESG, ERR) { printf("\x1b[31m\x1b[1mRuntime Error: \x1b[0m(in "__WEBS_XE_PASTE(__FILE__)", line \x1b[1m"__WEBS_XE_PASTE(__LINE__)"\x1b[0m) : "MESG"\n"); exit(ERR); }
+		#define WEBS_XERR(MESG, ERR) { printf("\x1b[31m\x1b[1mRuntime Error: \x1b[0m(in " __WEBS_XE_PASTE(__FILE__) ", line \x1b[1m" __WEBS_XE_PASTE(__LINE__) "\x1b[0m) : " MESG "\n"); exit(ERR); }
 	#endif
 #endif
 
@@ -46,7 +50,7 @@
 	#define WEBS_BIG_ENDIAN_DWORD(X) X
 	
 	#define WEBS_BIG_ENDIAN_QWORD(X) X
-	
+
 #else
 	
 	#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
@@ -62,7 +66,7 @@
 		(((uint32_t) X << 24) & 0xFF000000UL)))
 	
 	#define WEBS_BIG_ENDIAN_QWORD(X) ( __WEBS_BIG_ENDIAN_QWORD(X) )
-	
+
 #endif
 
 /* 
@@ -77,6 +81,123 @@
  */
 #define WEBS_MAX_PACKET 32768
 #define WEBS_MAX_BACKLOG 8
+#define WEBS_MAX_PATH 256
+
+/* 
+ * number of response headers cached for files served over HTTP (see
+ * webs_serve_files()).
+ */
+#define WEBS_HTTP_CACHE 64
+
+/* 
+ * outbound queue limits, frames are gathered into at most WEBS_MAX_IOV
+ * buffers per write, and a client's queue is written out early once it
+ * holds more than WEBS_MAX_QUEUE bytes. a broadcast waits on a client
+ * that has WEBS_MAX_BEHIND bytes queued in memory (unless conflated).
+ */
+#define WEBS_MAX_IOV 64
+#define WEBS_MAX_QUEUE 65536
+#define WEBS_MAX_BEHIND (4 * 1024 * 1024)
+
+/* 
+ * the most handshake buffers kept spare for each NUMA node (shared by
+ * every server), the most nodes kept apart (higher ones share), and
+ * the most parked connections woken per call to epoll_wait(2).
+ */
+#define WEBS_MAX_SPARE_BUFFERS 16
+#define WEBS_MAX_NODES 8
+#define WEBS_MAX_EVENTS 64
+
+/* 
+ * the most messages handed to a single `on_data_batch` call.
+ */
+#define WEBS_MAX_BATCH 64
+
+/* 
+ * the first bytes of a capture file (see webs_capture_start()), and the
+ * "opcodes" of the records marking a connection's open and close.
+ */
+#define WEBS_CAPTURE_MAGIC "WEBSCAP1"
+#define WEBS_CAPTURE_OPEN 0x10
+#define WEBS_CAPTURE_CLOSE 0x11
+
+/* 
+ * session resumption (see webs_enable_resume()): the length of a
+ * resume token (in hex digits), the number of buckets sessions are
+ * looked up in, and the most sessions left waiting to be resumed.
+ */
+#define WEBS_RESUME_TOKEN 32
+#define WEBS_RESUME_BUCKETS 1024
+#define WEBS_RESUME_MAX_WAITING 4096
+
+/* 
+ * number of (power of two) buckets in a latency histogram.
+ */
+#define WEBS_LATENCY_BUCKETS 32
+
+/* 
+ * the `park_ms` given to servers started on a runtime.
+ */
+#define WEBS_RUNTIME_PARK_MS 100
+
+/* 
+ * kinds of descriptor watched by epoll(7).
+ */
+#define WEBS_WATCH_CLIENT 0
+#define WEBS_WATCH_LISTENER 1
+
+/* 
+ * flags recording which directions of a TLS connection have been
+ * handed to the kernel (kTLS), in which case plain read(2)/sendmsg(2)
+ * calls on the descriptor carry unencrypted data.
+ */
+#define WEBS_KTLS_TX 0x1
+#define WEBS_KTLS_RX 0x2
+
+/* 
+ * the most data packed into one TLS record written through OpenSSL.
+ */
+#define WEBS_TLS_RECORD 16384
+
+/* 
+ * connection states, a client only recieves broadcasts once open.
+ */
+#define WEBS_STATE_HANDSHAKE 0
+#define WEBS_STATE_OPEN 1
+#define WEBS_STATE_CLOSING 2
+
+/* 
+ * close frame status codes (RFC-6455, section 7.4.1).
+ */
+#define WEBS_CLOSE_NORMAL 1000
+#define WEBS_CLOSE_GOING_AWAY 1001
+#define WEBS_CLOSE_POLICY 1008
+
+/* 
+ * what happens to a client that goes over its rate limits.
+ */
+#define WEBS_LIMIT_PAUSE 0 /* stop reading from it until it is within them */
+#define WEBS_LIMIT_CLOSE 1 /* close the connection (status 1008) */
+
+/* 
+ * outbound priority classes. control frames are always urgent, and
+ * urgent frames are written before any queued normal ones.
+ */
+#define WEBS_PRIO_NORMAL 0
+#define WEBS_PRIO_URGENT 1
+
+/* 
+ * flags for placing frames in a client's outbound queue.
+ */
+#define WEBS_QUEUE_FRAGMENT 0x1 /* part of the message being streamed */
+#define WEBS_QUEUE_NOWAIT 0x2   /* never wait on the connection (what it
+                                 *   can't take is left to the poller) */
+
+/* 
+ * seconds that webs_drain() waits for clients to reply to its close
+ * frames before hanging up on them.
+ */
+#define WEBS_DRAIN_TIMEOUT 5
 
 /* 
  * maximum packet recieve size is SSIZE_MAX.
@@ -104,6 +225,28 @@
  */
 #define WEBS_RESPONSE_FMT "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n"
 
+/* 
+ * header ending the response to a client with a session, giving its
+ * resume token.
+ */
+#define WEBS_RESUME_FMT "Webs-Resume: %s\r\n\r\n"
+
+/* 
+ * HTTP response used to turn connections away while a server is at
+ * capacity (see webs_set_admission()).
+ */
+#define WEBS_SHED_FMT "HTTP/1.1 503 Service Unavailable\r\nRetry-After: %d\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+
+/* 
+ * HTTP responses to requests that aren't websocket handshakes (see
+ * webs_serve_files() and webs_set_health()).
+ */
+#define WEBS_HTTP_FILE_FMT "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %lu\r\nETag: %s\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n"
+#define WEBS_HTTP_UNCHANGED_FMT "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nConnection: close\r\n\r\n"
+#define WEBS_HTTP_HEALTH_FMT "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %lu\r\nCache-Control: no-store\r\nConnection: close\r\n\r\n%s"
+#define WEBS_HTTP_NOT_FOUND "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+#define WEBS_HTTP_BAD_REQUEST "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+
 /* 
  * macro to convert an integer to its base-64 representation.
  */
@@ -121,6 +264,10 @@
 
 typedef struct webs_server webs_server;
 typedef struct webs_client webs_client;
+typedef struct webs_ring webs_ring;
+typedef struct webs_pool webs_pool;
+typedef struct webs_runtime webs_runtime;
+typedef struct webs_fanout webs_fanout;
 
 /* 
  * list of errors passed to `on_error`
@@ -130,7 +277,8 @@ enum webs_error {
 	WEBS_ERR_READ_FAILED,
 	WEBS_ERR_UNEXPECTED_CONTINUTATION,
 	WEBS_ERR_NO_SUPPORT,
-	WEBS_ERR_OVERFLOW
+	WEBS_ERR_OVERFLOW,
+	WEBS_ERR_RATE_LIMITED
 };
 
 /* 
@@ -151,16 +299,217 @@ struct webs_info {
 	char webs_key[24 + 1]; /* websocket key (base-64 encoded string) */
 	uint16_t webs_vrs;     /* websocket version (integer) */
 	uint16_t http_vrs;     /* HTTP version (concatonated chars) */
+	char path[WEBS_MAX_PATH]; /* the request's target */
+	char etag[64];         /* its If-None-Match header (if any) */
+	char resume[WEBS_RESUME_TOKEN + 1]; /* token of the session to be
+	                                     *   resumed (if any) */
+	size_t resume_seen;    /* messages the client received in it */
 };
 
 /* 
  * used for sending / receiving data.
  */
 struct webs_buffer {
+	struct webs_buffer* next; /* link in the pool of spare buffers */
 	char data[WEBS_MAX_PACKET];
 	ssize_t len;
 };
 
+/* 
+ * the spare buffers kept for a NUMA node.
+ */
+struct webs_spares {
+	pthread_mutex_t lock;
+	struct webs_buffer* head;
+	size_t count;
+};
+
+/* 
+ * a file shared by the packets that send (part of) it.
+ */
+struct webs_file {
+	pthread_mutex_t lock;
+	size_t refs; /* number of packets that refer to the file */
+	int fd;      /* the library's own duplicate of the descriptor */
+};
+
+/* 
+ * the cached response header for a file served over HTTP, kept for as
+ * long as the file is unchanged.
+ */
+struct webs_http_file {
+	char path[WEBS_MAX_PATH]; /* path within the served directory */
+	dev_t dev;                /* identifies the version of the file */
+	ino_t ino;                /*   that the header was built for */
+	time_t mtime;
+	off_t size;
+	char etag[48];
+	char header[256];
+	size_t len;               /* length of `header` */
+};
+
+/* 
+ * an encoded frame waiting in a client's outbound queue.
+ */
+struct webs_packet {
+	struct webs_packet* next;
+	struct webs_file* file; /* file holding the rest of the frame's
+	                         *   payload (or NULL if none) */
+	off_t file_off;         /* start of the payload within `file` */
+	size_t file_len;        /* number of payload bytes in `file` */
+	size_t len;             /* length of the data held in `data` */
+	size_t off;             /* number of bytes already written */
+	size_t key;             /* the frame's key, if it is `keyed` */
+	int keyed;              /* set if a newer frame with the same key
+	                         *   replaces this one while it is unsent */
+	char data[1];           /* the encoded frame (or just its header
+	                         *   if `file` is set) */
+};
+
+/* 
+ * a client's outbound queue.
+ */
+struct webs_queue {
+	struct webs_packet* head;
+	struct webs_packet* tail;
+	size_t num_bytes; /* bytes waiting to be written */
+	size_t file_bytes; /* of which are read from files as they are */
+};
+
+/* 
+ * traffic counters, kept per client and totalled per server.
+ */
+struct webs_stats {
+	size_t conns;       /* connections accepted */
+	size_t msgs_in;     /* messages recieved */
+	size_t bytes_in;    /* payload bytes recieved */
+	size_t msgs_out;    /* frames queued for sending */
+	size_t bytes_out;   /* bytes written to sockets */
+	size_t write_calls; /* calls made to sendmsg(2) */
+	size_t segs_out;    /* TCP segments carrying data (from TCP_INFO) */
+	size_t jobs;        /* messages handled by a worker pool */
+	size_t job_wait_us; /* total time jobs spent waiting for a worker */
+	size_t job_wait_max_us; /* longest time a job waited for a worker */
+	size_t throttled;   /* frames that arrived over a rate limit */
+	size_t throttle_us; /* total time reading was paused by rate limits */
+	size_t parks;       /* times an idle connection was parked */
+	size_t shed;        /* connections turned away at capacity */
+	size_t deferred;    /* times accepting was delayed at capacity */
+	size_t conflated;   /* unsent frames replaced by newer ones */
+	size_t busy_polls;  /* reads whose data arrived while spinning */
+	size_t busy_us;     /* time spent spinning, in microseconds */
+};
+
+/* 
+ * per-client rate limits, checked as each frame's header is parsed
+ * (before its payload is read). every frame (including control
+ * frames) costs one message, plus its payload length in bytes.
+ */
+struct webs_limits {
+	size_t msgs;       /* frames per second (0 for no limit) */
+	size_t bytes;      /* payload bytes per second (0 for no limit) */
+	size_t msg_burst;  /* frames allowed at once (0 for `msgs`) */
+	size_t byte_burst; /* bytes allowed at once (0 for `bytes`) */
+	int action;        /* WEBS_LIMIT_PAUSE or WEBS_LIMIT_CLOSE */
+};
+
+/* 
+ * a token bucket, refilled as time passes and drained by each frame.
+ */
+struct webs_bucket {
+	double tokens;
+	size_t last_us;    /* when the bucket was last refilled */
+};
+
+/* 
+ * identifies what a descriptor watched by epoll(7) belongs to.
+ */
+struct webs_watch {
+	int type;  /* WEBS_WATCH_CLIENT or WEBS_WATCH_LISTENER */
+	void* ptr; /* the client, or server */
+};
+
+/* 
+ * times (in microseconds, CLOCK_MONOTONIC) at which a sampled message
+ * reached each stage of its handling. `start` is 0 if the message
+ * isn't sampled.
+ */
+struct webs_trace {
+	size_t start; /* its first frame header was parsed */
+	size_t read;  /* its last payload byte was read and unmasked */
+	size_t enter; /* its handler was called */
+	size_t exit;  /* its handler returned */
+	size_t done;  /* the frames its handler sent were written */
+};
+
+/* 
+ * a histogram of end-to-end message latencies (from the first frame
+ * header being parsed to the handler's replies being written), with
+ * the time spent in each stage along the way.
+ */
+struct webs_latency {
+	size_t samples;    /* messages timed */
+	size_t read_us;    /* total time reading (and unmasking) messages */
+	size_t wait_us;    /* total time waiting for a worker pool */
+	size_t handler_us; /* total time spent in handlers */
+	size_t write_us;   /* total time writing handlers' replies */
+	size_t max_us;     /* longest end-to-end time */
+	size_t buckets[WEBS_LATENCY_BUCKETS]; /* bucket `i` counts samples
+	                                       *   taking under 2^i us */
+};
+
+/* 
+ * a message handed to `on_data_batch`.
+ */
+struct webs_msg {
+	char* data;  /* the message (followed by a NUL) */
+	size_t len;  /* number of bytes in the message */
+};
+
+/* 
+ * a record in a capture file, followed by the message's payload if
+ * `payload` is set. records are written in the host's byte order.
+ */
+struct webs_capture_record {
+	uint64_t time_us;  /* when the message was read, in microseconds
+	                    *   since the capture started */
+	uint32_t conn;     /* the client's id */
+	uint32_t len;      /* the message's length */
+	uint8_t op;        /* its opcode (or WEBS_CAPTURE_OPEN/CLOSE) */
+	uint8_t payload;   /* set if the payload follows the record */
+	uint8_t pad[6];
+};
+
+/* 
+ * a resumable session (see webs_enable_resume()), which outlives its
+ * client's connection for a while, holding the data frames most
+ * recently written to it.
+ */
+struct webs_session {
+	struct webs_session* next;  /* link in its bucket of the server's
+	                             *   table */
+	struct webs_session* older; /* links in the server's list of */
+	struct webs_session* newer; /*   sessions waiting to be resumed */
+	char token[WEBS_RESUME_TOKEN + 1];
+	webs_ring* ring;            /* frames written to the session, whose
+	                             *   sequence numbers count its messages */
+	struct webs_client* client; /* client connected to the session (or
+	                             *   NULL while it waits to be resumed) */
+	size_t left;                /* when its client left, in microseconds */
+};
+
+/* 
+ * an `on_data` call waiting to be run by a worker pool.
+ */
+struct webs_job {
+	struct webs_job* next;
+	size_t queued;          /* when the job was queued (in
+	                         *   microseconds, CLOCK_MONOTONIC) */
+	char* data;             /* the message (freed after the call) */
+	ssize_t len;            /* length of the message */
+	struct webs_trace trace; /* the message's timings (if sampled) */
+};
+
 /* 
  * user-implemented event handlers.
  */
@@ -171,6 +520,26 @@ struct webs_event_list {
 	int (*on_close)(struct webs_client*);
 	int (*on_pong)(struct webs_client*);
 	int (*on_ping)(struct webs_client*);
+	int (*on_data_batch)(struct webs_client*, const struct webs_msg*, size_t);
+};
+
+/* 
+ * where and how webs_start_with() starts a server (zero anything that
+ * isn't wanted).
+ */
+struct webs_start_opts {
+	char* addr;                     /* numeric address to listen on, or
+	                                 *   NULL for every IPv4 address */
+	int port;                       /* port to listen on */
+	char* path;                     /* unix socket to listen on instead
+	                                 *   of a port, or NULL */
+	char* cert;                     /* PEM certificate (chain) file for
+	                                 *   TLS, or NULL for none */
+	char* key;                      /* PEM private key for `cert` */
+	webs_runtime* runtime;          /* runtime to start on, or NULL */
+	struct webs_event_list* events; /* handlers (copied), or NULL */
+	void* user;                     /* the server's `user` */
+	void (*on_free)(void*);         /* the server's `on_free` */
 };
 
 /* 
@@ -179,12 +548,186 @@ struct webs_event_list {
 struct webs_client {
 	struct webs_server* srv; /* a pointer to the server the the
 	                          *   clinet is connected to */
-	struct sockaddr_in addr; /* client address */
+	struct sockaddr_storage addr; /* client address (any family) */
+	struct webs_queue out;   /* frames waiting to be sent */
+	struct webs_queue urgent; /* frames sent ahead of `out` (control
+	                          *   frames, and urgent messages) */
+	int mid_message;         /* set while the last data frame written
+	                          *   from `out` wasn't final */
+	int writing;             /* set while the server's poller writes
+	                          *   out a backlog of conflated frames */
+	size_t refs;             /* references taken by broadcasts that are
+	                          *   queueing frames for the client */
+	pthread_cond_t written;  /* signalled when the backlog is done
+	                          *   with, and as references are dropped */
+	struct webs_queue held;  /* data frames held back until the message
+	                          *   being streamed ends */
+	int stream_op;           /* opcode of the next fragment of the message
+	                          *   being streamed (or -1 if none) */
+	struct webs_stats stats; /* client's traffic counters */
+	pthread_mutex_t lock;    /* guards `out` and outbound stats */
 	pthread_t thread;        /* client's posix thread id */
+	void* ssl;               /* OpenSSL session (NULL if not TLS) */
+	int tls_flags;           /* WEBS_KTLS_* flags */
+	char* tls_buf;           /* the record being written through */
+	size_t tls_len;          /*   OpenSSL, and its length (0 once
+	                          *   it has been written) */
+	
+	/* worker pool state (guarded by the pool's lock, which may be
+	 * taken while holding the client's lock) */
+	struct webs_job* jobs;      /* messages waiting to be handled */
+	struct webs_job* jobs_tail;
+	size_t num_jobs;            /* jobs queued or running */
+	int scheduled;              /* set while in (or running from) the
+	                             *   pool's run queue */
+	int stalled;                /* set while the client's jobs are held
+	                             *   back, as it is too far behind */
+	struct webs_client* next_ready; /* link in the pool's run queue */
+	pthread_cond_t drained;     /* signalled as jobs complete */
+	pthread_t worker;           /* worker running one of the client's */
+	int working;                /*   jobs, if `working` is set */
+	
+	struct webs_bucket msg_bucket;  /* rate limit state (see */
+	struct webs_bucket byte_bucket; /*   `webs_server.limits`) */
+	
+	int state;               /* WEBS_STATE_* */
+	int cpu;                 /* CPU the client is placed on (or -1) */
+	int parked;              /* set while the client has no thread */
+	struct webs_buffer* rbuf; /* frames read ahead, while messages are
+	                          *   batched (see `on_data_batch`) */
+	size_t rbuf_off;         /* bytes of `rbuf` already consumed */
+	struct webs_watch watch; /* identifies the client to epoll(7) */
+	int ejected;             /* set once the client has been ejected */
+	struct webs_session* session; /* the client's session (or NULL, see
+	                               *   webs_enable_resume()) */
+	int resumed;             /* set if it resumed an earlier session */
+	int resuming;            /* set while it is sent what the session
+	                          *   missed, before it opens (guarded by
+	                          *   the server's lock) */
+	size_t resume_seq;       /* last message of the session sent to it
+	                          *   while resuming */
+	void* user;              /* left to handlers (NULL to begin with) */
 	size_t id;               /* client's internal id */
 	int fd;                  /* client's descriptor */
 };
 
+/* 
+ * an encoded frame held in a replay ring.
+ */
+struct webs_ring_entry {
+	size_t seq; /* the frame's sequence number */
+	size_t off; /* offset of the frame within the ring's data */
+	size_t len; /* length of the encoded frame */
+};
+
+/* 
+ * a bounded buffer holding the most recently published frames (for
+ * a topic, or a whole server), so that they can be replayed to clients
+ * that join late without being encoded again.
+ */
+struct webs_ring {
+	pthread_mutex_t lock;
+	struct webs_ring_entry* entries; /* circular list, oldest first */
+	char* data;                      /* the encoded frames */
+	size_t max_frames;               /* capacity of `entries` */
+	size_t size;                     /* size of `data` in bytes */
+	size_t first;                    /* index of the oldest entry */
+	size_t count;                    /* number of entries in use */
+	size_t write_off;                /* where the next frame goes */
+	size_t next_seq;                 /* sequence number of the next frame */
+	int fd;                          /* backing file (or -1 if none) */
+	int prio;                        /* class the ring's frames are sent
+	                                  *   in (WEBS_PRIO_NORMAL) */
+};
+
+/* 
+ * the shared part of a fanout ring, at the start of its mapping (and
+ * followed by its records). publishers take `lock`, consumers never
+ * write to the mapping except to wait on `wake`.
+ */
+struct webs_fanout_shared {
+	uint64_t size;          /* bytes of records following the header */
+	uint64_t head;          /* end of the last published record (every
+	                         *   position counts bytes ever written) */
+	uint64_t reserved;      /* end of the record being written */
+	uint64_t next_seq;      /* sequence number of the next frame */
+	uint32_t wake;          /* bumped on each publish (a futex) */
+	uint32_t waiters;       /* consumers waiting on `wake` */
+	pthread_mutex_t lock;   /* process-shared, robust */
+};
+
+/* 
+ * a record in a fanout ring, followed by its encoded frame. records
+ * are 8-byte aligned, and one with a `len` of 0 marks a wrap.
+ */
+struct webs_fanout_record {
+	uint64_t seq;
+	uint32_t len;
+	uint32_t pad;
+};
+
+/* 
+ * a fanout ring consumer's counters.
+ */
+struct webs_fanout_stats {
+	size_t frames;   /* frames broadcast to the server's clients */
+	size_t lag;      /* frames published, but not yet broadcast */
+	size_t overruns; /* times the consumer fell a whole ring behind */
+	size_t missed;   /* frames skipped as a result */
+};
+
+/* 
+ * a process's handle on a fanout ring, a shared-memory (memfd) ring of
+ * encoded frames that any process mapping it can publish to, and that
+ * each process can broadcast to the clients of one of its servers.
+ */
+struct webs_fanout {
+	struct webs_fanout_shared* shm;
+	char* data;              /* records (after the shared header) */
+	int fd;                  /* the ring's memfd */
+	webs_server* srv;        /* server frames are broadcast to (or NULL
+	                          *   if the handle only publishes) */
+	pthread_t thread;        /* consumer thread */
+	pthread_mutex_t lock;    /* guards `stats` and `seq` */
+	uint64_t pos;            /* consumer's read position */
+	uint64_t seq;            /* last sequence number consumed */
+	int stopped;             /* set when the consumer should exit */
+	struct webs_fanout_stats stats;
+};
+
+/* 
+ * a pool of threads that run `on_data` handlers on behalf of one or
+ * more servers, so that slow handlers don't hold up reading. each
+ * client's messages are handled one at a time and in order, but
+ * different clients are handled in parallel.
+ */
+struct webs_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t ready;           /* signalled when a client is queued */
+	struct webs_client* head;       /* clients with jobs waiting */
+	struct webs_client* tail;
+	pthread_t* threads;
+	size_t num_threads;
+	size_t max_jobs;                /* most jobs held per client before
+	                                 *   reading from it is paused */
+	int stop;
+};
+
+/* 
+ * a thread (and optional worker pool) shared by several servers. the
+ * runtime's thread accepts connections for all of them, and wakes
+ * their parked connections.
+ */
+struct webs_runtime {
+	int epfd;         /* watches every server's socket, and every
+	                   *   parked (or backed up) connection */
+	pthread_t thread;
+	webs_pool* pool;  /* given to each server started on the runtime */
+	struct webs_server* servers; /* servers still listening on it */
+	pthread_mutex_t lock;        /* guards `servers` */
+	pthread_cond_t stopped;      /* signalled as servers stop listening */
+};
+
 /* 
  * holds information relevant to a server.
  */
@@ -192,6 +735,72 @@ struct webs_server {
 	struct webs_event_list events;
 	struct webs_client_node* head;
 	struct webs_client_node* tail;
+	struct webs_stats stats; /* totals for clients that have left */
+	pthread_mutex_t lock;    /* guards the client list and `stats` */
+	pthread_cond_t left;     /* signalled as clients leave (or finish
+	                          *   their handshakes) */
+	void* tls;               /* OpenSSL context (NULL if not TLS) */
+	webs_pool* pool;         /* runs `on_data` handlers (NULL to run
+	                          *   them on each client's own thread) */
+	int closing;             /* set once webs_close() has been called */
+	struct webs_limits limits; /* per-client rate limits (none by default) */
+	size_t busy_poll_us;     /* spin for this long before a read blocks
+	                          *   (0 for never) */
+	size_t park_ms;          /* park connections idle for this long, so
+	                          *   that they hold no thread (0 for never) */
+	size_t max_clients;      /* admission control (see */
+	size_t max_handshakes;   /*   webs_set_admission()) */
+	size_t num_handshakes;   /* handshakes in progress */
+	int retry_after;
+	char shed_response[128]; /* pre-built 503 response */
+	int http_root;           /* directory served to plain HTTP requests
+	                          *   (or -1, see webs_serve_files()) */
+	struct webs_http_file* http_cache; /* headers of files served
+	                                    *   (guarded by `lock`) */
+	char* health_path;       /* path answered with `health_response` */
+	char* health_response;   /*   (NULL for none, see webs_set_health()) */
+	FILE* capture;           /* records inbound traffic (or NULL, see */
+	pthread_mutex_t capture_lock; /* webs_capture_start()) */
+	size_t capture_start;    /* when the capture started, in microseconds */
+	int capture_payloads;    /* set if payloads are recorded too */
+	struct webs_session** sessions; /* resumable sessions, by token (NULL
+	                                 *   unless webs_enable_resume() has
+	                                 *   been called, guarded by `lock`) */
+	struct webs_session* waiting; /* sessions waiting to be resumed, */
+	struct webs_session* waiting_tail; /*   oldest first */
+	size_t num_waiting;
+	size_t num_resuming;     /* clients `resuming` their sessions */
+	size_t resume_frames;    /* most frames, and bytes, held for */
+	size_t resume_bytes;     /*   each session */
+	size_t resume_ms;        /* how long a session waits to be resumed */
+	pthread_t resume_thread; /* expires sessions that have waited too */
+	pthread_cond_t resume_cond; /* long (and is woken by this) */
+	size_t sample_every;     /* time every Nth message from each client
+	                          *   end to end (0 for none) */
+	struct webs_latency latency; /* sampled timings (guarded by `lock`) */
+	int epfd;                /* epoll(7) instance watching parked (and
+	                          *   backed up) connections (or -1 until
+	                          *   needed) */
+	pthread_t park_thread;   /* thread waiting on `epfd` */
+	webs_runtime* runtime;   /* runtime the server was started on (or
+	                          *   NULL if it has threads of its own) */
+	struct webs_server* rt_next; /* the runtime's next listening server */
+	struct webs_watch watch; /* identifies the server to epoll(7) */
+	int stopped;             /* set once the server stops accepting */
+	int paused;              /* set while a runtime isn't accepting for
+	                          *   the server, as it is at capacity */
+	int listening;           /* set while a runtime watches `soc` */
+	int* cpus;               /* CPUs that client threads are pinned to */
+	size_t num_cpus;         /*   (none if `num_cpus` is 0) */
+	size_t next_cpu;         /* next CPU to place a client on, when the
+	                          *   one that recieved it isn't in `cpus` */
+	size_t max_cpus;         /* number of CPUs in the system */
+	struct webs_stats* cpu_stats; /* per-CPU totals for clients that
+	                               *   have left */
+	void* user;              /* left to handlers (NULL to begin with) */
+	void (*on_free)(void*);  /* called with `user` once the server has
+	                          *   been freed, after its last handler
+	                          *   has returned (NULL for none) */
 	size_t num_clients;
 	pthread_t thread;
 	size_t id;
@@ -225,22 +834,54 @@ extern uint8_t WEBS_PONG[2];
  * checks a client out of the server to which it is connected.
  * @param _self: the client to be ejected.
  * @note for user functions, passing self (a webs_client pointer) is suffice.
+ * @note the connection is shut down straight away, but the client is
+ * only freed (after `on_close` is called) once its thread notices.
  */
 void webs_eject(webs_client* _self);
 
 /**
- * closes a websocket server.
+ * closes a websocket server, sending each open client a close frame
+ * (as far as its connection takes it without waiting) before hanging
+ * up on it.
  * @param _srv: the server that is to be shut down.
+ * @note the server is freed once its last client has left.
  */
 void webs_close(webs_server* _srv);
 
+/**
+ * passes a server's listening socket to a new process (which calls
+ * webs_start_inherit()), so that it can start accepting connections
+ * without the port ever being closed. blocks until the new process
+ * has connected.
+ * @param _srv: the server whose socket is to be handed off.
+ * @param _path: the unix socket path to wait for the new process on.
+ * @note the server keeps accepting connections too, until it is
+ * drained (see webs_drain()) or closed.
+ * @return -1 on error, or 0 otherwise.
+ */
+int webs_handoff(webs_server* _srv, char* _path);
+
+/**
+ * gradually shuts a server down. it stops accepting connections,
+ * then sends each client a close frame (status 1001, "going away")
+ * at a limited rate, so that they don't all reconnect at once. once
+ * every client has left (or WEBS_DRAIN_TIMEOUT seconds after the last
+ * close frame) the server is closed, as with webs_close().
+ * @param _srv: the server to be drained.
+ * @param _rate: the most clients to close per second (0 for no limit).
+ */
+void webs_drain(webs_server* _srv, size_t _rate);
+
 /**
  * user function used to send null-terminated data over a
  * websocket.
  * @param _self: the client who is sending the data.
  * @param _data: a pointer to the null-terminated data
  * that is to be sent.
- * @return the result of the write.
+ * @note frames sent from a client's own handlers are queued and
+ * written together once the handler returns, frames sent from any
+ * other thread are written immediately.
+ * @return the size of the queued frame, or -1 on error.
  */
 int webs_send(webs_client* _self, char* _data);
 
@@ -249,22 +890,384 @@ int webs_send(webs_client* _self, char* _data);
  * @param _self: the client who is sending the data.
  * @param _data: a pointer to the data to is to be sent.
  * @param _n: the number of bytes that are to be sent.
- * @return the result of the write.
+ * @note queued in the same way as webs_send().
+ * @return the size of the queued frame, or -1 on error.
  */
 int webs_sendn(webs_client* _self, char* _data, ssize_t _n);
 
+/**
+ * sends data to a client in a given priority class. urgent frames are
+ * written ahead of any normal ones still queued for the client (but
+ * never partway through a frame, or a fragmented message).
+ * @param _self: the client who is sending the data.
+ * @param _data: a pointer to the data to is to be sent.
+ * @param _n: the number of bytes that are to be sent.
+ * @param _op: the message's opcode (0x1 for text, 0x2 for binary).
+ * @param _prio: WEBS_PRIO_NORMAL or WEBS_PRIO_URGENT.
+ * @note queued in the same way as webs_send(). unlike webs_sendn(), data
+ * that starts with a 0 byte is still sent.
+ * @return the size of the queued frame, or -1 on error (or if `_op` is
+ * invalid).
+ */
+int webs_send_prio(webs_client* _self, char* _data, ssize_t _n, int _op,
+	int _prio);
+
+/**
+ * starts streaming a message to a client, whose data is then sent a
+ * chunk at a time (as fragmented frames) with webs_send_chunk(), so
+ * that it never needs to be held in memory all at once. control
+ * frames (pings, pongs and closes) may still be sent in the meantime,
+ * while other data frames are held back until webs_send_end().
+ * @param _self: the client who is to be sent the message.
+ * @param _op: the message's opcode (0x1 for text, 0x2 for binary).
+ * @return -1 if a message is already being streamed to the client
+ * (or `_op` is invalid), or 0 otherwise.
+ */
+int webs_send_begin(webs_client* _self, int _op);
+
+/**
+ * sends the next part of a message started with webs_send_begin().
+ * @param _self: the client who is being sent the message.
+ * @param _data: a pointer to the data to is to be sent.
+ * @param _n: the number of bytes that are to be sent.
+ * @note queued in the same way as webs_send().
+ * @return the size of the queued frame, or -1 on error.
+ */
+int webs_send_chunk(webs_client* _self, char* _data, size_t _n);
+
+/**
+ * finishes a message started with webs_send_begin().
+ * @param _self: the client who is being sent the message.
+ * @return -1 on error, or 0 otherwise.
+ */
+int webs_send_end(webs_client* _self);
+
+/**
+ * sends part of a file as a binary message, without reading the
+ * data into memory (the kernel copies it straight to the socket
+ * with sendfile(2) where possible).
+ * @param _self: the client who is sending the data.
+ * @param _fd: a descriptor for the file (it is duplicated, so the
+ * caller may close theirs straight away).
+ * @param _off: the offset of the data within the file.
+ * @param _n: the number of bytes that are to be sent.
+ * @note queued in the same way as webs_send().
+ * @return -1 on error, or 0 otherwise.
+ */
+int webs_send_file(webs_client* _self, int _fd, off_t _off, size_t _n);
+
+/**
+ * sends part of a file to every client connected to a server, as
+ * with webs_send_file(), without waiting on any client's connection
+ * (the data is read from the file as each connection drains).
+ * @param _srv: the server whose clients are to be sent the data.
+ * @param _fd: a descriptor for the file (it is duplicated, and
+ * shared by all of the clients).
+ * @param _off: the offset of the data within the file.
+ * @param _n: the number of bytes that are to be sent.
+ * @return the number of clients the data was queued for, or -1
+ * on error.
+ */
+int webs_broadcast_file(webs_server* _srv, int _fd, off_t _off, size_t _n);
+
+/**
+ * creates a replay ring, which keeps the most recently published
+ * frames so they can be sent to clients that join late.
+ * @param _frames: the most frames the ring may hold.
+ * @param _bytes: the most bytes of encoded frames the ring may hold.
+ * @param _path: a file to back the ring's data with (useful for
+ * rings too large to keep in memory), or NULL to use memory.
+ * @return a pointer to the new ring, or NULL on error.
+ */
+webs_ring* webs_ring_create(size_t _frames, size_t _bytes, char* _path);
+
+/**
+ * frees a replay ring (the backing file, if any, is left in place).
+ * @param _ring: the ring to be freed.
+ */
+void webs_ring_free(webs_ring* _ring);
+
+/**
+ * encodes a text frame once, keeps it in a replay ring and sends it
+ * to every client connected to a server. the publisher doesn't wait on
+ * a client's connection (whatever it can't take yet is written as it
+ * drains) until the client is WEBS_MAX_BEHIND bytes behind.
+ * @param _srv: the server whose clients are to be sent the frame
+ * (or NULL to only add it to the ring).
+ * @param _ring: the ring to keep the frame in (or NULL for none).
+ * @param _data: a pointer to the data that is to be sent.
+ * @param _n: the number of bytes that are to be sent.
+ * @return the frame's sequence number in the ring (these start
+ * at 1), or 0 if the frame wasn't added to a ring.
+ */
+size_t webs_publish(webs_server* _srv, webs_ring* _ring, char* _data,
+ssize_t _n);
+
+/**
+ * sends a client every frame still held in a replay ring that was
+ * published after a given sequence number.
+ * @param _self: the client to be sent the frames.
+ * @param _ring: the ring to be replayed.
+ * @param _since: the sequence number of the last frame the client
+ * has seen (0 to send everything held).
+ * @note if fewer frames are sent than were published since `_since`,
+ * the rest have already been evicted from the ring.
+ * @return the number of frames queued, or -1 on error.
+ */
+int webs_replay(webs_client* _self, webs_ring* _ring, size_t _since);
+
+/**
+ * sends a text frame to every client connected to a server, replacing
+ * any frame with the same key that is still waiting to be sent to a
+ * client. a client that can't keep up is only ever sent the newest
+ * frame for each key, and the publisher never waits for it (the rest
+ * is written as the client's connection drains).
+ * @param _srv: the server whose clients are to be sent the frame.
+ * @param _key: the frame's key (e.g. an instrument's id).
+ * @param _data: a pointer to the data that is to be sent.
+ * @param _n: the number of bytes that are to be sent.
+ * @return the number of clients the frame was queued for.
+ */
+int webs_publish_latest(webs_server* _srv, size_t _key, char* _data,
+ssize_t _n);
+
+/**
+ * creates a fanout ring in shared memory (a memfd), through which
+ * several processes can publish frames to each other's clients. the
+ * ring is mapped by processes forked after it is created, others can
+ * map it with webs_fanout_open() given its `fd` (e.g. passed over a
+ * unix socket, or inherited across exec).
+ * @param _bytes: the size of the ring's records (frames of up to half
+ * this can be published).
+ * @return a pointer to the new ring, or NULL on error.
+ */
+webs_fanout* webs_fanout_create(size_t _bytes);
+
+/**
+ * maps an existing fanout ring.
+ * @param _fd: the ring's descriptor (duplicated).
+ * @return a pointer to the new handle, or NULL on error.
+ */
+webs_fanout* webs_fanout_open(int _fd);
+
+/**
+ * encodes a text frame once, and publishes it to a fanout ring.
+ * @param _fan: the ring to publish to.
+ * @param _data: a pointer to the data that is to be sent.
+ * @param _n: the number of bytes that are to be sent.
+ * @return the frame's sequence number (these start at 1), or 0 if the
+ * frame is too large for the ring.
+ */
+size_t webs_fanout_publish(webs_fanout* _fan, char* _data, ssize_t _n);
+
+/**
+ * starts a thread that broadcasts every frame published to a fanout
+ * ring (from now on) to a server's clients. a handle can only be
+ * attached to one server.
+ * @param _fan: the ring to consume.
+ * @param _srv: the server whose clients are to be sent the frames.
+ * @return 0 on success, or -1 on error.
+ */
+int webs_fanout_attach(webs_fanout* _fan, webs_server* _srv);
+
+/**
+ * reads a fanout ring consumer's counters.
+ * @param _fan: the consumer's handle.
+ * @param _dst: a pointer to store the counters.
+ */
+void webs_fanout_get_stats(webs_fanout* _fan, struct webs_fanout_stats* _dst);
+
+/**
+ * stops a handle's consumer (if any), and unmaps the ring. the ring
+ * itself lasts until every process has freed (or closed) it.
+ * @param _fan: the handle to be freed.
+ */
+void webs_fanout_free(webs_fanout* _fan);
+
+/**
+ * writes any frames queued for a client immediately, rather
+ * than waiting for the current handler to return.
+ * @param _self: the client whose queue is to be written.
+ * @return -1 on error, or 0 otherwise.
+ */
+int webs_flush(webs_client* _self);
+
+/**
+ * totals the traffic counters of a server's current and
+ * past clients.
+ * @param _srv: the server to be queried.
+ * @param _dst: a pointer to store the resulting counters.
+ */
+void webs_get_stats(webs_server* _srv, struct webs_stats* _dst);
+
 /**
  * sends a pong frame to a client over a websocket.
  * @param _self: the client that the pong is to be sent to.
  */
 void webs_pong(webs_client* _self);
 
+/**
+ * copies a server's message latency histogram (see `sample_every`).
+ * @param _srv: the server to be queried.
+ * @param _dst: the histogram to be filled in.
+ */
+void webs_get_latency(webs_server* _srv, struct webs_latency* _dst);
+
+/**
+ * estimates a percentile of a latency histogram.
+ * @param _lat: the histogram.
+ * @param _p: the percentile (e.g. 99).
+ * @return the upper bound of the bucket holding the percentile, in
+ * microseconds (0 if there are no samples).
+ */
+size_t webs_latency_percentile(struct webs_latency* _lat, double _p);
+
+/**
+ * limits the connections a server accepts, so that a storm of clients
+ * reconnecting at once can't swamp it (or the clients it already
+ * has). while handshakes are limited, they also run at a lower
+ * priority (SCHED_BATCH) than established connections.
+ * @param _srv: the server to be limited.
+ * @param _max_clients: the most connections at once (0 for no limit).
+ * @param _max_handshakes: the most handshakes in progress at once (0
+ * for no limit).
+ * @param _retry_after: over either limit, new connections are sent a
+ * `503` response asking them to retry after this many seconds (or, for
+ * TLS servers, closed). if 0, they are left waiting in the listen
+ * backlog until there is room instead.
+ */
+void webs_set_admission(webs_server* _srv, size_t _max_clients,
+size_t _max_handshakes, int _retry_after);
+
+/**
+ * serves the files in a directory to requests on a server's port that
+ * aren't websocket handshakes (e.g. the page that opens the websocket),
+ * so that no other HTTP server is needed in front of it. files are
+ * sent with sendfile(2), under a cached header carrying an ETag that
+ * changes with the file. a request for a directory is sent its
+ * `index.html`. paths that would leave the directory (including through
+ * a symbolic link) get a `404`, and badly encoded ones a `400`.
+ * @param _srv: the server whose requests are to be answered.
+ * @param _dir: the directory to be served (NULL to stop serving one).
+ * @return -1 if the directory can't be opened, or 0 otherwise.
+ */
+int webs_serve_files(webs_server* _srv, char* _dir);
+
+/**
+ * answers requests for a path on a server's port with a response that
+ * is rendered in advance, e.g. for a load balancer's health checks.
+ * the path is answered ahead of any files served, and like them is
+ * subject to the server's admission control.
+ * @param _srv: the server whose requests are to be answered.
+ * @param _path: the path to be answered (NULL to stop answering one).
+ * @param _body: the (text) body of the response, e.g. "ok".
+ */
+void webs_set_health(webs_server* _srv, char* _path, char* _body);
+
+/**
+ * lets a server's clients resume their sessions after reconnecting,
+ * rather than starting over. each client is given a session, whose
+ * token is sent in a "Webs-Resume" header of the handshake response
+ * (and can be had from webs_resume_token()). the last data frames
+ * written to each session are kept, and for a while after its client
+ * leaves, the session waits to be resumed. a client resumes it by
+ * passing its token, and the number of messages it received in the
+ * session, in a "Webs-Resume: <token> <count>" header or in the query
+ * string ("?resume=<token>&seen=<count>"). it is then sent the messages
+ * it missed, before `on_open`. a client whose session can't be resumed
+ * (it has expired, or the messages it missed are no longer held) is
+ * given a new one, and a new token.
+ * @param _srv: the server.
+ * @param _frames: the most data frames held for each session.
+ * @param _bytes: the most bytes held for each session.
+ * @param _ms: how long a session waits to be resumed.
+ * @note only whole messages are held. a session that missed a message
+ * streamed with webs_send_begin(), or sent with webs_send_file() or
+ * webs_broadcast_file(), can't be resumed. values published with
+ * webs_publish_latest() are all held, none being replaced.
+ * @return -1 on error, or 0 otherwise.
+ */
+int webs_enable_resume(webs_server* _srv, size_t _frames, size_t _bytes,
+size_t _ms);
+
+/**
+ * gets the token a client passes to resume its session.
+ * @param _self: the client.
+ * @return the token, or NULL if the client has no session.
+ */
+char* webs_resume_token(webs_client* _self);
+
+/**
+ * starts recording the messages that a server's clients send (and when
+ * they connect and disconnect) to a capture file, which bench/replay
+ * can drive against a server again later. each message is recorded
+ * with when it was read, its client, its opcode and its length.
+ * @param _srv: the server whose traffic is to be recorded.
+ * @param _path: the file to record to (replaced if it exists).
+ * @param _payloads: set to record each message's payload as well.
+ * @return -1 if the file can't be created, or 0 otherwise.
+ */
+int webs_capture_start(webs_server* _srv, char* _path, int _payloads);
+
+/**
+ * stops recording a server's traffic, and closes the capture file.
+ * @param _srv: the server being recorded.
+ */
+void webs_capture_stop(webs_server* _srv);
+
+/**
+ * pins a server's threads to a set of CPUs. each new client's thread
+ * is pinned to the CPU that recieved the client's packets (see
+ * SO_INCOMING_CPU) if it is in the set, or otherwise to the next CPU
+ * in the set in turn. since client threads allocate their own memory
+ * (and borrow buffers from spares kept for each node), it comes from
+ * the NUMA node local to their CPU.
+ * @param _srv: the server to be pinned.
+ * @param _cpus: the CPUs to use.
+ * @param _n: the number of CPUs (0 to stop pinning new clients).
+ * @return -1 if a CPU doesn't exist, or 0 otherwise.
+ */
+int webs_set_cpus(webs_server* _srv, int* _cpus, size_t _n);
+
+/**
+ * totals the traffic counters of a server's current and past
+ * clients for each CPU, by the CPU each client was placed on.
+ * @param _srv: the server to be queried.
+ * @param _dst: an array to store the counters for each CPU in.
+ * @param _n: the length of `_dst`.
+ * @return the number of entries filled in (at most the number of
+ * CPUs in the system).
+ */
+size_t webs_get_cpu_stats(webs_server* _srv, struct webs_stats* _dst,
+size_t _n);
+
+/**
+ * creates a pool of worker threads, which runs the `on_data`
+ * handlers of any server whose `pool` field is set to it (or its
+ * `on_data_batch` handler, with as many of a client's waiting messages
+ * as a batch holds).
+ * @param _threads: the number of worker threads.
+ * @param _max_jobs: the most messages that may wait to be handled
+ * for one client before reading from that client is paused.
+ * @return a pointer to the new pool, or NULL on error.
+ */
+webs_pool* webs_pool_create(size_t _threads, size_t _max_jobs);
+
+/**
+ * stops and frees a worker pool. servers using the pool should be
+ * closed first.
+ * @param _pool: the pool to be freed.
+ */
+void webs_pool_free(webs_pool* _pool);
+
 /**
  * blocks until a server's thread closes (likely the
- * server has been closed with a call to "webs_close()").
+ * server has been closed with a call to "webs_close()"). a server on a
+ * runtime has no thread of its own, and is waited for until it stops
+ * listening.
  * @param _srv: the server that is to be waited for.
- * @return the result of pthread_join(), or -1 if NULL
- * was provided.
+ * @return the result of pthread_join() (0 for a server on a runtime),
+ * or -1 if NULL was provided.
  */
 int webs_hold(webs_server* _srv);
 
@@ -277,10 +1280,107 @@ int webs_hold(webs_server* _srv);
  */
 webs_server* webs_start(int _port);
 
+/**
+ * initialises a websocket server listening on a specific address.
+ * @param _addr: the numeric IPv4 or IPv6 address to listen on (e.g.
+ * "127.0.0.1" or "::1"), or NULL for every IPv4 address.
+ * @param _port: the port to listen on.
+ * @return 0 if the server could not be created, or a pointer
+ * to the newly created server otherwise.
+ */
+webs_server* webs_start_at(char* _addr, int _port);
+
+/**
+ * creates a runtime, whose thread (and worker pool) can be shared by
+ * several servers, see webs_start_on(). the runtime accepts every
+ * server's connections, and watches their parked ones, but a connection
+ * that is busy still has a thread of its own while it is (see
+ * `park_ms`).
+ * @param _workers: threads in the runtime's worker pool (0 for none,
+ * so that handlers run on each client's own thread).
+ * @param _max_jobs: the pool's `max_jobs` (see webs_pool_create()).
+ * @return a pointer to the new runtime, or NULL on error.
+ */
+webs_runtime* webs_runtime_create(size_t _workers, size_t _max_jobs);
+
+/**
+ * stops a runtime and frees it (along with its worker pool). every
+ * server started on it should be closed (and have emptied) first.
+ * @param _rt: the runtime to be freed.
+ */
+void webs_runtime_free(webs_runtime* _rt);
+
+/**
+ * initialises a websocket server on a runtime. rather than having a
+ * thread of its own to accept connections, and another to watch its
+ * parked connections, the server shares the runtime's thread (and
+ * its worker pool). its connections are parked after
+ * WEBS_RUNTIME_PARK_MS, so that idle ones hold no thread either.
+ * @param _rt: the runtime to use.
+ * @param _port: the port to listen on.
+ * @param _events: the server's handlers (copied), or NULL to set them
+ * later.
+ * @note webs_hold() on such a server waits for it to stop listening.
+ * @return 0 if the server could not be created, or a pointer
+ * to the newly created server otherwise.
+ */
+webs_server* webs_start_on(webs_runtime* _rt, int _port,
+struct webs_event_list* _events);
+
+/**
+ * initialises a websocket server listening on a unix domain socket,
+ * e.g. for a proxy on the same host. any existing file at the path
+ * is replaced, and the file is left in place when the server closes.
+ * @param _path: the path of the socket.
+ * @return 0 if the server could not be created, or a pointer
+ * to the newly created server otherwise.
+ */
+webs_server* webs_start_unix(char* _path);
+
+/**
+ * initialises a websocket server using a listening socket handed
+ * off by another process's call to webs_handoff().
+ * @param _path: the unix socket path the other process is waiting on.
+ * @return 0 if the server could not be created, or a pointer
+ * to the newly created server otherwise.
+ */
+webs_server* webs_start_inherit(char* _path);
+
+/**
+ * initialises a websocket server that accepts TLS (wss://)
+ * connections. where the kernel supports it, encryption is
+ * handed to kernel TLS once the handshake completes, otherwise
+ * OpenSSL encrypts in userspace.
+ * @param _port: the port to listen on.
+ * @param _cert: path to a PEM certificate (chain) file.
+ * @param _key: path to the PEM private key for `_cert`.
+ * @note requires webs to be compiled with WEBS_TLS defined.
+ * @return 0 if the server could not be created, or a pointer
+ * to the newly created server otherwise.
+ */
+webs_server* webs_start_tls(int _port, char* _cert, char* _key);
+
+/**
+ * initialises a websocket server, as webs_start_at(), webs_start_unix(),
+ * webs_start_tls() and webs_start_on() do, but with its handlers and
+ * `user` set before it accepts its first connection (they are otherwise
+ * set once the server has started, when clients may already be
+ * connecting).
+ * @param _opts: where and how to start the server.
+ * @note TLS requires webs to be compiled with WEBS_TLS defined.
+ * @return 0 if the server could not be created, or a pointer
+ * to the newly created server otherwise.
+ */
+webs_server* webs_start_with(struct webs_start_opts* _opts);
+
 /* 
  * C89 doesn't officially support 64-bt integer constants, so
  * thats why this mess is here...  (there is a better way)
  */
 uint64_t __WEBS_BIG_ENDIAN_QWORD(uint64_t _x);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* __WEBS_H__ */
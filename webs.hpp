@@ -0,0 +1,570 @@
+#ifndef __WEBS_HPP__
+#define __WEBS_HPP__
+
+/*
+ * an optional, header-only C++17 layer over webs.h. a server's
+ * handlers are the members of a class given as a template parameter,
+ * so each event is a direct (inlinable) call from a generated static
+ * function, and only the events the class handles are registered.
+ * received messages are handed over as views of the library's own
+ * buffers, without being copied.
+ */
+
+#include "webs.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus >= 202002L
+	#include <span>
+#endif
+
+namespace webs {
+
+namespace detail {
+	
+	/*
+	 * element type of a contiguous range (anything std::data() and
+	 * std::size() accept, e.g. std::string, std::vector, std::array,
+	 * std::string_view or std::span).
+	 */
+	template <class R>
+	using element_t = std::remove_cv_t<std::remove_pointer_t<
+		decltype(std::data(std::declval<const R&>()))>>;
+	
+	template <class R, class = void>
+	struct is_contiguous : std::false_type {};
+	
+	template <class R>
+	struct is_contiguous<R, std::void_t<element_t<R>,
+		decltype(std::size(std::declval<const R&>()))>>
+		: std::is_trivially_copyable<element_t<R>> {};
+	
+	template <class R>
+	using if_contiguous = std::enable_if_t<is_contiguous<R>::value, int>;
+	
+	/*
+	 * the bytes of a contiguous range (the C functions take `char*`,
+	 * but only ever read from it).
+	 */
+	template <class R>
+	char* bytes(const R& _r) noexcept {
+		return const_cast<char*>(reinterpret_cast<const char*>(std::data(_r)));
+	}
+	
+	template <class R>
+	size_t num_bytes(const R& _r) noexcept {
+		return std::size(_r) * sizeof(element_t<R>);
+	}
+	
+	/*
+	 * the opcode a range is sent with: ranges of characters go as text,
+	 * anything else (which needn't be valid UTF-8) as binary.
+	 */
+	template <class R>
+	constexpr int opcode() noexcept {
+	#if __cplusplus >= 202002L
+		if (std::is_same_v<element_t<R>, char8_t>)
+			return 0x1;
+	#endif
+		
+		return std::is_same_v<element_t<R>, char> ? 0x1 : 0x2;
+	}
+
+}
+
+/**
+ * a message being streamed to a client (see webs_send_begin()), which
+ * is ended when the stream goes out of scope (if end() hasn't been
+ * called by then).
+ */
+class stream {
+	public:
+		stream(stream&& _o) noexcept : cli(std::exchange(_o.cli, nullptr)) {}
+		
+		stream& operator=(stream&& _o) noexcept {
+			if (this != &_o) {
+				end();
+				cli = std::exchange(_o.cli, nullptr);
+			}
+			
+			return *this;
+		}
+		
+		stream(const stream&) = delete;
+		stream& operator=(const stream&) = delete;
+		
+		~stream() { end(); }
+		
+		/**
+		 * false if the stream couldn't be started (as another message
+		 * was being streamed to the client), or has ended.
+		 */
+		explicit operator bool() const noexcept { return cli != nullptr; }
+		
+		/**
+		 * sends the next part of the message (see webs_send_chunk()).
+		 * @return the size of the queued frame, or -1 on error.
+		 */
+		template <class R, detail::if_contiguous<R> = 0>
+		int write(const R& _r) const noexcept {
+			if (cli == nullptr) return -1;
+			return webs_send_chunk(cli, detail::bytes(_r), detail::num_bytes(_r));
+		}
+		
+		/**
+		 * finishes the message (see webs_send_end()).
+		 * @return -1 on error (or if it had already ended), or 0 otherwise.
+		 */
+		int end() noexcept {
+			if (cli == nullptr) return -1;
+			return webs_send_end(std::exchange(cli, nullptr));
+		}
+	
+	private:
+		friend class client;
+		explicit stream(webs_client* _cli) noexcept : cli(_cli) {}
+		
+		webs_client* cli;
+};
+
+/**
+ * a handle to a connected client, as handed to a server's handlers.
+ * it doesn't own the connection, and is only valid until the client's
+ * `on_close` handler returns. handles are move-only, so that a client
+ * tracked by a handler (e.g. in a map, from `on_open` to `on_close`)
+ * has exactly one.
+ */
+class client {
+	public:
+		explicit client(webs_client* _cli) noexcept : cli(_cli) {}
+		client(client&& _o) noexcept : cli(std::exchange(_o.cli, nullptr)) {}
+		
+		client& operator=(client&& _o) noexcept {
+			cli = std::exchange(_o.cli, nullptr);
+			return *this;
+		}
+		
+		client(const client&) = delete;
+		client& operator=(const client&) = delete;
+		
+		explicit operator bool() const noexcept { return cli != nullptr; }
+		webs_client* native() const noexcept { return cli; }
+		size_t id() const noexcept { return cli->id; }
+		
+		/**
+		 * the token the client passes to resume its session, and
+		 * whether it has (see webs_enable_resume()).
+		 */
+		const char* resume_token() const noexcept { return webs_resume_token(cli); }
+		bool resumed() const noexcept { return cli->resumed != 0; }
+		
+		/**
+		 * sends a message, from any contiguous range of trivially
+		 * copyable elements (see webs_send_prio(), which, unlike
+		 * webs_sendn(), sends data that starts with a 0 byte). ranges
+		 * of `char` are sent as text, and any others as binary.
+		 * @return the number of bytes queued, or -1 on error.
+		 */
+		template <class R, detail::if_contiguous<R> = 0>
+		int send(const R& _r) const noexcept {
+			return webs_send_prio(cli, detail::bytes(_r), detail::num_bytes(_r),
+				detail::opcode<R>(), WEBS_PRIO_NORMAL);
+		}
+		
+		/**
+		 * sends a message as binary, whatever its elements are.
+		 */
+		template <class R, detail::if_contiguous<R> = 0>
+		int send_binary(const R& _r) const noexcept {
+			return webs_send_prio(cli, detail::bytes(_r), detail::num_bytes(_r),
+				0x2, WEBS_PRIO_NORMAL);
+		}
+		
+		/**
+		 * sends a NUL-terminated string (without its NUL, unlike the
+		 * array a string literal is).
+		 */
+		int send(const char* _s) const noexcept {
+			return webs_send(cli, const_cast<char*>(_s));
+		}
+		
+		/**
+		 * sends a message at a priority (see webs_send_prio()).
+		 */
+		template <class R, detail::if_contiguous<R> = 0>
+		int send_prio(const R& _r, int _prio) const noexcept {
+			return webs_send_prio(cli, detail::bytes(_r), detail::num_bytes(_r),
+				detail::opcode<R>(), _prio);
+		}
+		
+		/**
+		 * starts streaming a message (0x1 for text, 0x2 for binary).
+		 */
+		stream begin(int _op = 0x1) const noexcept {
+			return stream(webs_send_begin(cli, _op) == 0 ? cli : nullptr);
+		}
+		
+		int flush() const noexcept { return webs_flush(cli); }
+		void pong() const noexcept { webs_pong(cli); }
+		void eject() const noexcept { webs_eject(cli); }
+		
+		/**
+		 * the client's `user` pointer, left to handlers to attach
+		 * their own state to.
+		 */
+		template <class T>
+		T* user() const noexcept { return static_cast<T*>(cli->user); }
+		void user(void* _p) const noexcept { cli->user = _p; }
+	
+	private:
+		webs_client* cli;
+};
+
+/**
+ * the messages handed to a handler's `on_batch` in one call, as views
+ * of the client's receive buffer (valid until the handler returns).
+ */
+class batch {
+	public:
+		class iterator {
+			public:
+				using iterator_category = std::random_access_iterator_tag;
+				using value_type = std::string_view;
+				using difference_type = std::ptrdiff_t;
+				using pointer = void;
+				using reference = std::string_view;
+				
+				explicit iterator(const webs_msg* _m) noexcept : m(_m) {}
+				
+				std::string_view operator*() const noexcept {
+					return std::string_view(m->data, m->len);
+				}
+				
+				std::string_view operator[](difference_type _i) const noexcept {
+					return *(*this + _i);
+				}
+				
+				iterator& operator++() noexcept { ++m; return *this; }
+				iterator operator++(int) noexcept { return iterator(m++); }
+				iterator& operator--() noexcept { --m; return *this; }
+				iterator operator--(int) noexcept { return iterator(m--); }
+				iterator& operator+=(difference_type _n) noexcept { m += _n; return *this; }
+				iterator& operator-=(difference_type _n) noexcept { m -= _n; return *this; }
+				iterator operator+(difference_type _n) const noexcept { return iterator(m + _n); }
+				iterator operator-(difference_type _n) const noexcept { return iterator(m - _n); }
+				difference_type operator-(iterator _o) const noexcept { return m - _o.m; }
+				
+				bool operator==(iterator _o) const noexcept { return m == _o.m; }
+				bool operator!=(iterator _o) const noexcept { return m != _o.m; }
+				bool operator<(iterator _o) const noexcept { return m < _o.m; }
+				bool operator>(iterator _o) const noexcept { return m > _o.m; }
+				bool operator<=(iterator _o) const noexcept { return m <= _o.m; }
+				bool operator>=(iterator _o) const noexcept { return m >= _o.m; }
+			
+			private:
+				const webs_msg* m;
+		};
+		
+		batch(const webs_msg* _msgs, size_t _n) noexcept : msgs(_msgs), n(_n) {}
+		
+		size_t size() const noexcept { return n; }
+		bool empty() const noexcept { return n == 0; }
+		iterator begin() const noexcept { return iterator(msgs); }
+		iterator end() const noexcept { return iterator(msgs + n); }
+		
+		std::string_view operator[](size_t _i) const noexcept {
+			return std::string_view(msgs[_i].data, msgs[_i].len);
+		}
+	
+	private:
+		const webs_msg* msgs;
+		size_t n;
+};
+
+#if __cplusplus >= 202002L
+	/**
+	 * a received message, as bytes rather than characters.
+	 */
+	inline std::span<const std::byte> as_bytes(std::string_view _msg) noexcept {
+		return std::as_bytes(std::span<const char>(_msg.data(), _msg.size()));
+	}
+#endif
+
+namespace detail {
+	
+	/*
+	 * detects which handlers a class has (each is only registered with
+	 * the server if it does).
+	 */
+	#define __WEBS_HPP_HANDLER(NAME, ARGS) \
+		template <class H, class = void> \
+		struct has_##NAME : std::false_type {}; \
+		template <class H> \
+		struct has_##NAME<H, std::void_t<decltype(std::declval<H&>().NAME ARGS)>> \
+			: std::true_type {};
+	
+	__WEBS_HPP_HANDLER(on_open, (std::declval<client&>()))
+	__WEBS_HPP_HANDLER(on_close, (std::declval<client&>()))
+	__WEBS_HPP_HANDLER(on_ping, (std::declval<client&>()))
+	__WEBS_HPP_HANDLER(on_pong, (std::declval<client&>()))
+	__WEBS_HPP_HANDLER(on_error, (std::declval<client&>(), std::declval<enum webs_error>()))
+	__WEBS_HPP_HANDLER(on_data, (std::declval<client&>(), std::declval<std::string_view>()))
+	__WEBS_HPP_HANDLER(on_batch, (std::declval<client&>(), std::declval<batch>()))
+	
+	#undef __WEBS_HPP_HANDLER
+	
+	/*
+	 * a server's handler object, kept alive (at a fixed address) until
+	 * the server has been freed.
+	 */
+	template <class H>
+	struct state {
+		template <class... A>
+		explicit state(A&&... _args) : handler(std::forward<A>(_args)...) {}
+		
+		H handler;
+		std::mutex lock;
+		std::condition_variable cond;
+		bool freed = false;
+	};
+	
+	/*
+	 * the functions registered with the server, each of which calls its
+	 * handler directly.
+	 */
+	template <class H>
+	struct dispatch {
+		static H& handler(webs_client* _cli) noexcept {
+			return static_cast<state<H>*>(_cli->srv->user)->handler;
+		}
+		
+		static int on_open(webs_client* _cli) noexcept {
+			client c(_cli);
+			handler(_cli).on_open(c);
+			return 0;
+		}
+		
+		static int on_close(webs_client* _cli) noexcept {
+			client c(_cli);
+			handler(_cli).on_close(c);
+			return 0;
+		}
+		
+		static int on_ping(webs_client* _cli) noexcept {
+			client c(_cli);
+			handler(_cli).on_ping(c);
+			return 0;
+		}
+		
+		static int on_pong(webs_client* _cli) noexcept {
+			client c(_cli);
+			handler(_cli).on_pong(c);
+			return 0;
+		}
+		
+		static int on_error(webs_client* _cli, enum webs_error _err) noexcept {
+			client c(_cli);
+			handler(_cli).on_error(c, _err);
+			return 0;
+		}
+		
+		static int on_data(webs_client* _cli, char* _data, ssize_t _n) noexcept {
+			client c(_cli);
+			handler(_cli).on_data(c, std::string_view(_data, _n));
+			return 0;
+		}
+		
+		static int on_batch(webs_client* _cli, const webs_msg* _msgs, size_t _n) noexcept {
+			client c(_cli);
+			handler(_cli).on_batch(c, batch(_msgs, _n));
+			return 0;
+		}
+		
+		static void on_free(void* _st) noexcept {
+			state<H>* st = static_cast<state<H>*>(_st);
+			std::lock_guard<std::mutex> guard(st->lock);
+			
+			st->freed = true;
+			st->cond.notify_all();
+		}
+		
+		static webs_event_list events() noexcept {
+			webs_event_list ev = {};
+			
+			if constexpr (has_on_open<H>::value) ev.on_open = &on_open;
+			if constexpr (has_on_close<H>::value) ev.on_close = &on_close;
+			if constexpr (has_on_ping<H>::value) ev.on_ping = &on_ping;
+			if constexpr (has_on_pong<H>::value) ev.on_pong = &on_pong;
+			if constexpr (has_on_error<H>::value) ev.on_error = &on_error;
+			if constexpr (has_on_data<H>::value) ev.on_data = &on_data;
+			if constexpr (has_on_batch<H>::value) ev.on_data_batch = &on_batch;
+			
+			return ev;
+		}
+	};
+
+}
+
+/**
+ * a server whose handlers are the members of `Handler`, any of:
+ *   on_open(client&), on_close(client&), on_ping(client&),
+ *   on_pong(client&), on_error(client&, webs_error),
+ *   on_data(client&, std::string_view), on_batch(client&, batch)
+ * (`on_batch` takes the place of `on_data`, as `on_data_batch` does).
+ * handlers are called from the library's threads, must be safe to call
+ * concurrently (for different clients), and must not throw.
+ *
+ * servers are move-only. destroying one closes it, then waits for its
+ * clients to leave, so that no handler is running (or will run) once
+ * it has been destroyed (and it mustn't be destroyed by a handler).
+ */
+template <class Handler>
+class server {
+	public:
+		server() noexcept = default;
+		server(server&& _o) noexcept
+			: srv(std::exchange(_o.srv, nullptr)), st(std::exchange(_o.st, nullptr)),
+			closed(_o.closed) {}
+		
+		server& operator=(server&& _o) noexcept {
+			if (this != &_o) {
+				reset();
+				srv = std::exchange(_o.srv, nullptr);
+				st = std::exchange(_o.st, nullptr);
+				closed = _o.closed;
+			}
+			
+			return *this;
+		}
+		
+		server(const server&) = delete;
+		server& operator=(const server&) = delete;
+		
+		~server() { reset(); }
+		
+		/**
+		 * starts a server (see webs_start(), webs_start_at() and so on),
+		 * constructing its handler from `_args`.
+		 * @return a server, which is false if it couldn't be started.
+		 */
+		template <class... A>
+		static server start(int _port, A&&... _args) {
+			webs_start_opts opts = {};
+			opts.port = _port;
+			return start_with(opts, std::forward<A>(_args)...);
+		}
+		
+		template <class... A>
+		static server start_at(const char* _addr, int _port, A&&... _args) {
+			webs_start_opts opts = {};
+			opts.addr = const_cast<char*>(_addr);
+			opts.port = _port;
+			return start_with(opts, std::forward<A>(_args)...);
+		}
+		
+		template <class... A>
+		static server start_unix(const char* _path, A&&... _args) {
+			webs_start_opts opts = {};
+			opts.path = const_cast<char*>(_path);
+			return start_with(opts, std::forward<A>(_args)...);
+		}
+		
+		template <class... A>
+		static server start_tls(int _port, const char* _cert, const char* _key,
+		A&&... _args) {
+			webs_start_opts opts = {};
+			opts.port = _port;
+			opts.cert = const_cast<char*>(_cert);
+			opts.key = const_cast<char*>(_key);
+			return start_with(opts, std::forward<A>(_args)...);
+		}
+		
+		template <class... A>
+		static server start_on(webs_runtime* _rt, int _port, A&&... _args) {
+			webs_start_opts opts = {};
+			opts.port = _port;
+			opts.runtime = _rt;
+			return start_with(opts, std::forward<A>(_args)...);
+		}
+		
+		/**
+		 * starts a server from options (see webs_start_with()), e.g.
+		 * TLS on a specific address. its handlers (and `user`) are set
+		 * from the handler before it accepts a connection.
+		 */
+		template <class... A>
+		static server start_with(webs_start_opts _opts, A&&... _args) {
+			auto st = std::make_unique<detail::state<Handler>>(std::forward<A>(_args)...);
+			webs_event_list events = detail::dispatch<Handler>::events();
+			
+			_opts.events = &events;
+			_opts.user = st.get();
+			_opts.on_free = &detail::dispatch<Handler>::on_free;
+			
+			return server(webs_start_with(&_opts), std::move(st));
+		}
+		
+		explicit operator bool() const noexcept { return srv != nullptr; }
+		
+		/**
+		 * the underlying server (for the rest of the C API), which is
+		 * freed some time after close() (and mustn't be passed to
+		 * webs_close() directly).
+		 */
+		webs_server* native() const noexcept { return srv; }
+		Handler& handler() const noexcept { return st->handler; }
+		
+		/**
+		 * closes the server (see webs_close()), without waiting for its
+		 * clients to leave.
+		 */
+		void close() noexcept {
+			if (srv && !closed) {
+				closed = true;
+				webs_close(srv);
+			}
+		}
+		
+		/**
+		 * blocks until the server has been closed (by close(), from any
+		 * thread) and its clients have all left.
+		 */
+		void wait() noexcept {
+			if (st == nullptr) return;
+			
+			std::unique_lock<std::mutex> guard(st->lock);
+			st->cond.wait(guard, [this] { return st->freed; });
+		}
+	
+	private:
+		server(webs_server* _srv, std::unique_ptr<detail::state<Handler>> _st) noexcept {
+			if (_srv == nullptr)
+				return;
+			
+			srv = _srv;
+			st = _st.release();
+		}
+		
+		void reset() noexcept {
+			close();
+			wait();
+			delete st;
+			srv = nullptr;
+			st = nullptr;
+		}
+		
+		webs_server* srv = nullptr;
+		detail::state<Handler>* st = nullptr;
+		bool closed = false;
+};
+
+}
+
+#endif /* __WEBS_HPP__ */